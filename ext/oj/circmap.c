@@ -0,0 +1,88 @@
+/* circmap.c
+ * Copyright (c) 2017, Peter Ohler
+ * All rights reserved.
+ */
+
+#include <string.h>
+
+#include "circmap.h"
+
+inline static unsigned long
+circ_hash(VALUE obj, unsigned long mask) {
+    // Objects are at least 8 byte aligned so the low bits carry nothing.
+    return (unsigned long)(((uint64_t)obj >> 3) * 0x9E3779B97F4A7C15ULL >> 17) & mask;
+}
+
+static void
+circ_map_grow(CircMap cm) {
+    CircSlot		old = cm->slots;
+    CircSlot		end = old + cm->mask + 1;
+    CircSlot		s;
+    unsigned long	size = (cm->mask + 1) * 4;
+    unsigned long	h;
+
+    if (0 == (cm->slots = ALLOC_N(struct _CircSlot, size))) {
+	rb_raise(rb_eNoMemError, "not enough memory\n");
+    }
+    memset(cm->slots, 0, sizeof(struct _CircSlot) * size);
+    cm->mask = size - 1;
+    for (s = old; s < end; s++) {
+	if (0 != s->obj) {
+	    for (h = circ_hash(s->obj, cm->mask); 0 != cm->slots[h].obj; h = (h + 1) & cm->mask) {
+	    }
+	    cm->slots[h] = *s;
+	}
+    }
+    if (old != cm->slot_array) {
+	xfree(old);
+    }
+}
+
+CircMap
+oj_circ_map_new() {
+    CircMap	cm;
+    
+    if (0 == (cm = ALLOC(struct _CircMap))) {
+	rb_raise(rb_eNoMemError, "not enough memory\n");
+    }
+    memset(cm->slot_array, 0, sizeof(cm->slot_array));
+    cm->slots = cm->slot_array;
+    cm->mask = sizeof(cm->slot_array) / sizeof(struct _CircSlot) - 1;
+    cm->cnt = 0;
+    
+    return cm;
+}
+
+void
+oj_circ_map_free(CircMap cm) {
+    if (cm->slots != cm->slot_array) {
+	xfree(cm->slots);
+    }
+    xfree(cm);
+}
+
+// Returns the id of the object or 0 if it was not in the map. When not found
+// the object is added and slot is set to where the new id should be written.
+slot_t
+oj_circ_map_get(CircMap cm, VALUE obj, slot_t **slot) {
+    CircSlot	s;
+    
+    for (s = cm->slots + circ_hash(obj, cm->mask); 0 != s->obj; s = cm->slots + ((s - cm->slots + 1) & cm->mask)) {
+	if (obj == s->obj) {
+	    *slot = &s->id;
+	    return s->id;
+	}
+    }
+    // Keep the map no more than half full so probe runs stay short.
+    if (cm->mask < (cm->cnt + 1) * 2) {
+	circ_map_grow(cm);
+	for (s = cm->slots + circ_hash(obj, cm->mask); 0 != s->obj; s = cm->slots + ((s - cm->slots + 1) & cm->mask)) {
+	}
+    }
+    cm->cnt++;
+    s->obj = obj;
+    s->id = 0;
+    *slot = &s->id;
+
+    return 0;
+}
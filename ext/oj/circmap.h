@@ -0,0 +1,34 @@
+/* circmap.h
+ * Copyright (c) 2017, Peter Ohler
+ * All rights reserved.
+ */
+
+#ifndef __OJ_CIRCMAP_H__
+#define __OJ_CIRCMAP_H__
+
+#include "ruby.h"
+#include "stdint.h"
+
+typedef uint64_t	slot_t;
+
+typedef struct _CircSlot {
+    VALUE	obj;	// 0 if the slot is empty
+    slot_t	id;
+} *CircSlot;
+
+// An open addressing map from the objects already dumped to their circular
+// reference ids. The first slots are part of the map itself so small graphs
+// do not allocate anything else.
+typedef struct _CircMap {
+    struct _CircSlot	slot_array[256];
+    CircSlot		slots;
+    unsigned long	mask;	// slot count - 1
+    unsigned long	cnt;
+} *CircMap;
+
+extern CircMap	oj_circ_map_new(void);
+extern void	oj_circ_map_free(CircMap cm);
+
+extern slot_t	oj_circ_map_get(CircMap cm, VALUE obj, slot_t **slot);
+
+#endif /* __OJ_CIRCMAP_H__ */
@@ -197,31 +197,14 @@ oj_code_attrs(VALUE obj, Attr attrs, int depth, Out out, bool with_class) {
 		default:	oj_dump_time(attrs->time, out, false);	break;
 		}
 	    } else {
-		char	buf[32];
-		char	*b = buf + sizeof(buf) - 1;
-		int	neg = 0;
 		long	num = attrs->num;
-	    
+
+		assure_size(out, 24);
 		if (0 > num) {
-		    neg = 1;
-		    num = -num;
-		}
-		*b-- = '\0';
-		if (0 < num) {
-		    for (; 0 < num; num /= 10, b--) {
-			*b = (num % 10) + '0';
-		    }
-		    if (neg) {
-			*b = '-';
-		    } else {
-			b++;
-		    }
+		    *out->cur++ = '-';
+		    out->cur = oj_fill_ulong(out->cur, -(unsigned long)num);
 		} else {
-		    *b = '0';
-		}
-		assure_size(out, (sizeof(buf) - (b - buf)));
-		for (; '\0' != *b; b++) {
-		    *out->cur++ = *b;
+		    out->cur = oj_fill_ulong(out->cur, (unsigned long)num);
 		}
 	    }
 	} else {
@@ -29,11 +29,12 @@ hash_set_cstr(ParseInfo pi, Val kval, const char *str, size_t len, const char *o
 	parent->classname = oj_strndup(str, len);
 	parent->clen = len;
     } else {
-	volatile VALUE	rstr = rb_str_new(str, len);
+	volatile VALUE	rstr = cstr_to_value(pi, str, len);
 
-	if (Qundef == rkey) {
+	if (Qundef == rkey && str_cache_active(&pi->key_cache)) {
+	    rkey = oj_str_cache_intern(&pi->key_cache, key, klen);
+	} else if (Qundef == rkey) {
 	    rkey = rb_str_new(key, klen);
-	    rstr = oj_encode(rstr);
 	    rkey = oj_encode(rkey);
 	    if (Yes == pi->options.sym_key) {
 		rkey = rb_str_intern(rkey);
@@ -97,6 +98,9 @@ calc_hash_key(ParseInfo pi, Val parent) {
     volatile VALUE	rkey = parent->key_val;
 
     if (Qundef == rkey) {
+	if (str_cache_active(&pi->key_cache)) {
+	    return oj_str_cache_intern(&pi->key_cache, parent->key, parent->klen);
+	}
 	rkey = rb_str_new(parent->key, parent->klen);
     }
     rkey = oj_encode(rkey);
@@ -108,9 +112,7 @@ calc_hash_key(ParseInfo pi, Val parent) {
 
 static void
 add_cstr(ParseInfo pi, const char *str, size_t len, const char *orig) {
-    volatile VALUE	rstr = rb_str_new(str, len);
-
-    rstr = oj_encode(rstr);
+    volatile VALUE	rstr = cstr_to_value(pi, str, len);
     if (Yes == pi->options.create_ok && NULL != pi->options.str_rx.head) {
 	VALUE	clas = oj_rxclass_match(&pi->options.str_rx, str, (int)len);
 
@@ -177,9 +179,7 @@ array_append_num(ParseInfo pi, NumInfo ni) {
 
 static void
 array_append_cstr(ParseInfo pi, const char *str, size_t len, const char *orig) {
-    volatile VALUE	rstr = rb_str_new(str, len);
-
-    rstr = oj_encode(rstr);
+    volatile VALUE	rstr = cstr_to_value(pi, str, len);
     if (Yes == pi->options.create_ok && NULL != pi->options.str_rx.head) {
 	VALUE	clas = oj_rxclass_match(&pi->options.str_rx, str, (int)len);
 
@@ -265,10 +265,8 @@ hash_cb(VALUE key, VALUE value, Out out) {
     }
     switch (rb_type(key)) {
     case T_STRING:
-	oj_dump_str(key, 0, out, false);
-	break;
     case T_SYMBOL:
-	oj_dump_sym(key, 0, out, false);
+	oj_dump_key(key, out);
 	break;
     default:
 	oj_dump_str(rb_funcall(key, oj_to_s_id, 0), 0, out, false);
@@ -624,7 +622,8 @@ dump_obj_attrs(VALUE obj, VALUE clas, slot_t id, int depth, Out out) {
 	    *out->cur++ = ',';
 	}
 	// message
-	assure_size(out, 2);
+	size = d2 * out->indent + 2;
+	assure_size(out, size);
 	fill_indent(out, d2);
 	oj_dump_cstr("~mesg", 5, 0, 0, out);
 	*out->cur++ = ':';
@@ -643,6 +642,7 @@ dump_obj_attrs(VALUE obj, VALUE clas, slot_t id, int depth, Out out) {
 #endif
     out->depth = depth;
 
+    assure_size(out, depth * out->indent + 2);
     fill_indent(out, depth);
     *out->cur++ = '}';
     *out->cur = '\0';
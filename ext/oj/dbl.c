@@ -0,0 +1,505 @@
+/* dbl.c
+ * Copyright (c) 2017, Peter Ohler
+ * All rights reserved.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ruby.h"
+#include "ruby/util.h"
+#include "dbl.h"
+#include "pow5.h"
+#include "ryu.h"
+
+#define MANT_BITS	52
+#define MIN_EXP		-1023
+#define INF_POWER	0x7FF
+#define MAX_DIGITS	19
+#define EXP_LIMIT	1000000
+
+typedef struct _U128 {
+    uint64_t	hi;
+    uint64_t	lo;
+} U128;
+
+// Powers of ten that are exact as doubles.
+static const double	pow10_exact[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+inline static U128
+mul64(uint64_t a, uint64_t b) {
+    U128	r;
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128	p = (unsigned __int128)a * b;
+
+    r.hi = (uint64_t)(p >> 64);
+    r.lo = (uint64_t)p;
+#else
+    uint64_t	a0 = (uint32_t)a;
+    uint64_t	a1 = a >> 32;
+    uint64_t	b0 = (uint32_t)b;
+    uint64_t	b1 = b >> 32;
+    uint64_t	p00 = a0 * b0;
+    uint64_t	p01 = a0 * b1;
+    uint64_t	p10 = a1 * b0;
+    uint64_t	mid = (p00 >> 32) + (uint32_t)p01 + (uint32_t)p10;
+
+    r.lo = (mid << 32) | (uint32_t)p00;
+    r.hi = a1 * b1 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+#endif
+    return r;
+}
+
+inline static int
+clz64(uint64_t x) {
+#if defined(__GNUC__)
+    return __builtin_clzll(x);
+#else
+    int	cnt = 0;
+
+    for (; 0 == (x & 0x8000000000000000ULL); x <<= 1) {
+	cnt++;
+    }
+    return cnt;
+#endif
+}
+
+// The Eisel-Lemire algorithm as described in "Number Parsing at a Gigabyte
+// per Second" by Daniel Lemire. The mantissa must not be zero. The result
+// is the bit pattern of the positive double. False is returned in the rare
+// cases where the truncated powers of five are not precise enough.
+static bool
+eisel_lemire(uint64_t w, long q, uint64_t *bitsp) {
+    const uint64_t	*p5;
+    U128		prod;
+    U128		p2;
+    uint64_t		mant;
+    int			lz;
+    int			upper;
+    long		power2;
+
+    if (q < POW5_MIN_EXP) {
+	*bitsp = 0;
+	return true;
+    }
+    if (POW5_MAX_EXP < q) {
+	*bitsp = (uint64_t)INF_POWER << MANT_BITS;
+	return true;
+    }
+    lz = clz64(w);
+    w <<= lz;
+    p5 = pow5_128[q - POW5_MIN_EXP];
+    prod = mul64(w, p5[0]);
+    // Only when the bits below the ones that matter are all set can the
+    // lower half of the power change the answer.
+    if ((prod.hi & 0x1FF) == 0x1FF) {
+	p2 = mul64(w, p5[1]);
+	prod.lo += p2.hi;
+	if (p2.hi > prod.lo) {
+	    prod.hi++;
+	}
+    }
+    if (0xFFFFFFFFFFFFFFFFULL == prod.lo && (q < -27 || 55 < q)) {
+	return false;
+    }
+    upper = (int)(prod.hi >> 63);
+    mant = prod.hi >> (upper + 64 - MANT_BITS - 3);
+    power2 = (((152170 + 65536) * q) >> 16) + 63 + upper - lz - MIN_EXP;
+    if (power2 <= 0) { // subnormal
+	if (64 <= -power2 + 1) {
+	    *bitsp = 0;
+	    return true;
+	}
+	mant >>= -power2 + 1;
+	mant += (mant & 1);
+	mant >>= 1;
+	power2 = (mant < ((uint64_t)1 << MANT_BITS)) ? 0 : 1;
+	*bitsp = (mant & ~((uint64_t)1 << MANT_BITS)) | ((uint64_t)power2 << MANT_BITS);
+	return true;
+    }
+    // Exactly half way between two doubles so round to even.
+    if (prod.lo <= 1 && -4 <= q && q <= 23 && 1 == (mant & 3) &&
+	(mant << (upper + 64 - MANT_BITS - 3)) == prod.hi) {
+	mant &= ~(uint64_t)1;
+    }
+    mant += (mant & 1);
+    mant >>= 1;
+    if (((uint64_t)2 << MANT_BITS) <= mant) {
+	mant = (uint64_t)1 << MANT_BITS;
+	power2++;
+    }
+    mant &= ~((uint64_t)1 << MANT_BITS);
+    if (INF_POWER <= power2) {
+	power2 = INF_POWER;
+	mant = 0;
+    }
+    *bitsp = mant | ((uint64_t)power2 << MANT_BITS);
+
+    return true;
+}
+
+bool
+oj_dbl_from_parts(uint64_t mant, long exp10, bool neg, double *dp) {
+    double	d;
+    uint64_t	bits;
+
+    if (0 == mant) {
+	d = 0.0;
+    } else if (mant <= ((uint64_t)1 << 53) && -22 <= exp10 && exp10 <= 22) {
+	// Both the mantissa and the power are exact so there is only one
+	// rounding.
+	d = (double)mant;
+	if (exp10 < 0) {
+	    d /= pow10_exact[-exp10];
+	} else {
+	    d *= pow10_exact[exp10];
+	}
+    } else if (eisel_lemire(mant, exp10, &bits)) {
+	memcpy(&d, &bits, sizeof(d));
+    } else {
+	return false;
+    }
+    *dp = neg ? -d : d;
+
+    return true;
+}
+
+static double
+slow_parse(const char *str, size_t len) {
+    char	buf[256];
+    char	*s = buf;
+    double	d;
+
+    if (sizeof(buf) <= len) {
+	s = ALLOC_N(char, len + 1);
+    }
+    memcpy(s, str, len);
+    s[len] = '\0';
+    d = ruby_strtod(s, NULL);
+    if (buf != s) {
+	xfree(s);
+    }
+    return d;
+}
+
+double
+oj_dbl_parse(const char *str, size_t len) {
+    const char	*s = str;
+    const char	*end = str + len;
+    uint64_t	mant = 0;
+    long	exp10 = 0;
+    int		digits = 0;
+    bool	neg = false;
+    bool	trunc = false;
+    double	d;
+    double	d2;
+
+    if (s < end && ('-' == *s || '+' == *s)) {
+	neg = ('-' == *s);
+	s++;
+    }
+    for (; s < end && '0' <= *s && *s <= '9'; s++) {
+	if (digits < MAX_DIGITS) {
+	    mant = mant * 10 + (*s - '0');
+	    if (0 < mant) {
+		digits++;
+	    }
+	} else {
+	    exp10++;
+	    if ('0' != *s) {
+		trunc = true;
+	    }
+	}
+    }
+    if (s < end && '.' == *s) {
+	for (s++; s < end && '0' <= *s && *s <= '9'; s++) {
+	    if (digits < MAX_DIGITS) {
+		mant = mant * 10 + (*s - '0');
+		exp10--;
+		if (0 < mant) {
+		    digits++;
+		}
+	    } else if ('0' != *s) {
+		trunc = true;
+	    }
+	}
+    }
+    if (s < end && ('e' == *s || 'E' == *s)) {
+	long	e = 0;
+	bool	eneg = false;
+
+	s++;
+	if (s < end && ('-' == *s || '+' == *s)) {
+	    eneg = ('-' == *s);
+	    s++;
+	}
+	for (; s < end && '0' <= *s && *s <= '9'; s++) {
+	    if (e < EXP_LIMIT) {
+		e = e * 10 + (*s - '0');
+	    }
+	}
+	exp10 += eneg ? -e : e;
+    }
+    if (oj_dbl_from_parts(mant, exp10, neg, &d)) {
+	if (!trunc) {
+	    return d;
+	}
+	// The dropped digits only matter if they could push the value over
+	// to the next double.
+	if (oj_dbl_from_parts(mant + 1, exp10, neg, &d2) && d == d2) {
+	    return d;
+	}
+    }
+    return slow_parse(str, len);
+}
+
+inline static uint64_t
+shift_right128(U128 v, int shift) {
+    // Only called with 0 < shift < 64.
+    return (v.hi << (64 - shift)) | (v.lo >> shift);
+}
+
+inline static uint64_t
+mul_shift64(uint64_t m, const uint64_t *mul, int j) {
+    U128	b0 = mul64(m, mul[0]);
+    U128	b2 = mul64(m, mul[1]);
+    U128	sum;
+
+    sum.lo = b0.hi + b2.lo;
+    sum.hi = b2.hi + (sum.lo < b0.hi);
+
+    return shift_right128(sum, j - 64);
+}
+
+inline static uint32_t
+pow5bits(int32_t e) {
+    return (uint32_t)(((e * 1217359) >> 19) + 1);
+}
+
+inline static uint32_t
+log10_pow2(int32_t e) {
+    return (uint32_t)((e * 78913) >> 18);
+}
+
+inline static uint32_t
+log10_pow5(int32_t e) {
+    return (uint32_t)((e * 732923) >> 20);
+}
+
+inline static bool
+multiple_of_pow5(uint64_t v, uint32_t p) {
+    uint32_t	cnt = 0;
+
+    for (; 0 == v % 5; v /= 5) {
+	cnt++;
+    }
+    return p <= cnt;
+}
+
+inline static bool
+multiple_of_pow2(uint64_t v, uint32_t p) {
+    return 0 == (v & (((uint64_t)1 << p) - 1));
+}
+
+// Ryu by Ulf Adams, "Ryu: Fast Float-to-String Conversion". The shortest
+// decimal mantissa that reads back as the same double is placed in outp and
+// the power of ten is returned.
+static int32_t
+ryu(uint64_t bits, uint64_t *outp) {
+    uint64_t	ieee_mant = bits & (((uint64_t)1 << MANT_BITS) - 1);
+    uint32_t	ieee_exp = (uint32_t)((bits >> MANT_BITS) & INF_POWER);
+    int32_t	e2;
+    uint64_t	m2;
+    bool	accept_bounds;
+    uint64_t	mv;
+    uint32_t	mm_shift;
+    uint64_t	vr, vp, vm;
+    int32_t	e10;
+    bool	vm_zeros = false;
+    bool	vr_zeros = false;
+    int32_t	removed = 0;
+    uint8_t	last_removed = 0;
+    uint64_t	output;
+
+    if (0 == ieee_exp) {
+	e2 = 1 + MIN_EXP - MANT_BITS - 2;
+	m2 = ieee_mant;
+    } else {
+	e2 = (int32_t)ieee_exp + MIN_EXP - MANT_BITS - 2;
+	m2 = ((uint64_t)1 << MANT_BITS) | ieee_mant;
+    }
+    accept_bounds = (0 == (m2 & 1));
+    mv = 4 * m2;
+    mm_shift = (0 != ieee_mant || ieee_exp <= 1);
+
+    if (0 <= e2) {
+	uint32_t	q = log10_pow2(e2) - (3 < e2);
+	int32_t		k = POW5_INV_BITCOUNT + pow5bits((int32_t)q) - 1;
+	int32_t		i = -e2 + (int32_t)q + k;
+
+	e10 = (int32_t)q;
+	vr = mul_shift64(4 * m2, pow5_inv_split[q], i);
+	vp = mul_shift64(4 * m2 + 2, pow5_inv_split[q], i);
+	vm = mul_shift64(4 * m2 - 1 - mm_shift, pow5_inv_split[q], i);
+	if (q <= 21) {
+	    // Only one of mp, mv, and mm can be a multiple of 5, if any.
+	    if (0 == mv % 5) {
+		vr_zeros = multiple_of_pow5(mv, q);
+	    } else if (accept_bounds) {
+		vm_zeros = multiple_of_pow5(mv - 1 - mm_shift, q);
+	    } else {
+		vp -= multiple_of_pow5(mv + 2, q);
+	    }
+	}
+    } else {
+	uint32_t	q = log10_pow5(-e2) - (1 < -e2);
+	int32_t		i = -e2 - (int32_t)q;
+	int32_t		k = pow5bits(i) - POW5_BITCOUNT;
+	int32_t		j = (int32_t)q - k;
+
+	e10 = (int32_t)q + e2;
+	vr = mul_shift64(4 * m2, pow5_split[i], j);
+	vp = mul_shift64(4 * m2 + 2, pow5_split[i], j);
+	vm = mul_shift64(4 * m2 - 1 - mm_shift, pow5_split[i], j);
+	if (q <= 1) {
+	    vr_zeros = true;
+	    if (accept_bounds) {
+		vm_zeros = (1 == mm_shift);
+	    } else {
+		vp--;
+	    }
+	} else if (q < 63) {
+	    vr_zeros = multiple_of_pow2(mv, q);
+	}
+    }
+    if (vm_zeros || vr_zeros) {
+	// The rare general case.
+	for (; vm / 10 < vp / 10; removed++) {
+	    vm_zeros &= (0 == vm % 10);
+	    vr_zeros &= (0 == last_removed);
+	    last_removed = (uint8_t)(vr % 10);
+	    vr /= 10;
+	    vp /= 10;
+	    vm /= 10;
+	}
+	if (vm_zeros) {
+	    for (; 0 == vm % 10; removed++) {
+		vr_zeros &= (0 == last_removed);
+		last_removed = (uint8_t)(vr % 10);
+		vr /= 10;
+		vp /= 10;
+		vm /= 10;
+	    }
+	}
+	if (vr_zeros && 5 == last_removed && 0 == vr % 2) {
+	    // Round to even when exactly half way.
+	    last_removed = 4;
+	}
+	output = vr + ((vr == vm && (!accept_bounds || !vm_zeros)) || 5 <= last_removed);
+    } else {
+	bool	round_up = false;
+
+	if (vm / 100 < vp / 100) {
+	    round_up = (50 <= vr % 100);
+	    vr /= 100;
+	    vp /= 100;
+	    vm /= 100;
+	    removed += 2;
+	}
+	for (; vm / 10 < vp / 10; removed++) {
+	    round_up = (5 <= vr % 10);
+	    vr /= 10;
+	    vp /= 10;
+	    vm /= 10;
+	}
+	output = vr + (vr == vm || round_up);
+    }
+    *outp = output;
+
+    return e10 + removed;
+}
+
+int
+oj_dbl_to_s(double d, char *buf) {
+    char	digits[20];
+    char	*b = buf;
+    uint64_t	bits;
+    uint64_t	mant;
+    int		cnt = 0;
+    int		decpt;
+    int		i;
+
+    memcpy(&bits, &d, sizeof(bits));
+    if (0 != (bits >> 63)) {
+	*b++ = '-';
+    }
+    decpt = ryu(bits, &mant);
+    // At least one digit so a zero mantissa still fills digits.
+    i = (int)sizeof(digits);
+    do {
+	digits[--i] = '0' + (char)(mant % 10);
+	mant /= 10;
+    } while (0 < mant);
+    cnt = (int)sizeof(digits) - i;
+    memmove(digits, digits + i, cnt);
+    // Ryu may leave trailing zeros in the mantissa.
+    for (; 1 < cnt && '0' == digits[cnt - 1]; cnt--) {
+	decpt++;
+    }
+    decpt += cnt; // position of the decimal point as with dtoa
+
+    // The rest follows flo_to_s() in numeric.c.
+    if (0 < decpt && decpt <= 16) {
+	if (decpt < cnt) {
+	    memcpy(b, digits, decpt);
+	    b += decpt;
+	    *b++ = '.';
+	    memcpy(b, digits + decpt, cnt - decpt);
+	    b += cnt - decpt;
+	} else {
+	    memcpy(b, digits, cnt);
+	    b += cnt;
+	    for (i = cnt; i < decpt; i++) {
+		*b++ = '0';
+	    }
+	    *b++ = '.';
+	    *b++ = '0';
+	}
+    } else if (-4 < decpt && decpt <= 0) {
+	*b++ = '0';
+	*b++ = '.';
+	for (i = decpt; i < 0; i++) {
+	    *b++ = '0';
+	}
+	memcpy(b, digits, cnt);
+	b += cnt;
+    } else {
+	int	x = decpt - 1;
+
+	*b++ = *digits;
+	*b++ = '.';
+	if (1 < cnt) {
+	    memcpy(b, digits + 1, cnt - 1);
+	    b += cnt - 1;
+	} else {
+	    *b++ = '0';
+	}
+	*b++ = 'e';
+	if (x < 0) {
+	    *b++ = '-';
+	    x = -x;
+	} else {
+	    *b++ = '+';
+	}
+	if (100 <= x) {
+	    *b++ = '0' + x / 100;
+	    x %= 100;
+	}
+	*b++ = '0' + x / 10;
+	*b++ = '0' + x % 10;
+    }
+    return (int)(b - buf);
+}
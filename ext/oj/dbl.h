@@ -0,0 +1,29 @@
+/* dbl.h
+ * Copyright (c) 2017, Peter Ohler
+ * All rights reserved.
+ */
+
+#ifndef __OJ_DBL_H__
+#define __OJ_DBL_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Converts a decimal mantissa and power of ten to the nearest double. The
+// return is false if the result can not be determined without more digits.
+extern bool	oj_dbl_from_parts(uint64_t mant, long exp10, bool neg, double *dp);
+
+// Converts a JSON number to a correctly rounded double. No Ruby objects are
+// created.
+extern double	oj_dbl_parse(const char *str, size_t len);
+
+// Writes the shortest representation of a finite, non-zero double that
+// reads back as the same value, formatted the same way as Float#to_s. The
+// buffer must hold at least OJ_DBL_SIZE bytes. The length is returned and
+// the output is not terminated.
+#define OJ_DBL_SIZE	32
+
+extern int	oj_dbl_to_s(double d, char *buf);
+
+#endif /* __OJ_DBL_H__ */
@@ -7,6 +7,7 @@
 #include <errno.h>
 #if !IS_WINDOWS
 #include <sys/time.h>
+#include <sys/stat.h>
 #endif
 #include <time.h>
 #include <stdio.h>
@@ -16,9 +17,10 @@
 #include <errno.h>
 
 #include "oj.h"
-#include "cache8.h"
 #include "dump.h"
 #include "odd.h"
+#include "dbl.h"
+#include "scan.h"
 
 // Workaround in case INFINITY is not defined in math.h or if the OS is CentOS
 #define OJ_INFINITY (1.0/0.0)
@@ -37,6 +39,18 @@ static size_t	ascii_friendly_size(const uint8_t *str, size_t len);
 
 static const char	hex_chars[17] = "0123456789abcdef";
 
+const char	oj_digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
 // JSON standard except newlines are no escaped
 static char	newline_friendly_chars[256] = "\
 66666666221622666666666666666666\
@@ -320,7 +334,7 @@ oj_check_circular(VALUE obj, Out out) {
     slot_t	*slot;
 
     if (Yes == out->opts->circular) {
-	if (0 == (id = oj_cache8_get(out->circ_cache, obj, &slot))) {
+	if (0 == (id = oj_circ_map_get(out->circ_map, obj, &slot))) {
 	    out->circ_cnt++;
 	    id = out->circ_cnt;
 	    *slot = id;
@@ -341,11 +355,8 @@ oj_check_circular(VALUE obj, Out out) {
 
 void
 oj_dump_time(VALUE obj, Out out, int withZone) {
-    char		buf[64];
-    char		*b = buf + sizeof(buf) - 1;
-    long		size;
-    char		*dot;
     int			neg = 0;
+    int			digits = 9;
     long		one = 1000000000;
 #if HAS_RB_TIME_TIMESPEC
     struct timespec	ts = rb_time_timespec(obj);
@@ -360,29 +371,6 @@ oj_dump_time(VALUE obj, Out out, int withZone) {
 #endif
 #endif
     
-    *b-- = '\0';
-    if (withZone) {
-	long	tzsecs = NUM2LONG(rb_funcall2(obj, oj_utc_offset_id, 0, 0));
-	int	zneg = (0 > tzsecs);
-
-	if (0 == tzsecs && rb_funcall2(obj, oj_utcq_id, 0, 0)) {
-	    tzsecs = 86400;
-	}
-	if (zneg) {
-	    tzsecs = -tzsecs;
-	}
-	if (0 == tzsecs) {
-	    *b-- = '0';
-	} else {
-	    for (; 0 < tzsecs; b--, tzsecs /= 10) {
-		*b = '0' + (tzsecs % 10);
-	    }
-	    if (zneg) {
-		*b-- = '-';
-	    }
-	}
-	*b-- = 'e';
-    }
     if (0 > sec) {
 	neg = 1;
 	sec = -sec;
@@ -391,41 +379,39 @@ oj_dump_time(VALUE obj, Out out, int withZone) {
 	    sec--;
 	}
     }
-    dot = b - 9;
     if (0 < out->opts->sec_prec) {
-	if (9 > out->opts->sec_prec) {
-	    int	i;
-
-	    for (i = 9 - out->opts->sec_prec; 0 < i; i--) {
-		dot++;
-		nsec = (nsec + 5) / 10;
-		one /= 10;
-	    }
+	for (; out->opts->sec_prec < digits; digits--) {
+	    nsec = (nsec + 5) / 10;
+	    one /= 10;
 	}
 	if (one <= nsec) {
 	    nsec -= one;
 	    sec++;
 	}
-	for (; dot < b; b--, nsec /= 10) {
-	    *b = '0' + (nsec % 10);
-	}
-	*b-- = '.';
-    }
-    if (0 == sec) {
-	*b-- = '0';
-    } else {
-	for (; 0 < sec; b--, sec /= 10) {
-	    *b = '0' + (sec % 10);
-	}
     }
+    assure_size(out, 64);
     if (neg) {
-	*b-- = '-';
+	*out->cur++ = '-';
+    }
+    out->cur = oj_fill_ulong(out->cur, (uint64_t)sec);
+    if (0 < out->opts->sec_prec) {
+	*out->cur++ = '.';
+	oj_fill_digits(out->cur, (uint64_t)nsec, digits);
+	out->cur += digits;
+    }
+    if (withZone) {
+	long	tzsecs = NUM2LONG(rb_funcall2(obj, oj_utc_offset_id, 0, 0));
+
+	if (0 == tzsecs && rb_funcall2(obj, oj_utcq_id, 0, 0)) {
+	    tzsecs = 86400;
+	}
+	*out->cur++ = 'e';
+	if (0 > tzsecs) {
+	    *out->cur++ = '-';
+	    tzsecs = -tzsecs;
+	}
+	out->cur = oj_fill_ulong(out->cur, (uint64_t)tzsecs);
     }
-    b++;
-    size = sizeof(buf) - (b - buf) - 1;
-    assure_size(out, size);
-    memcpy(out->cur, b, size);
-    out->cur += size;
     *out->cur = '\0';
 }
 
@@ -455,6 +441,7 @@ oj_dump_xml_time(VALUE obj, Out out) {
 #endif
     long		tzsecs = NUM2LONG(rb_funcall2(obj, oj_utc_offset_id, 0, 0));
     int			tzhour, tzmin;
+    int			len;
     char		tzsign = '+';
 
     assure_size(out, 36);
@@ -501,45 +488,40 @@ oj_dump_xml_time(VALUE obj, Out out) {
         tzmin = (int)(tm->tm_gmtoff / 60) - (tzhour * 60);
     }
 #endif
+    // Years past 9999 take more than four digits so the length comes from
+    // sprintf rather than the format.
     if (0 == nsec || 0 == out->opts->sec_prec) {
 	if (0 == tzsecs && rb_funcall2(obj, oj_utcq_id, 0, 0)) {
-	    sprintf(buf, "%04d-%02d-%02dT%02d:%02d:%02dZ",
-		    tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday,
-		    tm->tm_hour, tm->tm_min, tm->tm_sec);
-	    oj_dump_cstr(buf, 20, 0, 0, out);
+	    len = sprintf(buf, "%04d-%02d-%02dT%02d:%02d:%02dZ",
+			  tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday,
+			  tm->tm_hour, tm->tm_min, tm->tm_sec);
 	} else {
-	    sprintf(buf, "%04d-%02d-%02dT%02d:%02d:%02d%c%02d:%02d",
-		    tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday,
-		    tm->tm_hour, tm->tm_min, tm->tm_sec,
-		    tzsign, tzhour, tzmin);
-	    oj_dump_cstr(buf, 25, 0, 0, out);
+	    len = sprintf(buf, "%04d-%02d-%02dT%02d:%02d:%02d%c%02d:%02d",
+			  tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday,
+			  tm->tm_hour, tm->tm_min, tm->tm_sec,
+			  tzsign, tzhour, tzmin);
 	}
     } else if (0 == tzsecs && rb_funcall2(obj, oj_utcq_id, 0, 0)) {
 	char	format[64] = "%04d-%02d-%02dT%02d:%02d:%02d.%09ldZ";
-	int	len = 30;
 
 	if (9 > out->opts->sec_prec) {
 	    format[32] = '0' + out->opts->sec_prec;
-	    len -= 9 - out->opts->sec_prec;
 	}
-	sprintf(buf, format,
-		tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday,
-		tm->tm_hour, tm->tm_min, tm->tm_sec, nsec);
-	oj_dump_cstr(buf, len, 0, 0, out);
+	len = sprintf(buf, format,
+		      tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday,
+		      tm->tm_hour, tm->tm_min, tm->tm_sec, nsec);
     } else {
 	char	format[64] = "%04d-%02d-%02dT%02d:%02d:%02d.%09ld%c%02d:%02d";
-	int	len = 35;
 
 	if (9 > out->opts->sec_prec) {
 	    format[32] = '0' + out->opts->sec_prec;
-	    len -= 9 - out->opts->sec_prec;
 	}
-	sprintf(buf, format,
-		tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday,
-		tm->tm_hour, tm->tm_min, tm->tm_sec, nsec,
-		tzsign, tzhour, tzmin);
-	oj_dump_cstr(buf, len, 0, 0, out);
+	len = sprintf(buf, format,
+		      tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday,
+		      tm->tm_hour, tm->tm_min, tm->tm_sec, nsec,
+		      tzsign, tzhour, tzmin);
     }
+    oj_dump_cstr(buf, len, 0, 0, out);
 }
 
 void
@@ -563,7 +545,7 @@ oj_dump_obj_to_json_using_params(VALUE obj, Options copts, Out out, int argc, VA
     out->argv = argv;
     out->ropts = NULL;
     if (Yes == copts->circular) {
-	oj_cache8_new(&out->circ_cache);
+	out->circ_map = oj_circ_map_new();
     }
     switch (copts->mode) {
     case StrictMode:	oj_dump_strict_val(obj, 0, out);			break;
@@ -587,82 +569,186 @@ oj_dump_obj_to_json_using_params(VALUE obj, Options copts, Out out, int argc, VA
     }
     *out->cur = '\0';
     if (Yes == copts->circular) {
-	oj_cache8_delete(out->circ_cache);
+	oj_circ_map_free(out->circ_map);
     }
 }
 
-void
-oj_write_obj_to_file(VALUE obj, const char *path, Options copts) {
-    char	buf[4096];
-    struct _Out out;
-    size_t	size;
-    FILE	*f;
-    int		ok;
+typedef struct _WriteArgs {
+    VALUE	obj;
+    Options	copts;
+    Out		out;
+} *WriteArgs;
 
-    out.buf = buf;
-    out.end = buf + sizeof(buf) - BUFFER_EXTRA;
-    out.allocated = false;
-    out.omit_nil = copts->dump_opts.omit_nil;
-    oj_dump_obj_to_json(obj, copts, &out);
-    size = out.cur - out.buf;
-    if (0 == (f = fopen(path, "w"))) {
-	if (out.allocated) {
-	    xfree(out.buf);
+static void
+flush_write(OutFlush flush, const char *buf, size_t len) {
+    if (0 == len) {
+	return;
+    }
+    if (NULL != flush->fp) {
+	if (len != fwrite(buf, 1, len, flush->fp)) {
+	    int	err = ferror(flush->fp);
+
+	    rb_raise(rb_eIOError, "Write failed. [%d:%s]", err, strerror(err));
+	}
+#if !IS_WINDOWS
+    } else if (0 <= flush->fd) {
+	ssize_t	cnt;
+
+	while (0 < len) {
+	    if (0 > (cnt = write(flush->fd, buf, len))) {
+		if (EINTR == errno) {
+		    continue;
+		}
+		rb_raise(rb_eIOError, "Write failed. [%d:%s]", errno, strerror(errno));
+	    }
+	    buf += cnt;
+	    len -= cnt;
 	}
+#endif
+    } else {
+	rb_funcall(flush->io, oj_write_id, 1, rb_str_new(buf, len));
+    }
+}
+
+// Writes all but the last byte of the buffer so the buffer can be reused.
+// The last byte is kept as it may be a trailing comma that is backed over.
+static void
+flush_out(Out out) {
+    size_t	len = out->cur - out->buf - 1;
+
+    flush_write(out->flush, out->buf, len);
+    *out->buf = out->buf[len];
+    out->cur = out->buf + 1;
+}
+
+static VALUE
+protect_write(VALUE ap) {
+    WriteArgs	a = (WriteArgs)ap;
+
+    oj_dump_obj_to_json(a->obj, a->copts, a->out);
+    flush_write(a->out->flush, a->out->buf, a->out->cur - a->out->buf);
+
+    return Qnil;
+}
+
+// Dumps obj through a buffer of OJ_FLUSH_SIZE bytes that is written out each
+// time it fills so the whole document is never held in memory. Returns the
+// rb_protect() state so the caller can clean up before raising.
+static int
+write_obj(VALUE obj, Options copts, OutFlush flush) {
+    struct _Out		out;
+    struct _WriteArgs	a;
+    int			state = 0;
+
+    out.buf = ALLOC_N(char, OJ_FLUSH_SIZE);
+    out.end = out.buf + OJ_FLUSH_SIZE - BUFFER_EXTRA;
+    out.allocated = true;
+    out.omit_nil = copts->dump_opts.omit_nil;
+    out.str = Qnil;
+    out.flush = flush;
+    a.obj = obj;
+    a.copts = copts;
+    a.out = &out;
+    rb_protect(protect_write, (VALUE)&a, &state);
+    xfree(out.buf);
+
+    return state;
+}
+
+// The JSON is written to a temporary file next to path that replaces it only
+// once the dump is complete so a dump that raises leaves path untouched.
+void
+oj_write_obj_to_file(VALUE obj, const char *path, Options copts) {
+    struct _OutFlush	flush;
+    int			state;
+    int			err = 0;
+#if IS_WINDOWS
+    if (0 == (flush.fp = fopen(path, "w"))) {
 	rb_raise(rb_eIOError, "%s", strerror(errno));
     }
-    ok = (size == fwrite(out.buf, 1, size, f));
-    if (out.allocated) {
-	xfree(out.buf);
+#else
+    size_t		plen = strlen(path);
+    char		*tmp = ALLOC_N(char, plen + 8);
+    struct stat		st;
+    mode_t		mask;
+    int			fd;
+
+    memcpy(tmp, path, plen);
+    memcpy(tmp + plen, ".XXXXXX", 8);
+    if (0 > (fd = mkstemp(tmp))) {
+	err = errno;
+	xfree(tmp);
+	rb_raise(rb_eIOError, "%s", strerror(err));
     }
-    fclose(f);
-    if (!ok) {
-	int	err = ferror(f);
-
+    // mkstemp() creates the file readable only by the owner. Keep the mode
+    // of the file being replaced or use the one fopen() would have.
+    if (0 == stat(path, &st)) {
+	fchmod(fd, st.st_mode & 07777);
+    } else {
+	mask = umask(0);
+	umask(mask);
+	fchmod(fd, 0666 & ~mask);
+    }
+    if (0 == (flush.fp = fdopen(fd, "w"))) {
+	err = errno;
+	close(fd);
+	unlink(tmp);
+	xfree(tmp);
+	rb_raise(rb_eIOError, "%s", strerror(err));
+    }
+#endif
+    flush.fd = -1;
+    flush.io = Qnil;
+    state = write_obj(obj, copts, &flush);
+    if (0 != fclose(flush.fp)) {
+	err = errno;
+    }
+#if !IS_WINDOWS
+    if (0 != state || 0 != err) {
+	unlink(tmp);
+    } else if (0 != rename(tmp, path)) {
+	err = errno;
+	unlink(tmp);
+    }
+    xfree(tmp);
+#endif
+    if (0 != state) {
+	rb_jump_tag(state);
+    }
+    if (0 != err) {
 	rb_raise(rb_eIOError, "Write failed. [%d:%s]", err, strerror(err));
     }
 }
 
 void
 oj_write_obj_to_stream(VALUE obj, VALUE stream, Options copts) {
-    char	buf[4096];
-    struct _Out out;
-    ssize_t	size;
-    VALUE	clas = rb_obj_class(stream);
+    struct _OutFlush	flush;
+    VALUE		clas = rb_obj_class(stream);
+    int			state;
 #if !IS_WINDOWS
-    int		fd;
-    VALUE	s;
+    VALUE		s;
 #endif
 
-    out.buf = buf;
-    out.end = buf + sizeof(buf) - BUFFER_EXTRA;
-    out.allocated = false;
-    out.omit_nil = copts->dump_opts.omit_nil;
-    oj_dump_obj_to_json(obj, copts, &out);
-    size = out.cur - out.buf;
+    flush.fp = NULL;
+    flush.fd = -1;
+    flush.io = stream;
     if (oj_stringio_class == clas) {
-	rb_funcall(stream, oj_write_id, 1, rb_str_new(out.buf, size));
+	// written with write()
 #if !IS_WINDOWS
     } else if (rb_respond_to(stream, oj_fileno_id) &&
 	       Qnil != (s = rb_funcall(stream, oj_fileno_id, 0)) &&
-	       0 != (fd = FIX2INT(s))) {
-	if (size != write(fd, out.buf, size)) {
-	    if (out.allocated) {
-		xfree(out.buf);
-	    }
-	    rb_raise(rb_eIOError, "Write failed. [%d:%s]", errno, strerror(errno));
+	       0 != FIX2INT(s)) {
+	// Anything the IO has buffered goes first.
+	if (rb_respond_to(stream, oj_flush_id)) {
+	    rb_funcall(stream, oj_flush_id, 0);
 	}
+	flush.fd = FIX2INT(s);
 #endif
-    } else if (rb_respond_to(stream, oj_write_id)) {
-	rb_funcall(stream, oj_write_id, 1, rb_str_new(out.buf, size));
-    } else {
-	if (out.allocated) {
-	    xfree(out.buf);
-	}
+    } else if (!rb_respond_to(stream, oj_write_id)) {
 	rb_raise(rb_eArgError, "to_stream() expected an IO Object.");
     }
-    if (out.allocated) {
-	xfree(out.buf);
+    if (0 != (state = write_obj(obj, copts, &flush))) {
+	rb_jump_tag(state);
     }
 }
 
@@ -685,6 +771,87 @@ oj_dump_sym(VALUE obj, int depth, Out out, bool as_ok) {
     oj_dump_cstr(sym, strlen(sym), 0, 0, out);
 }
 
+// Hash keys are usually the same few Symbols or frozen Strings over and over
+// so the quoted and escaped form of short keys is kept in a small direct
+// mapped table. Symbols are looked up by ID. A String is looked up by the
+// object and the bytes are compared as well in case the object was collected
+// and the slot reused.
+#define KEY_CACHE_SIZE	512
+#define KEY_CACHE_MASK	(KEY_CACHE_SIZE - 1)
+#define KEY_CACHE_MAX	32
+// Worst case is 6 output bytes for each input byte plus the quotes.
+#define KEY_CACHE_ESC	(KEY_CACHE_MAX * 6 + 2)
+
+typedef struct _KeyCache {
+    VALUE	key;	// ID for a Symbol or the String
+    char	mode;	// escape mode the key was dumped with
+    bool	is_str;
+    uint8_t	len;
+    uint8_t	elen;
+    char	raw[KEY_CACHE_MAX];
+    char	esc[KEY_CACHE_ESC];
+} *KeyCache;
+
+static struct _KeyCache	key_cache[KEY_CACHE_SIZE];
+
+void
+oj_dump_key(VALUE key, Out out) {
+    KeyCache	kc;
+    const char	*str;
+    char	*start;
+    size_t	len;
+    VALUE	k;
+    bool	is_str = (T_STRING == rb_type(key));
+
+    if (is_str) {
+	if (KEY_CACHE_MAX < (size_t)RSTRING_LEN(key) || !OBJ_FROZEN(key)
+#if HAS_ENCODING_SUPPORT
+	    || rb_utf8_encindex() != RB_ENCODING_GET(key)
+#endif
+	    ) {
+	    oj_dump_str(key, 0, out, false);
+	    return;
+	}
+	k = key;
+    } else {
+	k = (VALUE)SYM2ID(key);
+    }
+    kc = &key_cache[((k >> 3) ^ (k >> 11) ^ (VALUE)out->opts->escape_mode) & KEY_CACHE_MASK];
+    if (k == kc->key && is_str == kc->is_str && out->opts->escape_mode == kc->mode) {
+	if (!is_str || ((size_t)RSTRING_LEN(key) == kc->len && 0 == memcmp(RSTRING_PTR(key), kc->raw, kc->len))) {
+	    assure_size(out, kc->elen);
+	    memcpy(out->cur, kc->esc, kc->elen);
+	    out->cur += kc->elen;
+	    return;
+	}
+    }
+    if (is_str) {
+	str = RSTRING_PTR(key);
+	len = RSTRING_LEN(key);
+    } else {
+	str = rb_id2name((ID)k);
+	len = strlen(str);
+	if (KEY_CACHE_MAX < len) {
+	    oj_dump_cstr(str, len, 0, 0, out);
+	    return;
+	}
+    }
+    // Make room for the worst case first so the key is not moved or flushed
+    // while it is being written.
+    assure_size(out, KEY_CACHE_ESC + BUFFER_EXTRA);
+    start = out->cur;
+    oj_dump_cstr(str, len, 0, 0, out);
+    kc->key = k;
+    kc->mode = out->opts->escape_mode;
+    kc->is_str = is_str;
+    kc->len = (uint8_t)len;
+    kc->elen = (uint8_t)(out->cur - start);
+    if (is_str) {
+	memcpy(kc->raw, str, len);
+    }
+    memcpy(kc->esc, start, kc->elen);
+}
+
 static void
 debug_raise(const char *orig, size_t cnt, int line) {
     char	buf[1024];
@@ -707,32 +874,51 @@ oj_dump_cstr(const char *str, size_t cnt, bool is_sym, bool escape1, Out out) {
     size_t	size;
     char	*cmap;
     const char	*orig = str;
+    const char	*end = str + cnt;
+    const char	*run;
+    int		flags;
 
     switch (out->opts->escape_mode) {
     case NLEsc:
 	cmap = newline_friendly_chars;
-	size = newline_friendly_size((uint8_t*)str, cnt);
+	flags = 0;
 	break;
     case ASCIIEsc:
 	cmap = ascii_friendly_chars;
-	size = ascii_friendly_size((uint8_t*)str, cnt);
+	flags = SCAN_ESC_HIBIT;
 	break;
     case XSSEsc:
 	cmap = xss_friendly_chars;
-	size = xss_friendly_size((uint8_t*)str, cnt);
+	flags = SCAN_ESC_HIBIT | SCAN_ESC_HTML;
 	break;
     case JXEsc:
+	// Multibyte characters are checked so the high bit ones all stop.
 	cmap = hixss_friendly_chars;
-	size = hixss_friendly_size((uint8_t*)str, cnt);
+	flags = SCAN_ESC_HIBIT | SCAN_ESC_HTML;
 	break;
     case RailsEsc:
 	cmap = rails_friendly_chars;
-	size = rails_friendly_size((uint8_t*)str, cnt);
+	flags = SCAN_ESC_E2;
 	break;
     case JSONEsc:
     default:
 	cmap = hibit_friendly_chars;
-	size = hibit_friendly_size((uint8_t*)str, cnt);
+	flags = 0;
+    }
+    // Only the part after the first byte that might need an escape has to be
+    // sized byte by byte.
+    run = oj_scan_esc(str, end, flags);
+    size = run - str;
+    if (run < end) {
+	switch (out->opts->escape_mode) {
+	case NLEsc:	size += newline_friendly_size((uint8_t*)run, end - run);	break;
+	case ASCIIEsc:	size += ascii_friendly_size((uint8_t*)run, end - run);		break;
+	case XSSEsc:	size += xss_friendly_size((uint8_t*)run, end - run);		break;
+	case JXEsc:	size += hixss_friendly_size((uint8_t*)run, end - run);		break;
+	case RailsEsc:	size += rails_friendly_size((uint8_t*)run, end - run);		break;
+	case JSONEsc:
+	default:	size += hibit_friendly_size((uint8_t*)run, end - run);		break;
+	}
     }
     assure_size(out, size + BUFFER_EXTRA);
     *out->cur++ = '"';
@@ -752,18 +938,26 @@ oj_dump_cstr(const char *str, size_t cnt, bool is_sym, bool escape1, Out out) {
 	if (is_sym) {
 	    *out->cur++ = ':';
 	}
-	for (; '\0' != *str; str++) {
-	    *out->cur++ = *str;
-	}
+	memcpy(out->cur, str, cnt);
+	out->cur += cnt;
+	str = end;
 	*out->cur++ = '"';
     } else {
-	const char	*end = str + cnt;
 	const char	*check_start = str;
 	
 	if (is_sym) {
 	    *out->cur++ = ':';
 	}
 	for (; str < end; str++) {
+	    // Copy everything up to the next byte that might need an escape
+	    // in one go.
+	    if (str < (run = oj_scan_esc(str, end, flags))) {
+		memcpy(out->cur, str, run - str);
+		out->cur += run - str;
+		if (end <= (str = run)) {
+		    break;
+		}
+	    }
 	    switch (cmap[(uint8_t)*str]) {
 	    case '1':
 		if (JXEsc == out->opts->escape_mode && check_start <= str) {
@@ -892,17 +1086,84 @@ oj_dump_raw(const char *str, size_t cnt, Out out) {
     *out->cur = '\0';
 }
 
+// Sets up out to write into str after its current contents, making room for
+// at least size bytes. The String keeps its length until oj_out_str_done()
+// and is locked until then so a to_json or as_json can not move its memory.
+void
+oj_out_init_str(Out out, VALUE str, size_t size) {
+    long	len = RSTRING_LEN(str);
+
+    rb_str_modify_expand(str, size + BUFFER_EXTRA);
+    rb_str_locktmp(str);
+    out->str = str;
+    out->buf = RSTRING_PTR(str) + len;
+    out->end = out->buf + size;
+    out->cur = out->buf;
+    out->allocated = false;
+}
+
+// A to_json or as_json that dups the String, or a conversion of it to
+// UTF-8, leaves it sharing its memory with the copy. Making it independent
+// again only copies its length so the output written past the length is
+// copied over as well. The shared memory stays alive until the copy is
+// collected, which can not happen before the memcpy. The String must be
+// unlocked.
+static void
+str_out_own(Out out) {
+    char	*ptr = RSTRING_PTR(out->str);
+    long	len = RSTRING_LEN(out->str);
+    long	end = out->cur - ptr;
+    char	*nptr;
+
+    rb_str_modify_expand(out->str, end - len);
+    if (ptr != (nptr = RSTRING_PTR(out->str))) {
+	memcpy(nptr + len, ptr + len, end - len);
+	out->buf = nptr + (out->buf - ptr);
+	out->end = nptr + (out->end - ptr);
+	out->cur = nptr + end;
+    }
+}
+
+// Unlocks the String out writes into and, if the dump finished, sets its
+// length to include the output.
+void
+oj_out_str_done(Out out, bool ok) {
+    rb_str_unlocktmp(out->str);
+    if (ok) {
+	str_out_own(out);
+	rb_str_set_len(out->str, out->cur - RSTRING_PTR(out->str));
+    }
+}
+
 void
 oj_grow_out(Out out, size_t len) {
     size_t  size = out->end - out->buf;
     long    pos = out->cur - out->buf;
     char    *buf;
-	
+
+    if (NULL != out->flush && 1 < pos) {
+	flush_out(out);
+	if ((long)len < out->end - out->cur) {
+	    return;
+	}
+	pos = out->cur - out->buf;
+    }
     size *= 2;
     if (size <= len * 2 + pos) {
 	size += len;
     }
-    if (out->allocated) {
+    if (Qnil != out->str) {
+	// The output is written into the String's own memory so the String
+	// is expanded in place. Its length is only set when the dump is done.
+	long	off;
+
+	rb_str_unlocktmp(out->str);
+	str_out_own(out);
+	off = out->buf - RSTRING_PTR(out->str);
+	rb_str_modify_expand(out->str, off + size + BUFFER_EXTRA - RSTRING_LEN(out->str));
+	rb_str_locktmp(out->str);
+	buf = RSTRING_PTR(out->str) + off;
+    } else if (out->allocated) {
 	buf = REALLOC_N(out->buf, char, (size + BUFFER_EXTRA));
     } else {
 	buf = ALLOC_N(char, (size + BUFFER_EXTRA));
@@ -950,31 +1211,14 @@ oj_dump_false(VALUE obj, int depth, Out out, bool as_ok) {
 
 void
 oj_dump_fixnum(VALUE obj, int depth, Out out, bool as_ok) {
-    char	buf[32];
-    char	*b = buf + sizeof(buf) - 1;
     long long	num = rb_num2ll(obj);
-    int		neg = 0;
 
+    assure_size(out, 24);
     if (0 > num) {
-	neg = 1;
-	num = -num;
-    }
-    *b-- = '\0';
-    if (0 < num) {
-	for (; 0 < num; num /= 10, b--) {
-	    *b = (num % 10) + '0';
-	}
-	if (neg) {
-	    *b = '-';
-	} else {
-	    b++;
-	}
+	*out->cur++ = '-';
+	out->cur = oj_fill_ulong(out->cur, -(unsigned long long)num);
     } else {
-	*b = '0';
-    }
-    assure_size(out, (sizeof(buf) - (b - buf)));
-    for (; '\0' != *b; b++) {
-	*out->cur++ = *b;
+	out->cur = oj_fill_ulong(out->cur, (unsigned long long)num);
     }
     *out->cur = '\0';
 }
@@ -1111,14 +1355,10 @@ oj_dump_float(VALUE obj, int depth, Out out, bool as_ok) {
     } else if (d == (double)(long long int)d) {
 	cnt = snprintf(buf, sizeof(buf), "%.1f", d);
     } else if (0 == out->opts->float_prec) {
-	volatile VALUE	rstr = rb_funcall(obj, oj_to_s_id, 0);
-
-	cnt = (int)RSTRING_LEN(rstr);
-	if ((int)sizeof(buf) <= cnt) {
-	    cnt = sizeof(buf) - 1;
-	}
-	strncpy(buf, rb_string_value_ptr((VALUE*)&rstr), cnt);
-	buf[cnt] = '\0';
+	assure_size(out, OJ_DBL_SIZE);
+	out->cur += oj_dbl_to_s(d, out->cur);
+	*out->cur = '\0';
+	return;
     } else {
 	cnt = oj_dump_float_printf(buf, sizeof(buf), obj, d, out->opts->float_fmt);
     }
@@ -1136,10 +1376,8 @@ oj_dump_float_printf(char *buf, size_t blen, VALUE obj, double d, const char *fo
     // Round off issues at 16 significant digits so check for obvious ones of
     // 0001 and 9999.
     if (17 <= cnt && (0 == strcmp("0001", buf + cnt - 4) || 0 == strcmp("9999", buf + cnt - 4))) {
-	volatile VALUE	rstr = rb_funcall(obj, oj_to_s_id, 0);
-
-	strcpy(buf, rb_string_value_ptr((VALUE*)&rstr));
-	cnt = (int)RSTRING_LEN(rstr);
+	cnt = oj_dbl_to_s(d, buf);
+	buf[cnt] = '\0';
     }
     return cnt;
 }
@@ -14,6 +14,8 @@
 
 // Extra padding at end of buffer.
 #define BUFFER_EXTRA 10
+// Size of the buffer used when dumping to a file or stream.
+#define OJ_FLUSH_SIZE	0x00010000
 
 extern void	oj_dump_nil(VALUE obj, int depth, Out out, bool as_ok);
 extern void	oj_dump_true(VALUE obj, int depth, Out out, bool as_ok);
@@ -23,6 +25,7 @@ extern void	oj_dump_bignum(VALUE obj, int depth, Out out, bool as_ok);
 extern void	oj_dump_float(VALUE obj, int depth, Out out, bool as_ok);
 extern void	oj_dump_str(VALUE obj, int depth, Out out, bool as_ok);
 extern void	oj_dump_sym(VALUE obj, int depth, Out out, bool as_ok);
+extern void	oj_dump_key(VALUE key, Out out);
 extern void	oj_dump_class(VALUE obj, int depth, Out out, bool as_ok);
 
 extern void	oj_dump_raw(const char *str, size_t cnt, Out out);
@@ -35,6 +38,8 @@ extern void	oj_dump_obj_to_s(VALUE obj, Out out);
 extern const char*	oj_nan_str(VALUE obj, int opt, int mode, bool plus, int *lenp);
 
 extern void	oj_grow_out(Out out, size_t len);
+extern void	oj_out_init_str(Out out, VALUE str, size_t size);
+extern void	oj_out_str_done(Out out, bool ok);
 extern long	oj_check_circular(VALUE obj, Out out);
 
 extern void	oj_dump_strict_val(VALUE obj, int depth, Out out);
@@ -68,23 +73,60 @@ fill_indent(Out out, int cnt) {
     }
 }
 
-inline static void
-dump_ulong(unsigned long num, Out out) {
-    char	buf[32];
-    char	*b = buf + sizeof(buf) - 1;
+// Two characters for each number from 00 to 99.
+extern const char	oj_digit_pairs[201];
+
+inline static int
+oj_ulong_digits(uint64_t num) {
+    int	cnt = 1;
 
-    *b-- = '\0';
-    if (0 < num) {
-	for (; 0 < num; num /= 10, b--) {
-	    *b = (num % 10) + '0';
+    for (;;) {
+	if (num < 10) {
+	    return cnt;
+	}
+	if (num < 100) {
+	    return cnt + 1;
+	}
+	if (num < 1000) {
+	    return cnt + 2;
 	}
-	b++;
-    } else {
-	*b = '0';
+	if (num < 10000) {
+	    return cnt + 3;
+	}
+	num /= 10000;
+	cnt += 4;
+    }
+}
+
+// Writes exactly cnt digits, zero padded on the left, two at a time from the
+// right.
+inline static void
+oj_fill_digits(char *s, uint64_t num, int cnt) {
+    char	*b = s + cnt;
+    const char	*d;
+
+    for (; s + 1 < b; num /= 100) {
+	d = oj_digit_pairs + (num % 100) * 2;
+	*--b = d[1];
+	*--b = d[0];
     }
-    for (; '\0' != *b; b++) {
-	*out->cur++ = *b;
+    if (s < b) {
+	*--b = '0' + (num % 10);
     }
+}
+
+inline static char*
+oj_fill_ulong(char *s, uint64_t num) {
+    int	cnt = oj_ulong_digits(num);
+
+    oj_fill_digits(s, num, cnt);
+
+    return s + cnt;
+}
+
+inline static void
+dump_ulong(unsigned long num, Out out) {
+    out->cur = oj_fill_ulong(out->cur, num);
     *out->cur = '\0';
 }
 
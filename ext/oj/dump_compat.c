@@ -6,6 +6,7 @@
 #include "code.h"
 #include "dump.h"
 #include "rails.h"
+#include "dbl.h"
 
 // Workaround in case INFINITY is not defined in math.h or if the OS is CentOS
 #define OJ_INFINITY (1.0/0.0)
@@ -363,6 +364,7 @@ exception_alt(VALUE obj, int depth, Out out) {
 	out->cur += out->opts->dump_opts.after_size;
     }
     dump_array(rb_funcall(obj, backtrace_id, 0), depth, out, false);
+    assure_size(out, depth * out->indent + 2);
     fill_indent(out, depth);
     *out->cur++ = '}';
     *out->cur = '\0';
@@ -412,6 +414,7 @@ range_alt(VALUE obj, int depth, Out out) {
     args[1] = rb_funcall(obj, oj_end_id, 0);
     args[2] = rb_funcall(obj, oj_exclude_end_id, 0);
     dump_values_array(args, depth, out);
+    assure_size(out, depth * out->indent + 2);
     fill_indent(out, depth);
     *out->cur++ = '}';
     *out->cur = '\0';
@@ -615,10 +618,8 @@ dump_float(VALUE obj, int depth, Out out, bool as_ok) {
     } else if (oj_rails_float_opt) {
 	cnt = oj_dump_float_printf(buf, sizeof(buf), obj, d, "%0.16g");
     } else {
-	volatile VALUE	rstr = rb_funcall(obj, oj_to_s_id, 0);
-
-	strcpy(buf, rb_string_value_ptr((VALUE*)&rstr));
-	cnt = (int)RSTRING_LEN(rstr);
+	cnt = oj_dbl_to_s(d, buf);
+	buf[cnt] = '\0';
     }
     assure_size(out, cnt);
     for (b = buf; '\0' != *b; b++) {
@@ -653,10 +654,8 @@ hash_cb(VALUE key, VALUE value, Out out) {
     }
     switch (rb_type(key)) {
     case T_STRING:
-	oj_dump_str(key, 0, out, false);
-	break;
     case T_SYMBOL:
-	oj_dump_sym(key, 0, out, false);
+	oj_dump_key(key, out);
 	break;
     default:
 	/*rb_raise(rb_eTypeError, "In :compat mode all Hash keys must be Strings or Symbols, not %s.\n", rb_class2name(rb_obj_class(key)));*/
@@ -832,6 +831,7 @@ dump_struct(VALUE obj, int depth, Out out, bool as_ok) {
 	}
 	args[cnt] = Qundef;
 	dump_values_array(args, depth, out);
+	assure_size(out, depth * out->indent + 2);
 	fill_indent(out, depth);
 	*out->cur++ = '}';
 	*out->cur = '\0';
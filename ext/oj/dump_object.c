@@ -661,6 +661,7 @@ dump_obj_attrs(VALUE obj, VALUE clas, slot_t id, int depth, Out out) {
 #endif
 	out->depth = depth;
     }
+    assure_size(out, depth * out->indent + 2);
     fill_indent(out, depth);
     *out->cur++ = '}';
     *out->cur = '\0';
@@ -12,6 +12,7 @@
 #include <errno.h>
 
 #include "dump.h"
+#include "dbl.h"
 
 #if !HAS_ENCODING_SUPPORT || defined(RUBINIUS_RUBY)
 #define rb_eEncodingError	rb_eException
@@ -106,14 +107,10 @@ dump_float(VALUE obj, int depth, Out out, bool as_ok) {
 	} else if (d == (double)(long long int)d) {
 	    cnt = snprintf(buf, sizeof(buf), "%.1f", d);
 	} else if (0 == out->opts->float_prec) {
-	    volatile VALUE	rstr = rb_funcall(obj, oj_to_s_id, 0);
-
-	    cnt = (int)RSTRING_LEN(rstr);
-	    if ((int)sizeof(buf) <= cnt) {
-		cnt = sizeof(buf) - 1;
-	    }
-	    strncpy(buf, rb_string_value_ptr((VALUE*)&rstr), cnt);
-	    buf[cnt] = '\0';
+	    assure_size(out, OJ_DBL_SIZE);
+	    out->cur += oj_dbl_to_s(d, out->cur);
+	    *out->cur = '\0';
+	    return;
 	} else {
 	    cnt = oj_dump_float_printf(buf, sizeof(buf), obj, d, out->opts->float_fmt);
 	}
@@ -216,11 +213,7 @@ hash_cb(VALUE key, VALUE value, Out out) {
 	size = depth * out->indent + 1;
 	assure_size(out, size);
 	fill_indent(out, depth);
-	if (rtype == T_STRING) {
-	    oj_dump_str(key, 0, out, false);
-	} else {
-	    oj_dump_sym(key, 0, out, false);
-	}
+	oj_dump_key(key, out);
 	*out->cur++ = ':';
     } else {
 	size = depth * out->opts->dump_opts.indent_size + out->opts->dump_opts.hash_size + 1;
@@ -236,11 +229,7 @@ hash_cb(VALUE key, VALUE value, Out out) {
 		out->cur += out->opts->dump_opts.indent_size;
 	    }
 	}
-	if (rtype == T_STRING) {
-	    oj_dump_str(key, 0, out, false);
-	} else {
-	    oj_dump_sym(key, 0, out, false);
-	}
+	oj_dump_key(key, out);
 	size = out->opts->dump_opts.before_size + out->opts->dump_opts.after_size + 2;
 	assure_size(out, size);
 	if (0 < out->opts->dump_opts.before_size) {
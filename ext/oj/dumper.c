@@ -0,0 +1,197 @@
+/* dumper.c
+ * Copyright (c) 2017, Peter Ohler
+ * All rights reserved.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "oj.h"
+#include "dump.h"
+#include "encode.h"
+
+// Output expected to be no larger than this is written to the kept buffer
+// and copied into the returned String. Anything larger is written straight
+// into the returned String.
+#define DUMPER_COPY_MAX		0x00004000
+// A kept buffer that grew past this is released after the dump.
+#define DUMPER_KEEP_MAX		0x00100000
+#define DUMPER_INIT_SIZE	4096
+
+// A dumper set up once and reused for each dump. The options are read when
+// the dumper is created and the output buffer is kept between dumps.
+typedef struct _Dumper {
+    struct _Options	opts;
+    struct _Out		out;	// kept buffer for small output
+    VALUE		ropts;	// Oj::Options the options are shared with or nil
+    VALUE		arg;	// options Hash handed to to_json and as_json or nil
+    size_t		estimate; // running estimate of the output size
+    bool		busy;	// a dump is in progress
+} *Dumper;
+
+typedef struct _DumpArgs {
+    Dumper	d;
+    Out		out;
+    VALUE	obj;
+} *DumpArgs;
+
+static void
+dumper_mark(void *ptr) {
+    Dumper	d = (Dumper)ptr;
+
+    if (NULL == d) {
+	return;
+    }
+    rb_gc_mark(d->ropts);
+    rb_gc_mark(d->arg);
+}
+
+static void
+dumper_free(void *ptr) {
+    Dumper	d = (Dumper)ptr;
+
+    if (NULL == d) {
+	return;
+    }
+    if (d->out.allocated) {
+	xfree(d->out.buf);
+    }
+    xfree(d);
+}
+
+static void
+reset_out(Dumper d) {
+    if (d->out.allocated) {
+	xfree(d->out.buf);
+    }
+    d->out.buf = ALLOC_N(char, DUMPER_INIT_SIZE);
+    d->out.end = d->out.buf + DUMPER_INIT_SIZE - BUFFER_EXTRA;
+    d->out.allocated = true;
+}
+
+static VALUE
+protect_dump(VALUE ap) {
+    DumpArgs	a = (DumpArgs)ap;
+
+    oj_dump_obj_to_json_using_params(a->obj, &a->d->opts, a->out, (Qnil == a->d->arg) ? 0 : 1, &a->d->arg);
+
+    return Qnil;
+}
+
+/* Document-class: Oj::Dumper
+ *
+ * A dumper that is set up once and then used for any number of dumps. The
+ * options are read when the dumper is created. Small output is written to a
+ * buffer kept from one dump to the next and larger output is written directly
+ * into the returned String, sized from the output of earlier dumps. A dumper
+ * is not reentrant and should not be shared between threads.
+ */
+
+/* Document-method: new
+ * call-seq: new(options=nil)
+ *
+ * Creates a new dumper.
+ *
+ * - *options* [_Hash_|_Oj::Options_] same as default_options
+ */
+static VALUE
+dumper_new(int argc, VALUE *argv, VALUE self) {
+    Dumper		d = ALLOC(struct _Dumper);
+    volatile VALUE	obj;
+
+    memset(d, 0, sizeof(struct _Dumper));
+    d->ropts = Qnil;
+    d->arg = Qnil;
+    d->out.str = Qnil;
+    obj = Data_Wrap_Struct(oj_dumper_class, dumper_mark, dumper_free, d);
+    d->opts = oj_default_options;
+    if (CompatMode == d->opts.mode) {
+	d->opts.dump_opts.nan_dump = WordNan;
+    }
+    if (1 <= argc && Qnil != *argv) {
+	if (T_HASH == rb_type(*argv)) {
+	    d->ropts = rb_funcall(oj_options_class, oj_new_id, 1, *argv);
+	} else if (oj_is_options(*argv)) {
+	    d->ropts = *argv;
+	} else {
+	    rb_raise(rb_eTypeError, "Oj::Dumper options must be a Hash or an Oj::Options.");
+	}
+	oj_parse_options(d->ropts, &d->opts);
+	// to_json and as_json are given the Hash, not an Oj::Options.
+	d->arg = oj_options_hash(d->ropts);
+    }
+    d->out.omit_nil = d->opts.dump_opts.omit_nil;
+    d->out.caller = CALLER_DUMP;
+    reset_out(d);
+
+    return obj;
+}
+
+/* Document-method: dump
+ * call-seq: dump(obj)
+ *
+ * Dumps an Object to a String the same way Oj.dump() does with the options
+ * the dumper was created with.
+ *
+ * - *obj* [_Object_] Object to serialize as an JSON document String
+ *
+ * Returns [_String_] the JSON document.
+ */
+static VALUE
+dumper_dump(VALUE self, VALUE obj) {
+    Dumper		d = (Dumper)DATA_PTR(self);
+    struct _Out		sout;
+    struct _DumpArgs	a;
+    volatile VALUE	rstr = Qnil;
+    size_t		len;
+    int			state = 0;
+
+    if (d->busy) {
+	rb_raise(rb_eRuntimeError, "Oj::Dumper is already dumping.");
+    }
+    a.d = d;
+    a.obj = obj;
+    if (DUMPER_COPY_MAX < d->estimate) {
+	sout = d->out;
+	rstr = rb_str_buf_new(0);
+	oj_out_init_str(&sout, rstr, d->estimate + d->estimate / 8);
+	a.out = &sout;
+    } else {
+	a.out = &d->out;
+    }
+    d->busy = true;
+    rb_protect(protect_dump, (VALUE)&a, &state);
+    d->busy = false;
+    if (0 != state) {
+	if (Qnil != rstr) {
+	    oj_out_str_done(&sout, false);
+	}
+	if (DUMPER_KEEP_MAX < (size_t)(d->out.end - d->out.buf)) {
+	    reset_out(d);
+	}
+	rb_jump_tag(state);
+    }
+    len = a.out->cur - a.out->buf;
+    if (Qnil == rstr) {
+	rstr = rb_str_new(d->out.buf, len);
+	if (DUMPER_KEEP_MAX < (size_t)(d->out.end - d->out.buf)) {
+	    reset_out(d);
+	}
+    } else {
+	oj_out_str_done(&sout, true);
+	if (len < (size_t)rb_str_capacity(rstr) / 2) {
+	    rb_str_resize(rstr, len);
+	}
+    }
+    d->estimate = (0 == d->estimate) ? len : (d->estimate * 3 + len) / 4;
+
+    return oj_encode(rstr);
+}
+
+void
+oj_dumper_init() {
+    oj_dumper_class = rb_define_class_under(Oj, "Dumper", rb_cObject);
+    rb_undef_alloc_func(oj_dumper_class);
+    rb_define_singleton_method(oj_dumper_class, "new", dumper_new, -1);
+    rb_define_method(oj_dumper_class, "dump", dumper_dump, 1);
+}
@@ -30,44 +30,130 @@
 
 #if !IS_WINDOWS
 #include <sys/resource.h>  // for getrlimit() on linux
+#include <sys/mman.h>
 #endif
+#include <sys/stat.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include <math.h>
 #include <errno.h>
 
 #include "oj.h"
 #include "encode.h"
+#include "scan.h"
 
 // maximum to allocate on the stack, arbitrary limit
 #define SMALL_XML	65536
 #define MAX_STACK	100
-//#define BATCH_SIZE	(4096 / sizeof(struct _Leaf) - 1)
-#define BATCH_SIZE	100
-
-typedef struct _Batch {
-    struct _Batch	*next;
-    int			next_avail;
-    struct _Leaf	leaves[BATCH_SIZE];
-} *Batch;
+// Size of the chunk that is part of the doc itself.
+#define CHUNK0_SIZE	(64 * sizeof(struct _Leaf))
+// The first allocated chunk has room for a leaf for every CHUNK_JSON_BYTES
+// bytes of JSON. Each chunk after that is twice the size of the one before up
+// to CHUNK_MAX. Larger chunks were slower as each one is a fresh mmap that
+// has to be faulted in.
+#define CHUNK_JSON_BYTES	32
+#define CHUNK_MIN	0x00001000
+#define CHUNK_MAX	0x00400000
+
+// Leaves are carved out of a few large chunks that are all released together
+// when the doc is freed.
+typedef struct _Chunk {
+    struct _Chunk	*next;
+    char		*cur;
+    char		*end;
+} *Chunk;
+
+// Containers with fewer children than this are searched by walking the
+// elements list instead of being indexed.
+#define INDEX_MIN	8
+// Marks a container that was looked at and is too small to index.
+#define INDEX_NONE	0xFFFFFFFF
+
+// The children of an array in order or the children of a hash in an open
+// addressed table keyed by a hash of the key. Built the first time a path
+// goes through the container.
+typedef struct _ChildIndex {
+    Leaf		*children;
+    size_t		cnt;
+    size_t		mask;	     // hash table size - 1
+} *ChildIndex;
 
 typedef struct _Doc {
     Leaf		data;
     Leaf		*where;	     // points to current location
     Leaf		where_path[MAX_STACK]; // points to head of path
     char		*json;
+    const char		*end;	     // end of json for skipping lazy containers
+    char		*map;	     // index file json is in or 0 if json was allocated
+    size_t		map_len;
     unsigned long	size;	     // number of leaves/branches in the doc
     VALUE		self;
-    Batch		batches;
-    struct _Batch	batch0;
+    ChildIndex		indexes;
+    uint32_t		index_cnt;
+    uint32_t		index_size;
+    Chunk		chunks;	     // most recent chunk first
+    size_t		chunk_size;  // size of the next chunk allocated
+    struct _Chunk	chunk0;
+    uint64_t		chunk0_data[CHUNK0_SIZE / sizeof(uint64_t)];
 } *Doc;
 
+// Index files start with this followed by INDEX_ORDER so a file written on a
+// machine with a different byte order is rejected.
+#define INDEX_MAGIC	"OjDocIx2"
+#define INDEX_ORDER	0x01020304
+
+#if HAS_ST_MTIM
+#define ST_MTIME_NSEC(st)	((int64_t)(st)->st_mtim.tv_nsec)
+#else
+#define ST_MTIME_NSEC(st)	((int64_t)0)
+#endif
+
+// An index file holds the JSON text as it is after parsing, with strings
+// unescaped and values terminated, followed by an IndexLeaf for each leaf in
+// document order. Reopening rebuilds the leaves from the records and uses
+// the text in place so nothing is parsed.
+typedef struct _IndexHead {
+    char	magic[8];
+    uint32_t	order;
+    uint32_t	pad;
+    uint64_t	json_size;	// identity, size and modification time of the JSON file
+    int64_t	json_mtime;
+    int64_t	json_mtime_nsec;
+    uint64_t	json_ino;
+    uint64_t	json_dev;
+    uint64_t	text_len;	// includes the terminating '\0'
+    uint64_t	leaf_cnt;
+    uint64_t	doc_size;
+} *IndexHead;
+
+typedef struct _IndexLeaf {
+    uint64_t	str;		// text offset of str or number of children
+    uint64_t	key;		// text offset of the key or the array index
+    uint8_t	rtype;
+    uint8_t	parent_type;
+    uint8_t	pad[6];
+} *IndexLeaf;
+
+// Options for opening a doc.
+typedef struct _OpenOpts {
+    bool	lazy;		// record nested containers without parsing them
+    const char	*index;		// index file to use or write, 0 for none
+    struct stat	st;		// of the JSON file the index is for
+    char	*map;		// index file to read leaves from instead of parsing
+    size_t	map_len;
+} *OpenOpts;
+
 typedef struct _ParseInfo {
     char	*str;		/* buffer being read from */
     char	*s;		/* current position in buffer */
     Doc		doc;
     void	*stack_min;
+    bool	lazy;		/* record nested containers without parsing them */
+    bool	nested;		/* reading inside a container */
+    OpenOpts	opts;
 } *ParseInfo;
 
 static void	leaf_init(Leaf leaf, int type);
@@ -90,19 +176,23 @@ static Leaf	read_nil(ParseInfo pi);
 static void	next_non_white(ParseInfo pi);
 static char*	read_quoted_value(ParseInfo pi);
 static void	skip_comment(ParseInfo pi);
+static void	expand_lazy(Doc doc, Leaf leaf, bool lazy);
+static void	expand_all(Doc doc, Leaf leaf);
 
 static VALUE	protect_open_proc(VALUE x);
-static VALUE	parse_json(VALUE clas, char *json, bool given, bool allocated);
+static VALUE	parse_json(VALUE clas, char *json, size_t len, bool given, bool allocated, OpenOpts opts);
+static bool	index_read(ParseInfo pi);
+static void	index_write(ParseInfo pi);
 static void	each_leaf(Doc doc, VALUE self);
 static int	move_step(Doc doc, const char *path, int loc);
 static Leaf	get_doc_leaf(Doc doc, const char *path);
-static Leaf	get_leaf(Leaf *stack, Leaf *lp, const char *path);
+static Leaf	get_leaf(Doc doc, Leaf *stack, Leaf *lp, const char *path);
 static void	each_value(Doc doc, Leaf leaf);
 
-static void	doc_init(Doc doc);
+static void	doc_init(Doc doc, size_t len);
 static void	doc_free(Doc doc);
-static VALUE	doc_open(VALUE clas, VALUE str);
-static VALUE	doc_open_file(VALUE clas, VALUE filename);
+static VALUE	doc_open(int argc, VALUE *argv, VALUE clas);
+static VALUE	doc_open_file(int argc, VALUE *argv, VALUE clas);
 static VALUE	doc_where(VALUE self);
 static VALUE	doc_local_key(VALUE self);
 static VALUE	doc_home(VALUE self);
@@ -116,6 +206,9 @@ static VALUE	doc_dump(int argc, VALUE *argv, VALUE self);
 static VALUE	doc_size(VALUE self);
 
 VALUE	oj_doc_class = 0;
+static VALUE	doc_path_class = Qundef;
+static VALUE	lazy_sym = Qundef;
+static VALUE	index_sym = Qundef;
 
 // This is only for CentOS 5.4 with Ruby 1.9.3-p0.
 #ifdef NEEDS_STPCPY
@@ -199,21 +292,39 @@ leaf_init(Leaf leaf, int type) {
     }
 }
 
-inline static Leaf
-leaf_new(Doc doc, int type) {
-    Leaf	leaf;
+static void*
+doc_alloc(Doc doc, size_t size) {
+    void	*mem;
 
-    if (0 == doc->batches || BATCH_SIZE == doc->batches->next_avail) {
-	Batch	b = ALLOC(struct _Batch);
+    size = (size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+    if ((size_t)(doc->chunks->end - doc->chunks->cur) < size) {
+	size_t	csize = doc->chunk_size;
+	Chunk	c;
 
-	// Initializes all leaves with a NO_VAL value_type
-	memset(b, 0, sizeof(struct _Batch));
-	b->next = doc->batches;
-	doc->batches = b;
-	b->next_avail = 0;
+	if (csize < size) {
+	    csize = size;
+	}
+	c = (Chunk)ALLOC_N(char, sizeof(struct _Chunk) + csize);
+	c->cur = (char*)(c + 1);
+	c->end = c->cur + csize;
+	c->next = doc->chunks;
+	doc->chunks = c;
+	if (doc->chunk_size < CHUNK_MAX) {
+	    doc->chunk_size *= 2;
+	}
     }
-    leaf = &doc->batches->leaves[doc->batches->next_avail];
-    doc->batches->next_avail++;
+    mem = doc->chunks->cur;
+    doc->chunks->cur += size;
+
+    return mem;
+}
+
+inline static Leaf
+leaf_new(Doc doc, int type) {
+    Leaf	leaf = (Leaf)doc_alloc(doc, sizeof(struct _Leaf));
+
+    // A key of 0 and index of 0 mean not set.
+    memset(leaf, 0, sizeof(struct _Leaf));
     leaf_init(leaf, type);
 
     return leaf;
@@ -231,8 +342,16 @@ leaf_append_element(Leaf parent, Leaf element) {
     }
 }
 
+inline static void
+leaf_expand(Doc doc, Leaf leaf) {
+    if (LAZY_VAL == leaf->value_type) {
+	expand_lazy(doc, leaf, true);
+    }
+}
+
 static VALUE
 leaf_value(Doc doc, Leaf leaf) {
+    leaf_expand(doc, leaf);
     if (RUBY_VAL != leaf->value_type) {
 	switch (leaf->rtype) {
 	case T_NIL:
@@ -391,6 +510,68 @@ leaf_hash_value(Doc doc, Leaf leaf) {
     return h;
 }
 
+// Moves pi->s past the array or object it is on without building any
+// leaves. Only brackets, strings, and comments are looked at so the contents
+// are not checked until the container is expanded.
+static void
+skip_container(ParseInfo pi) {
+    const char	*s;
+    int		depth = 1;
+
+    if (0 != (s = oj_scan_close(pi->s + 1, pi->doc->end))) {
+	pi->s = (char*)s;
+	return;
+    }
+    // Comments or a bad container, take the slow path.
+    for (s = pi->s + 1; true; s++) {
+	switch (*s) {
+	case '"':
+	    for (s++; '"' != *s; s++) {
+		if ('\0' == *s || ('\\' == *s && '\0' == *++s)) {
+		    raise_error("quoted string not terminated", pi->str, s);
+		}
+	    }
+	    break;
+	case '[':
+	case '{':
+	    depth++;
+	    break;
+	case ']':
+	case '}':
+	    if (0 == --depth) {
+		pi->s = (char*)s + 1;
+		return;
+	    }
+	    break;
+	case '/':
+	    pi->s = (char*)s;
+	    skip_comment(pi);
+	    // A line comment leaves pi->s on the terminator which may be the
+	    // '\0' so back up one to look at it again.
+	    s = ('/' == *pi->s) ? pi->s : pi->s - 1;
+	    break;
+	case '\0':
+	    raise_error("container not terminated", pi->str, s);
+	    break;
+	default:
+	    break;
+	}
+    }
+}
+
+// Records a nested container by where it starts. The children are read by
+// leaf_expand() the first time something looks inside.
+static Leaf
+read_lazy(ParseInfo pi, int type) {
+    Leaf	leaf = leaf_new(pi->doc, type);
+
+    leaf->value_type = LAZY_VAL;
+    leaf->str = pi->s;
+    skip_container(pi);
+
+    return leaf;
+}
+
 static Leaf
 read_next(ParseInfo pi) {
     Leaf	leaf = 0;
@@ -401,10 +582,10 @@ read_next(ParseInfo pi) {
     next_non_white(pi);	// skip white space
     switch (*pi->s) {
     case '{':
-	leaf = read_obj(pi);
+	leaf = (pi->lazy && pi->nested) ? read_lazy(pi, T_HASH) : read_obj(pi);
 	break;
     case '[':
-	leaf = read_array(pi);
+	leaf = (pi->lazy && pi->nested) ? read_lazy(pi, T_ARRAY) : read_array(pi);
 	break;
     case '"':
 	leaf = read_str(pi);
@@ -448,6 +629,7 @@ read_obj(ParseInfo pi) {
     const char	*key = 0;
     Leaf	val = 0;
 
+    pi->nested = true;
     pi->s++;
     next_non_white(pi);
     if ('}' == *pi->s) {
@@ -498,6 +680,7 @@ read_array(ParseInfo pi) {
     char	*end;
     int		cnt = 0;
 
+    pi->nested = true;
     pi->s++;
     next_non_white(pi);
     if (']' == *pi->s) {
@@ -733,25 +916,36 @@ read_quoted_value(ParseInfo pi) {
 
 // doc support functions
 inline static void
-doc_init(Doc doc) {
-    memset(doc, 0, sizeof(struct _Doc));
+doc_init(Doc doc, size_t len) {
+    memset(doc, 0, offsetof(struct _Doc, chunk0_data));
     doc->where = doc->where_path;
     doc->self = Qundef;
-    doc->batches = &doc->batch0;
+    doc->chunk0.cur = (char*)doc->chunk0_data;
+    doc->chunk0.end = doc->chunk0.cur + sizeof(doc->chunk0_data);
+    doc->chunks = &doc->chunk0;
+    doc->chunk_size = len / CHUNK_JSON_BYTES * sizeof(struct _Leaf);
+    if (doc->chunk_size < CHUNK_MIN) {
+	doc->chunk_size = CHUNK_MIN;
+    } else if (CHUNK_MAX < doc->chunk_size) {
+	doc->chunk_size = CHUNK_MAX;
+    }
 }
 
 static void
 doc_free(Doc doc) {
     if (0 != doc) {
-	Batch	b;
+	Chunk	c;
 
-	while (0 != (b = doc->batches)) {
-	    doc->batches = doc->batches->next;
-	    if (&doc->batch0 != b) {
-		xfree(b);
+	while (0 != (c = doc->chunks)) {
+	    doc->chunks = c->next;
+	    if (&doc->chunk0 != c) {
+		xfree(c);
 	    }
 	}
-	//xfree(f);
+	if (0 != doc->indexes) {
+	    xfree(doc->indexes);
+	    doc->indexes = 0;
+	}
     }
 }
 
@@ -759,7 +953,16 @@ static VALUE
 protect_open_proc(VALUE x) {
     ParseInfo	pi = (ParseInfo)x;
 
-    pi->doc->data = read_next(pi); // parse
+    if (0 != pi->opts->map) {
+	if (!index_read(pi)) {
+	    return Qundef; // corrupt index, the caller parses the file instead
+	}
+    } else {
+	pi->doc->data = read_next(pi); // parse
+	if (0 != pi->opts->index) {
+	    index_write(pi);
+	}
+    }
     *pi->doc->where = pi->doc->data;
     pi->doc->where = pi->doc->where_path;
     if (rb_block_given_p()) {
@@ -768,18 +971,52 @@ protect_open_proc(VALUE x) {
     return Qnil;
 }
 
+static void
+index_unmap(char *map, size_t len) {
+#if IS_WINDOWS
+    xfree(map);
+#else
+    munmap(map, len);
+#endif
+}
+
+static void
+doc_free_json(Doc doc) {
+    if (0 != doc->map) {
+	index_unmap(doc->map, doc->map_len);
+	doc->map = 0;
+    } else {
+	xfree(doc->json);
+    }
+}
+
 static void
 free_doc_cb(void *x) {
     Doc	doc = (Doc)x;
 
     if (0 != doc) {
-	xfree(doc->json);
+	doc_free_json(doc);
 	doc_free(doc);
     }
 }
 
+static void
+set_stack_min(ParseInfo pi) {
+#if IS_WINDOWS
+    pi->stack_min = (void*)((char*)pi - (512 * 1024)); // assume a 1M stack and give half to ruby
+#else
+    struct rlimit	lim;
+
+    if (0 == getrlimit(RLIMIT_STACK, &lim)) {
+	pi->stack_min = (void*)((char*)pi - (lim.rlim_cur / 4 * 3)); // let 3/4ths of the stack be used only
+    } else {
+	pi->stack_min = 0; // indicates not to check stack limit
+    }
+#endif
+}
+
 static VALUE
-parse_json(VALUE clas, char *json, bool given, bool allocated) {
+parse_json(VALUE clas, char *json, size_t len, bool given, bool allocated, OpenOpts opts) {
     struct _ParseInfo	pi;
     VALUE		result = Qnil;
     Doc			doc;
@@ -797,21 +1034,12 @@ parse_json(VALUE clas, char *json, bool given, bool allocated) {
 	pi.str = json;
     }
     pi.s = pi.str;
-    doc_init(doc);
+    doc_init(doc, len);
     pi.doc = doc;
-#if IS_WINDOWS
-    pi.stack_min = (void*)((char*)&pi - (512 * 1024)); // assume a 1M stack and give half to ruby
-#else
-    {
-	struct rlimit	lim;
-
-	if (0 == getrlimit(RLIMIT_STACK, &lim)) {
-	    pi.stack_min = (void*)((char*)&lim - (lim.rlim_cur / 4 * 3)); // let 3/4ths of the stack be used only
-	} else {
-	    pi.stack_min = 0; // indicates not to check stack limit
-	}
-    }
-#endif
+    pi.lazy = opts->lazy;
+    pi.nested = false;
+    pi.opts = opts;
+    set_stack_min(&pi);
     // last arg is free func void* func(void*)
 #if HAS_DATA_OBJECT_WRAP
     doc->self = rb_data_object_wrap(clas, doc, 0, free_doc_cb);
@@ -820,15 +1048,23 @@ parse_json(VALUE clas, char *json, bool given, bool allocated) {
 #endif
     rb_gc_register_address(&doc->self);
     doc->json = json;
+    doc->end = json + len;
+    doc->map = opts->map;
+    doc->map_len = opts->map_len;
     DATA_PTR(doc->self) = doc;
     result = rb_protect(protect_open_proc, (VALUE)&pi, &ex);
-    if (given || 0 != ex) {
+    if (given || 0 != ex || Qundef == result) {
 	rb_gc_unregister_address(&doc->self);
 	DATA_PTR(doc->self) = 0;
 	doc_free(pi.doc);
-	if (allocated && 0 != ex) { // will jump so caller will not free
+	if (0 != doc->map) {
+	    index_unmap(doc->map, doc->map_len);
+	} else if (allocated && 0 != ex) { // will jump so caller will not free
 	    xfree(json);
 	}
+	if (!given) {
+	    xfree(doc);
+	}
     } else {
 	result = doc->self;
     }
@@ -838,6 +1074,275 @@ parse_json(VALUE clas, char *json, bool given, bool allocated) {
     return result;
 }
 
+typedef struct _IndexRead {
+    ParseInfo	pi;
+    IndexLeaf	rec;
+    IndexLeaf	end;
+    Leaf	leaves;
+    uint64_t	text_len;
+} *IndexRead;
+
+// Returns 0 if the records are corrupt. The parent_type is the type of the
+// enclosing container or T_NONE for the root.
+static Leaf
+index_leaf(IndexRead ir, uint8_t parent_type) {
+    IndexLeaf	rec = ir->rec;
+    Leaf	leaf;
+
+    if ((void*)&leaf < ir->pi->stack_min) {
+	rb_raise(rb_eSysStackError, "JSON is too deeply nested");
+    }
+    if (ir->end <= rec || parent_type != rec->parent_type) {
+	return 0;
+    }
+    ir->rec++;
+    leaf = ir->leaves++;
+    switch (rec->rtype) {
+    case T_NIL:
+    case T_TRUE:
+    case T_FALSE:
+    case T_FIXNUM:
+    case T_FLOAT:
+    case T_STRING:
+    case T_ARRAY:
+    case T_HASH:
+	break;
+    default:
+	return 0;
+    }
+    memset(leaf, 0, sizeof(struct _Leaf));
+    leaf_init(leaf, rec->rtype);
+    leaf->parent_type = rec->parent_type;
+    if (T_ARRAY == rec->parent_type) {
+	leaf->index = (size_t)rec->key;
+    } else if (T_HASH == rec->parent_type) {
+	if (ir->text_len <= rec->key) {
+	    return 0;
+	}
+	leaf->key = ir->pi->doc->json + rec->key;
+    }
+    if (COL_VAL == leaf->value_type) {
+	uint64_t	cnt = rec->str;
+	Leaf		e;
+
+	if ((uint64_t)(ir->end - ir->rec) < cnt) {
+	    return 0;
+	}
+	for (; 0 < cnt; cnt--) {
+	    if (0 == (e = index_leaf(ir, rec->rtype))) {
+		return 0;
+	    }
+	    leaf_append_element(leaf, e);
+	}
+    } else if (STR_VAL == leaf->value_type) {
+	if (ir->text_len <= rec->str) {
+	    return 0;
+	}
+	leaf->str = ir->pi->doc->json + rec->str;
+    }
+    return leaf;
+}
+
+// Rebuilds the leaves from the records of a mapped index file. All of them
+// come from one allocation. Returns false if the records are corrupt.
+static bool
+index_read(ParseInfo pi) {
+    IndexHead		head = (IndexHead)pi->opts->map;
+    struct _IndexRead	ir;
+
+    pi->doc->size = head->doc_size;
+    pi->doc->data = 0;
+    if (0 == head->leaf_cnt) {
+	return true;
+    }
+    ir.pi = pi;
+    ir.rec = (IndexLeaf)(pi->doc->json + ((head->text_len + 7) & ~(uint64_t)7));
+    ir.end = ir.rec + head->leaf_cnt;
+    ir.leaves = (Leaf)doc_alloc(pi->doc, sizeof(struct _Leaf) * head->leaf_cnt);
+    ir.text_len = head->text_len;
+
+    return (0 != (pi->doc->data = index_leaf(&ir, T_NONE)) && ir.end == ir.rec);
+}
+
+// Maps an index file if it was written for the same JSON file, with the size
+// and modification time in st. Returns 0 if the index is missing or stale.
+static char*
+index_map(const char *path, struct stat *st, size_t *lenp) {
+    struct _IndexHead	head;
+    struct stat		ist;
+    FILE		*f;
+    char		*map;
+    size_t		len;
+
+    if (0 == (f = fopen(path, "rb"))) {
+	return 0;
+    }
+    if (0 != fstat(fileno(f), &ist) || 1 != fread(&head, sizeof(head), 1, f) ||
+	0 != memcmp(head.magic, INDEX_MAGIC, sizeof(head.magic)) || INDEX_ORDER != head.order ||
+	(uint64_t)st->st_size != head.json_size || (int64_t)st->st_mtime != head.json_mtime ||
+	ST_MTIME_NSEC(st) != head.json_mtime_nsec || (uint64_t)st->st_ino != head.json_ino ||
+	(uint64_t)st->st_dev != head.json_dev || 0 == head.text_len) {
+	fclose(f);
+	return 0;
+    }
+    len = sizeof(head) + ((head.text_len + 7) & ~(uint64_t)7) + sizeof(struct _IndexLeaf) * head.leaf_cnt;
+    if ((uint64_t)ist.st_size != len) {
+	fclose(f);
+	return 0;
+    }
+#if IS_WINDOWS
+    map = ALLOC_N(char, len);
+    fseek(f, 0, SEEK_SET);
+    if (len != fread(map, 1, len, f)) {
+	xfree(map);
+	map = 0;
+    }
+#else
+    // MAP_PRIVATE so the pages are shared between processes until written.
+    if (MAP_FAILED == (map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(f), 0))) {
+	map = 0;
+    }
+#endif
+    fclose(f);
+    if (0 != map && '\0' != map[sizeof(head) + head.text_len - 1]) {
+	index_unmap(map, len);
+	map = 0;
+    }
+    *lenp = len;
+
+    return map;
+}
+
+static bool
+index_write_leaf(FILE *f, Doc doc, Leaf leaf, uint64_t *cnt) {
+    struct _IndexLeaf	rec;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.rtype = leaf->rtype;
+    rec.parent_type = leaf->parent_type;
+    if (T_ARRAY == leaf->parent_type) {
+	rec.key = leaf->index;
+    } else if (T_HASH == leaf->parent_type) {
+	rec.key = leaf->key - doc->json;
+    }
+    if (COL_VAL == leaf->value_type && 0 != leaf->elements) {
+	Leaf	first = leaf->elements->next;
+	Leaf	e = first;
+
+	do {
+	    rec.str++;
+	    e = e->next;
+	} while (e != first);
+	if (1 != fwrite(&rec, sizeof(rec), 1, f)) {
+	    return false;
+	}
+	do {
+	    if (!index_write_leaf(f, doc, e, cnt)) {
+		return false;
+	    }
+	    e = e->next;
+	} while (e != first);
+    } else {
+	if (STR_VAL == leaf->value_type) {
+	    rec.str = leaf->str - doc->json;
+	}
+	if (1 != fwrite(&rec, sizeof(rec), 1, f)) {
+	    return false;
+	}
+    }
+    ++*cnt;
+
+    return true;
+}
+
+// Writes the index for a freshly parsed doc. It is written to a temporary
+// file and renamed so other processes never see a partial index. The index is
+// only a cache so a failure is a warning and the parsed doc is still used.
+static void
+index_write(ParseInfo pi) {
+    Doc			doc = pi->doc;
+    OpenOpts		opts = pi->opts;
+    struct _IndexHead	head;
+    char		tmp[1024];
+    FILE		*f;
+    uint64_t		zero = 0;
+    bool		ok;
+
+    if ((int)sizeof(tmp) <= snprintf(tmp, sizeof(tmp), "%s.%d.tmp", opts->index, (int)getpid())) {
+	rb_warning("Oj::Doc index file name %s is too long.", opts->index);
+	return;
+    }
+    if (0 == (f = fopen(tmp, "wb"))) {
+	rb_warning("Failed to write Oj::Doc index %s. %s", opts->index, strerror(errno));
+	return;
+    }
+    memset(&head, 0, sizeof(head));
+    memcpy(head.magic, INDEX_MAGIC, sizeof(head.magic));
+    head.order = INDEX_ORDER;
+    head.json_size = (uint64_t)opts->st.st_size;
+    head.json_mtime = (int64_t)opts->st.st_mtime;
+    head.json_mtime_nsec = ST_MTIME_NSEC(&opts->st);
+    head.json_ino = (uint64_t)opts->st.st_ino;
+    head.json_dev = (uint64_t)opts->st.st_dev;
+    head.text_len = doc->end - doc->json + 1;
+    head.doc_size = doc->size;
+    ok = (1 == fwrite(&head, sizeof(head), 1, f) &&
+	  1 == fwrite(doc->json, head.text_len, 1, f) &&
+	  (0 == (head.text_len & 7) || 1 == fwrite(&zero, 8 - (head.text_len & 7), 1, f)) &&
+	  (0 == doc->data || index_write_leaf(f, doc, doc->data, &head.leaf_cnt)) &&
+	  0 == fseek(f, 0, SEEK_SET) &&
+	  1 == fwrite(&head, sizeof(head), 1, f));
+    if (0 != fclose(f)) {
+	ok = false;
+    }
+#if IS_WINDOWS
+    remove(opts->index);
+#endif
+    if (!ok || 0 != rename(tmp, opts->index)) {
+	int	err = errno;
+
+	remove(tmp);
+	rb_warning("Failed to write Oj::Doc index %s. %s", opts->index, strerror(err));
+    }
+}
+
+// Reads the children of a container recorded by read_lazy(). If lazy is true
+// the containers inside it are recorded lazily in turn, otherwise the whole
+// subtree is read.
+static void
+expand_lazy(Doc doc, Leaf leaf, bool lazy) {
+    struct _ParseInfo	pi;
+    Leaf		col;
+
+    pi.str = doc->json;
+    pi.s = leaf->str;
+    pi.doc = doc;
+    pi.lazy = lazy;
+    pi.nested = false;
+    set_stack_min(&pi);
+    col = read_next(&pi);
+    doc->size--; // counted once already when recorded
+    leaf->elements = col->elements;
+    leaf->value_type = COL_VAL;
+}
+
+// Reads everything under leaf. A lazy container is read in one pass rather
+// than a level at a time, which would rescan the rest of it at every level.
+static void
+expand_all(Doc doc, Leaf leaf) {
+    if (LAZY_VAL == leaf->value_type) {
+	expand_lazy(doc, leaf, false);
+    } else if (COL_VAL == leaf->value_type && 0 != leaf->elements) {
+	Leaf	first = leaf->elements->next;
+	Leaf	e = first;
+
+	do {
+	    expand_all(doc, e);
+	    e = e->next;
+	} while (e != first);
+    }
+}
+
 static Leaf
 get_doc_leaf(Doc doc, const char *path) {
     Leaf	leaf = *doc->where;
@@ -862,7 +1367,7 @@ get_doc_leaf(Doc doc, const char *path) {
 	    memcpy(stack, doc->where_path, sizeof(Leaf) * (cnt + 1));
 	    lp = stack + cnt;
 	}
-	return get_leaf(stack, lp, path);
+	return get_leaf(doc, stack, lp, path);
     }
     return leaf;
 }
@@ -896,30 +1401,186 @@ key_match(const char *pat, const char *key, int plen) {
     return '\0' == *key;
 }
 
+static uint64_t
+key_hash(const char *key, size_t len) {
+    uint64_t	h = 0xcbf29ce484222325ULL;
+
+    for (; 0 < len; len--, key++) {
+	h = (h ^ (uint8_t)*key) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static ChildIndex
+leaf_index(Doc doc, Leaf leaf) {
+    ChildIndex	ci;
+    Leaf	first;
+    Leaf	e;
+    size_t	cnt = 0;
+
+    if (INDEX_NONE == leaf->child_index) {
+	return 0;
+    }
+    if (0 != leaf->child_index) {
+	return doc->indexes + leaf->child_index - 1;
+    }
+    first = leaf->elements->next;
+    e = first;
+    do {
+	cnt++;
+	e = e->next;
+    } while (e != first);
+    if (cnt < INDEX_MIN) {
+	leaf->child_index = INDEX_NONE;
+	return 0;
+    }
+    if (doc->index_size <= doc->index_cnt) {
+	doc->index_size = (0 == doc->index_size) ? 16 : doc->index_size * 2;
+	REALLOC_N(doc->indexes, struct _ChildIndex, doc->index_size);
+    }
+    ci = doc->indexes + doc->index_cnt;
+    doc->index_cnt++;
+    leaf->child_index = doc->index_cnt;
+    ci->cnt = cnt;
+    if (T_ARRAY == leaf->rtype) {
+	Leaf	*cp;
+
+	ci->mask = 0;
+	ci->children = (Leaf*)doc_alloc(doc, sizeof(Leaf) * cnt);
+	for (cp = ci->children; cp < ci->children + cnt; cp++) {
+	    *cp = e;
+	    e = e->next;
+	}
+    } else {
+	size_t	size = 16;
+	size_t	h;
+	size_t	len;
+
+	for (; size < cnt * 2; size *= 2) {
+	}
+	ci->mask = size - 1;
+	ci->children = (Leaf*)doc_alloc(doc, sizeof(Leaf) * size);
+	memset(ci->children, 0, sizeof(Leaf) * size);
+	do {
+	    len = strlen(e->key);
+	    for (h = key_hash(e->key, len) & ci->mask; 0 != ci->children[h]; h = (h + 1) & ci->mask) {
+		// With duplicate keys the first one is found as when walking.
+		if (0 == strcmp(e->key, ci->children[h]->key)) {
+		    break;
+		}
+	    }
+	    if (0 == ci->children[h]) {
+		ci->children[h] = e;
+	    }
+	    e = e->next;
+	} while (e != first);
+    }
+    return ci;
+}
+
+// Returns the element at the 1 based position cnt, where 0 is the same as 1,
+// or 0 if there are not that many elements.
+static Leaf
+array_child(Doc doc, Leaf leaf, int cnt) {
+    ChildIndex	ci = leaf_index(doc, leaf);
+    Leaf	first;
+    Leaf	e;
+
+    if (0 != ci) {
+	if (1 >= cnt) {
+	    return *ci->children;
+	}
+	return ((size_t)cnt <= ci->cnt) ? ci->children[cnt - 1] : 0;
+    }
+    first = leaf->elements->next;
+    e = first;
+    do {
+	if (1 >= cnt) {
+	    return e;
+	}
+	cnt--;
+	e = e->next;
+    } while (e != first);
+
+    return 0;
+}
+
+// Returns the first element with the key of klen characters that hashes to
+// hash or 0 if there is none.
+static Leaf
+hash_key_child(Doc doc, Leaf leaf, const char *key, size_t klen, uint64_t hash) {
+    ChildIndex	ci = leaf_index(doc, leaf);
+    Leaf	first;
+    Leaf	e;
+
+    if (0 != ci) {
+	size_t	h = hash & ci->mask;
+
+	for (; 0 != (e = ci->children[h]); h = (h + 1) & ci->mask) {
+	    if (0 == strncmp(e->key, key, klen) && '\0' == e->key[klen]) {
+		return e;
+	    }
+	}
+	return 0;
+    }
+    first = leaf->elements->next;
+    e = first;
+    do {
+	if (0 == strncmp(e->key, key, klen) && '\0' == e->key[klen]) {
+	    return e;
+	}
+	e = e->next;
+    } while (e != first);
+
+    return 0;
+}
+
+// Returns the first element with a key matching the path segment of klen
+// characters or 0 if there is none.
+static Leaf
+hash_child(Doc doc, Leaf leaf, const char *key, int klen) {
+    Leaf	first;
+    Leaf	e;
+
+    if (0 == memchr(key, '\\', klen)) {
+	return hash_key_child(doc, leaf, key, klen, key_hash(key, klen));
+    }
+    // Segments with escaped characters are matched by walking.
+    first = leaf->elements->next;
+    e = first;
+    do {
+	if (key_match(key, e->key, klen)) {
+	    return e;
+	}
+	e = e->next;
+    } while (e != first);
+
+    return 0;
+}
+
 static Leaf
-get_leaf(Leaf *stack, Leaf *lp, const char *path) {
+get_leaf(Doc doc, Leaf *stack, Leaf *lp, const char *path) {
     Leaf	leaf = *lp;
 
     if (MAX_STACK <= lp - stack) {
 	rb_raise(rb_const_get_at(Oj, rb_intern("DepthError")), "Path too deep. Limit is %d levels.", MAX_STACK);
     }
     if ('\0' != *path) {
+	leaf_expand(doc, leaf);
 	if ('.' == *path && '.' == *(path + 1)) {
 	    path += 2;
 	    if ('/' == *path) {
 		path++;
 	    }
 	    if (stack < lp) {
-		leaf = get_leaf(stack, lp - 1, path);
+		leaf = get_leaf(doc, stack, lp - 1, path);
 	    } else {
 		return 0;
 	    }
 	} else if (COL_VAL == leaf->value_type && 0 != leaf->elements) {
-	    Leaf	first = leaf->elements->next;
-	    Leaf	e = first;
+	    Leaf	e = 0;
 	    int		type = leaf->rtype;
 
-	    leaf = 0;
 	    if (T_ARRAY == type) {
 		int	cnt = 0;
 
@@ -929,16 +1590,7 @@ get_leaf(Leaf *stack, Leaf *lp, const char *path) {
 		if ('/' == *path) {
 		    path++;
 		}
-		do {
-		    if (1 >= cnt) {
-			lp++;
-			*lp = e;
-			leaf = get_leaf(stack, lp, path);
-			break;
-		    }
-		    cnt--;
-		    e = e->next;
-		} while (e != first);
+		e = array_child(doc, leaf, cnt);
 	    } else if (T_HASH == type) {
 		const char	*key = path;
 		const char	*slash = next_slash(path);
@@ -951,15 +1603,13 @@ get_leaf(Leaf *stack, Leaf *lp, const char *path) {
 		    klen = (int)(slash - key);
 		    path += klen + 1;
 		}
-		do {
-		    if (key_match(key, e->key, klen)) {
-			lp++;
-			*lp = e;
-			leaf = get_leaf(stack, lp, path);
-			break;
-		    }
-		    e = e->next;
-		} while (e != first);
+		e = hash_child(doc, leaf, key, klen);
+	    }
+	    leaf = 0;
+	    if (0 != e) {
+		lp++;
+		*lp = e;
+		leaf = get_leaf(doc, stack, lp, path);
 	    }
 	}
     }
@@ -968,6 +1618,7 @@ get_leaf(Leaf *stack, Leaf *lp, const char *path) {
 
 static void
 each_leaf(Doc doc, VALUE self) {
+    leaf_expand(doc, *doc->where);
     if (COL_VAL == (*doc->where)->value_type) {
 	if (0 != (*doc->where)->elements) {
 	    Leaf	first = (*doc->where)->elements->next;
@@ -1003,6 +1654,7 @@ move_step(Doc doc, const char *path, int loc) {
 	    printf("*** Internal error at %s\n", path);
 	    return loc;
 	}
+	leaf_expand(doc, leaf);
 	if ('.' == *path && '.' == *(path + 1)) {
 	    Leaf	init = *doc->where;
 
@@ -1021,8 +1673,7 @@ move_step(Doc doc, const char *path, int loc) {
 		doc->where++;
 	    }
 	} else if (COL_VAL == leaf->value_type && 0 != leaf->elements) {
-	    Leaf	first = leaf->elements->next;
-	    Leaf	e = first;
+	    Leaf	e = 0;
 
 	    if (T_ARRAY == leaf->rtype) {
 		int	cnt = 0;
@@ -1035,20 +1686,7 @@ move_step(Doc doc, const char *path, int loc) {
 		} else if ('\0' != *path) {
 		    return loc;
 		}
-		do {
-		    if (1 >= cnt) {
-			doc->where++;
-			*doc->where = e;
-			loc = move_step(doc, path, loc + 1);
-			if (0 != loc) {
-			    *doc->where = 0;
-			    doc->where--;
-			}
-			break;
-		    }
-		    cnt--;
-		    e = e->next;
-		} while (e != first);
+		e = array_child(doc, leaf, cnt);
 	    } else if (T_HASH == leaf->rtype) {
 		const char	*key = path;
 		const char	*slash = next_slash(path);
@@ -1061,19 +1699,16 @@ move_step(Doc doc, const char *path, int loc) {
 		    klen = (int)(slash - key);
 		    path += klen + 1;
 		}
-		do {
-		    if (key_match(key, e->key, klen)) {
-			doc->where++;
-			*doc->where = e;
-			loc = move_step(doc, path, loc + 1);
-			if (0 != loc) {
-			    *doc->where = 0;
-			    doc->where--;
-			}
-			break;
-		    }
-		    e = e->next;
-		} while (e != first);
+		e = hash_child(doc, leaf, key, klen);
+	    }
+	    if (0 != e) {
+		doc->where++;
+		*doc->where = e;
+		loc = move_step(doc, path, loc + 1);
+		if (0 != loc) {
+		    *doc->where = 0;
+		    doc->where--;
+		}
 	    }
 	}
     }
@@ -1082,6 +1717,7 @@ move_step(Doc doc, const char *path, int loc) {
 
 static void
 each_value(Doc doc, Leaf leaf) {
+    leaf_expand(doc, leaf);
     if (COL_VAL == leaf->value_type) {
 	if (0 != leaf->elements) {
 	    Leaf	first = leaf->elements->next;
@@ -1099,14 +1735,38 @@ each_value(Doc doc, Leaf leaf) {
 
 // doc functions
 
-/* @overload open(json) { |doc| ... } => Object
+// Reads the options Hash that may follow the JSON or filename.
+static void
+open_options(int argc, VALUE *argv, OpenOpts opts) {
+    memset(opts, 0, sizeof(struct _OpenOpts));
+    if (2 <= argc && Qnil != argv[1]) {
+	VALUE	v;
+
+	Check_Type(argv[1], T_HASH);
+	opts->lazy = RTEST(rb_hash_lookup(argv[1], lazy_sym));
+	if (Qnil != (v = rb_hash_lookup(argv[1], index_sym))) {
+	    Check_Type(v, T_STRING);
+	    opts->index = StringValuePtr(v);
+	}
+    }
+}
+
+/* @overload open(json, opts={}) { |doc| ... } => Object
  *
  * Parses a JSON document String and then yields to the provided block if one
  * is given with an instance of the Oj::Doc as the single yield parameter. If
  * a block is not given then an Oj::Doc instance is returned and must be
  * closed with a call to the #close() method when no longer needed.
  *
+ * With the :lazy option only the top level container is read when the
+ * document is opened. Each nested array or object is skipped over and read
+ * the first time a path or iterator goes into it, so subtrees that are never
+ * visited cost no more than a scan for their closing bracket. Errors inside a
+ * container are not reported until it is read.
+ *
  *   @param [String] json JSON document string
+ *   @param [Hash] opts options
+ *   @option opts [true|false] :lazy read nested containers on first use
  * @yieldparam [Oj::Doc] doc parsed JSON document
  * @yieldreturn [Object] returns the result of the yield as the result of the method call
  * @example
@@ -1117,13 +1777,21 @@ each_value(Doc doc, Leaf leaf) {
  *   doc.close()
  */
 static VALUE
-doc_open(VALUE clas, VALUE str) {
+doc_open(int argc, VALUE *argv, VALUE clas) {
+    struct _OpenOpts	opts;
     char	*json;
     size_t	len;
     VALUE	obj;
+    VALUE	str;
     int		given = rb_block_given_p();
     int		allocate;
 
+    if (1 > argc || 2 < argc) {
+	rb_raise(rb_eArgError, "Wrong number of arguments to open.");
+    }
+    open_options(argc, argv, &opts);
+    opts.index = 0; // only files are indexed
+    str = *argv;
     Check_Type(str, T_STRING);
     len = RSTRING_LEN(str) + 1;
     allocate = (SMALL_XML < len || !given);
@@ -1133,21 +1801,32 @@ doc_open(VALUE clas, VALUE str) {
 	json = ALLOCA_N(char, len);
     }
     memcpy(json, StringValuePtr(str), len);
-    obj = parse_json(clas, json, given, allocate);
+    // The length passed does not include the terminating '\0'.
+    obj = parse_json(clas, json, len - 1, given, allocate, &opts);
     if (given && allocate) {
 	xfree(json);
     }
     return obj;
 }
 
-/* @overload open_file(filename) { |doc| ... } => Object
+/* @overload open_file(filename, opts={}) { |doc| ... } => Object
  *
  * Parses a JSON document from a file and then yields to the provided block if
  * one is given with an instance of the Oj::Doc as the single yield
  * parameter. If a block is not given then an Oj::Doc instance is returned and
  * must be closed with a call to the #close() method when no longer needed.
  *
+ * With the :index option the leaves are written to the named index file
+ * after parsing. Later opens of the same, unchanged file map the index back
+ * in and skip parsing. The index is written again if the file, its size, or
+ * its modification time no longer match or if the index is corrupt. The
+ * index is only a cache so if it can not be written the parsed document is
+ * still returned and a warning is issued when $VERBOSE is set. The :lazy
+ * option is ignored when an index is used.
+ *
  *   @param [String] filename name of file that contains a JSON document
+ *   @param [Hash] opts options, see #open
+ *   @option opts [String] :index file to keep the parsed document in
  * @yieldparam [Oj::Doc] doc parsed JSON document
  * @yieldreturn [Object] returns the result of the yield as the result of the method call
  * @example
@@ -1157,19 +1836,43 @@ doc_open(VALUE clas, VALUE str) {
  *   doc = Oj::Doc.open_file(filename)
  *   doc.size()  #=> 4
  *   doc.close()
+ *   # parsed once and reused across processes
+ *   Oj::Doc.open_file(filename, :index => 'array.ojx') { |doc| doc.size() }  #=> 4
  */
 static VALUE
-doc_open_file(VALUE clas, VALUE filename) {
+doc_open_file(int argc, VALUE *argv, VALUE clas) {
+    struct _OpenOpts	opts;
     char	*path;
     char	*json;
     FILE	*f;
     size_t	len;
     VALUE	obj;
+    VALUE	filename;
     int		given = rb_block_given_p();
     int		allocate;
 
+    if (1 > argc || 2 < argc) {
+	rb_raise(rb_eArgError, "Wrong number of arguments to open_file.");
+    }
+    open_options(argc, argv, &opts);
+    filename = *argv;
     Check_Type(filename, T_STRING);
     path = StringValuePtr(filename);
+    if (0 != opts.index) {
+	if (0 != stat(path, &opts.st)) {
+	    rb_raise(rb_eIOError, "%s", strerror(errno));
+	}
+	if (0 != (opts.map = index_map(opts.index, &opts.st, &opts.map_len))) {
+	    obj = parse_json(clas, opts.map + sizeof(struct _IndexHead), ((IndexHead)opts.map)->text_len - 1, given, false, &opts);
+	    if (Qundef != obj) {
+		return obj;
+	    }
+	    // A corrupt index is replaced by parsing the file again.
+	    opts.map = 0;
+	    opts.map_len = 0;
+	}
+	opts.lazy = false; // the index needs every leaf
+    }
     if (0 == (f = fopen(path, "r"))) {
 	rb_raise(rb_eIOError, "%s", strerror(errno));
     }
@@ -1189,7 +1892,7 @@ doc_open_file(VALUE clas, VALUE filename) {
     }
     fclose(f);
     json[len] = '\0';
-    obj = parse_json(clas, json, given, allocate);
+    obj = parse_json(clas, json, len, given, allocate, &opts);
     if (given && allocate) {
 	xfree(json);
     }
@@ -1347,14 +2050,346 @@ doc_type(int argc, VALUE *argv, VALUE self) {
     return type;
 }
 
+// Compiled paths used by Oj::Doc::Path.
+typedef enum {
+    STEP_KEY	= 'k',
+    STEP_ANY	= '*',
+    STEP_SLICE	= 's',
+    STEP_UP	= 'u',
+} StepType;
+
+typedef struct _PathStep {
+    const char	*key;	// unescaped key used when the container is a hash
+    size_t	klen;
+    uint64_t	hash;
+    long	first;	// 1 based array position or -1 if not a number
+    long	last;	// last position of a slice
+    char	type;	// StepType
+} *PathStep;
+
+typedef struct _DocPath {
+    PathStep	steps;
+    int		cnt;
+    bool	abs;	// starts at the root instead of the current location
+    bool	multi;	// has a wildcard or slice so it can match more than once
+    char	*keys;
+    VALUE	src;
+} *DocPath;
+
+typedef struct _PathRun {
+    Doc		doc;
+    DocPath	path;
+    VALUE	self;
+    VALUE	result;
+    bool	(*cb)(struct _PathRun *run, Leaf *lp);
+    Leaf	stack[MAX_STACK];
+} *PathRun;
+
+static void
+doc_path_mark(void *ptr) {
+    if (NULL != ptr) {
+	rb_gc_mark(((DocPath)ptr)->src);
+    }
+}
+
+static void
+doc_path_free(void *ptr) {
+    DocPath	path = (DocPath)ptr;
+
+    if (NULL != path) {
+	xfree(path->steps);
+	xfree(path->keys);
+	xfree(path);
+    }
+}
+
+// Array positions past this are treated as this.
+#define PATH_POS_MAX	0x7FFFFFFF
+
+static long
+parse_pos(const char **sp, const char *end) {
+    const char	*s = *sp;
+    long	n = 0;
+
+    if (end <= s || *s < '0' || '9' < *s) {
+	return -1;
+    }
+    for (; s < end && '0' <= *s && *s <= '9'; s++) {
+	if (PATH_POS_MAX < (n = n * 10 + (*s - '0'))) {
+	    n = PATH_POS_MAX;
+	}
+    }
+    *sp = s;
+
+    return n;
+}
+
+static void
+compile_step(DocPath path, PathStep step, bool escaped) {
+    const char	*s = step->key;
+    const char	*end = s + step->klen;
+
+    step->hash = key_hash(step->key, step->klen);
+    step->type = STEP_KEY;
+    step->last = -1;
+    if (!escaped && 2 == step->klen && '.' == *s && '.' == s[1]) {
+	step->type = STEP_UP;
+	step->first = -1;
+    } else if (!escaped && 1 == step->klen && '*' == *s) {
+	step->type = STEP_ANY;
+	step->first = -1;
+	path->multi = true;
+    } else if (0 == step->klen) {
+	// An empty step is position 0 in an array, the same as in a String
+	// path, and the empty key in a hash.
+	step->first = 1;
+	step->last = 1;
+    } else if (0 <= (step->first = parse_pos(&s, end))) {
+	if (end == s) {
+	    step->last = step->first;
+	} else if (2 <= end - s && '.' == *s && '.' == s[1]) {
+	    s += 2;
+	    if (end == s) {
+		step->last = PATH_POS_MAX;
+	    } else if (0 > (step->last = parse_pos(&s, end)) || end != s) {
+		step->first = -1;
+		return;
+	    }
+	    step->type = STEP_SLICE;
+	    path->multi = true;
+	} else {
+	    step->first = -1;
+	    return;
+	}
+	// As with a String path, position 0 is the first element like 1.
+	if (0 == step->first) {
+	    step->first = 1;
+	}
+	if (0 == step->last) {
+	    step->last = 1;
+	}
+    }
+}
+
+static bool
+path_walk(PathRun run, int si, Leaf *lp) {
+    PathStep	step;
+    Leaf	leaf = *lp;
+    Leaf	first;
+    Leaf	e;
+
+    if (run->path->cnt <= si) {
+	return run->cb(run, lp);
+    }
+    if (MAX_STACK - 1 <= lp - run->stack) {
+	rb_raise(rb_const_get_at(Oj, rb_intern("DepthError")), "Path too deep. Limit is %d levels.", MAX_STACK);
+    }
+    step = run->path->steps + si;
+    if (STEP_UP == step->type) {
+	return (run->stack < lp) ? path_walk(run, si + 1, lp - 1) : false;
+    }
+    leaf_expand(run->doc, leaf);
+    if (COL_VAL != leaf->value_type || 0 == leaf->elements) {
+	return false;
+    }
+    first = leaf->elements->next;
+    if (T_ARRAY == leaf->rtype) {
+	long	pos = 1;
+	long	last = PATH_POS_MAX;
+
+	if (STEP_ANY != step->type) {
+	    if (0 > step->first) {
+		return false;
+	    }
+	    pos = step->first;
+	    last = step->last;
+	}
+	if (pos < 1) {
+	    pos = 1;
+	}
+	for (e = array_child(run->doc, leaf, (int)pos); 0 != e && pos <= last; pos++) {
+	    lp[1] = e;
+	    if (path_walk(run, si + 1, lp + 1)) {
+		return true;
+	    }
+	    if (first == (e = e->next)) {
+		break;
+	    }
+	}
+    } else if (STEP_ANY == step->type) {
+	e = first;
+	do {
+	    lp[1] = e;
+	    if (path_walk(run, si + 1, lp + 1)) {
+		return true;
+	    }
+	    e = e->next;
+	} while (e != first);
+    } else if (0 != (e = hash_key_child(run->doc, leaf, step->key, step->klen, step->hash))) {
+	lp[1] = e;
+	return path_walk(run, si + 1, lp + 1);
+    }
+    return false;
+}
+
+// Calls the run callback for each match until it returns true. Returns true
+// if the callback did.
+static bool
+path_run(PathRun run, Doc doc, VALUE rpath) {
+    Leaf	*lp;
+
+    run->doc = doc;
+    run->path = (DocPath)DATA_PTR(rpath);
+    if (0 == doc->data) {
+	return false;
+    }
+    if (run->path->abs || doc->where == doc->where_path) {
+	*run->stack = doc->data;
+	lp = run->stack;
+    } else {
+	size_t	cnt = doc->where - doc->where_path;
+
+	memcpy(run->stack, doc->where_path, sizeof(Leaf) * (cnt + 1));
+	lp = run->stack + cnt;
+    }
+    return path_walk(run, 0, lp);
+}
+
+static bool
+fetch_one_cb(PathRun run, Leaf *lp) {
+    run->result = leaf_value(run->doc, *lp);
+
+    return true;
+}
+
+static bool
+fetch_all_cb(PathRun run, Leaf *lp) {
+    rb_ary_push(run->result, leaf_value(run->doc, *lp));
+
+    return false;
+}
+
+static bool
+move_cb(PathRun run, Leaf *lp) {
+    size_t	cnt = lp - run->stack;
+
+    memcpy(run->doc->where_path, run->stack, sizeof(Leaf) * (cnt + 1));
+    run->doc->where = run->doc->where_path + cnt;
+
+    return true;
+}
+
+static bool
+each_child_cb(PathRun run, Leaf *lp) {
+    Doc		doc = run->doc;
+    Leaf	first;
+    Leaf	e;
+
+    leaf_expand(doc, *lp);
+    if (COL_VAL == (*lp)->value_type && 0 != (*lp)->elements) {
+	move_cb(run, lp);
+	first = (*lp)->elements->next;
+	e = first;
+	doc->where++;
+	do {
+	    *doc->where = e;
+	    rb_yield(run->self);
+	    e = e->next;
+	} while (e != first);
+    }
+    return false;
+}
+
+inline static bool
+is_doc_path(VALUE v) {
+    return rb_obj_class(v) == doc_path_class;
+}
+
+/* Document-class: Oj::Doc::Path
+ *
+ * A path compiled once so it can be used with any number of Oj::Doc
+ * instances. The Doc fetch, move and each_child methods take an
+ * Oj::Doc::Path in place of a path String. Besides the keys, positions and
+ * '..' of a String path a compiled path may have '*' steps that match every
+ * element of an array or hash and 'first..last' steps that match a range of
+ * array positions. A '*' meant as a key is escaped with a backslash.
+ */
+
+/* @overload new(path) => Oj::Doc::Path
+ *
+ * Compiles a path.
+ *   @param [String] path path to compile
+ * @example
+ *   path = Oj::Doc::Path.new('/users/1..2/name')
+ *   Oj::Doc.open('{"users":[{"name":"a"},{"name":"b"}]}') { |doc| doc.fetch(path) }  #=> ["a", "b"]
+ */
+static VALUE
+doc_path_new(VALUE clas, VALUE str) {
+    DocPath		path;
+    volatile VALUE	obj;
+    const char		*s;
+    const char		*end;
+    char		*k;
+    PathStep		step;
+    size_t		len;
+    bool		escaped;
+
+    Check_Type(str, T_STRING);
+    path = ALLOC(struct _DocPath);
+    memset(path, 0, sizeof(struct _DocPath));
+    path->src = Qnil;
+    obj = Data_Wrap_Struct(clas, doc_path_mark, doc_path_free, path);
+    path->src = rb_str_new_frozen(str);
+    s = RSTRING_PTR(path->src);
+    len = RSTRING_LEN(path->src);
+    end = s + len;
+    path->steps = ALLOC_N(struct _PathStep, len / 2 + 1);
+    path->keys = ALLOC_N(char, len + 1);
+    k = path->keys;
+    if (s < end && '/' == *s) {
+	path->abs = true;
+	s++;
+    }
+    while (s < end) {
+	step = path->steps + path->cnt;
+	step->key = k;
+	escaped = false;
+	for (; s < end && '/' != *s; s++) {
+	    if ('\\' == *s && s + 1 < end) {
+		s++;
+		escaped = true;
+	    }
+	    *k++ = *s;
+	}
+	step->klen = k - step->key;
+	*k++ = '\0';
+	compile_step(path, step, escaped);
+	path->cnt++;
+	if (s < end) {
+	    s++; // the slash
+	}
+    }
+    return obj;
+}
+
+/* @overload to_s() => String
+ *
+ * Returns the path the Oj::Doc::Path was compiled from.
+ */
+static VALUE
+doc_path_to_s(VALUE self) {
+    return ((DocPath)DATA_PTR(self))->src;
+}
+
 /* @overload fetch(path=nil) => nil, true, false, Fixnum, Float, String, Array, Hash
  *
  * Returns the value at the location identified by the path or the current
  * location if the path is nil or not provided. This method will create and
  * return an Array or Hash if that is the type of Object at the location
  * specified. This is more expensive than navigating to the leaves of the JSON
- * document.
- *   @param [String] path path to the location to get the type of if provided
+ * document. With an Oj::Doc::Path that has '*' or slice steps an Array of
+ * every matching value is returned.
+ *   @param [String|Oj::Doc::Path] path path to the location to get the type of if provided
  * @example
  *   Oj::Doc.open('[1,2]') { |doc| doc.fetch() }      #=> [1, 2]
  *   Oj::Doc.open('[1,2]') { |doc| doc.fetch('/1') }  #=> 1
@@ -1367,12 +2402,27 @@ doc_fetch(int argc, VALUE *argv, VALUE self) {
     const char	*path = 0;
 
     doc = self_doc(self);
+    if (2 == argc) {
+	val = argv[1];
+    }
+    if (1 <= argc && is_doc_path(*argv)) {
+	struct _PathRun	run;
+
+	run.self = self;
+	if (((DocPath)DATA_PTR(*argv))->multi) {
+	    run.result = rb_ary_new();
+	    run.cb = fetch_all_cb;
+	} else {
+	    run.result = val;
+	    run.cb = fetch_one_cb;
+	}
+	path_run(&run, doc, *argv);
+
+	return run.result;
+    }
     if (1 <= argc) {
 	Check_Type(*argv, T_STRING);
 	path = StringValuePtr(*argv);
-	if (2 == argc) {
-	    val = argv[1];
-	}
     }
     if (0 != (leaf = get_doc_leaf(doc, path))) {
 	val = leaf_value(doc, leaf);
@@ -1443,6 +2493,16 @@ doc_move(VALUE self, VALUE str) {
     const char	*path;
     int		loc;
 
+    if (is_doc_path(str)) {
+	struct _PathRun	run;
+
+	run.self = self;
+	run.cb = move_cb;
+	if (!path_run(&run, doc, str)) {
+	    rb_raise(rb_eArgError, "Failed to locate the path %s.", StringValuePtr(((DocPath)DATA_PTR(str))->src));
+	}
+	return Qnil;
+    }
     Check_Type(str, T_STRING);
     path = StringValuePtr(str);
     if ('/' == *path) {
@@ -1483,6 +2543,20 @@ doc_each_child(int argc, VALUE *argv, VALUE self) {
 	if (0 < wlen) {
 	    memcpy(save_path, doc->where_path, sizeof(Leaf) * (wlen + 1));
 	}
+	if (1 <= argc && is_doc_path(*argv)) {
+	    struct _PathRun	run;
+
+	    // Every match is visited in turn.
+	    run.self = self;
+	    run.cb = each_child_cb;
+	    path_run(&run, doc, *argv);
+	    if (0 < wlen) {
+		memcpy(doc->where_path, save_path, sizeof(Leaf) * (wlen + 1));
+	    }
+	    doc->where = doc->where_path + wlen;
+
+	    return Qnil;
+	}
 	if (1 <= argc) {
 	    Check_Type(*argv, T_STRING);
 	    path = StringValuePtr(*argv);
@@ -1497,6 +2571,7 @@ doc_each_child(int argc, VALUE *argv, VALUE self) {
 		return Qnil;
 	    }
 	}
+	leaf_expand(doc, *doc->where);
 	if (COL_VAL == (*doc->where)->value_type && 0 != (*doc->where)->elements) {
 	    Leaf	first = (*doc->where)->elements->next;
 	    Leaf	e = first;
@@ -1588,6 +2663,7 @@ doc_dump(int argc, VALUE *argv, VALUE self) {
     if (0 != (leaf = get_doc_leaf(doc, path))) {
 	VALUE	rjson;
 
+	expand_all(doc, leaf);
 	if (0 == filename) {
 	    char	buf[4096];
 	    struct _Out out;
@@ -1595,6 +2671,8 @@ doc_dump(int argc, VALUE *argv, VALUE self) {
 	    out.buf = buf;
 	    out.end = buf + sizeof(buf) - 10;
 	    out.allocated = false;
+	    out.str = Qnil;
+	    out.flush = NULL;
 	    out.omit_nil = oj_default_options.dump_opts.omit_nil;
 	    oj_dump_leaf_to_json(leaf, &oj_default_options, &out);
 	    rjson = rb_str_new2(out.buf);
@@ -1620,7 +2698,12 @@ doc_dump(int argc, VALUE *argv, VALUE self) {
  */
 static VALUE
 doc_size(VALUE self) {
-    return ULONG2NUM(((Doc)DATA_PTR(self))->size);
+    Doc	doc = self_doc(self);
+
+    if (0 != doc->data) {
+	expand_all(doc, doc->data);
+    }
+    return ULONG2NUM(doc->size);
 }
 
 /* @overload close() => nil
@@ -1639,7 +2722,7 @@ doc_close(VALUE self) {
     rb_gc_unregister_address(&doc->self);
     DATA_PTR(doc->self) = 0;
     if (0 != doc) {
-	xfree(doc->json);
+	doc_free_json(doc);
 	doc_free(doc);
 	xfree(doc);
     }
@@ -1705,9 +2788,9 @@ doc_not_implemented(VALUE self) {
 void
 oj_init_doc() {
     oj_doc_class = rb_define_class_under(Oj, "Doc", rb_cObject);
-    rb_define_singleton_method(oj_doc_class, "open", doc_open, 1);
-    rb_define_singleton_method(oj_doc_class, "open_file", doc_open_file, 1);
-    rb_define_singleton_method(oj_doc_class, "parse", doc_open, 1);
+    rb_define_singleton_method(oj_doc_class, "open", doc_open, -1);
+    rb_define_singleton_method(oj_doc_class, "open_file", doc_open_file, -1);
+    rb_define_singleton_method(oj_doc_class, "parse", doc_open, -1);
     rb_define_method(oj_doc_class, "where?", doc_where, 0);
     rb_define_method(oj_doc_class, "local_key", doc_local_key, 0);
     rb_define_method(oj_doc_class, "home", doc_home, 0);
@@ -1723,4 +2806,12 @@ oj_init_doc() {
 
     rb_define_method(oj_doc_class, "clone", doc_not_implemented, 0);
     rb_define_method(oj_doc_class, "dup", doc_not_implemented, 0);
+
+    doc_path_class = rb_define_class_under(oj_doc_class, "Path", rb_cObject);
+    rb_undef_alloc_func(doc_path_class);
+    rb_define_singleton_method(doc_path_class, "new", doc_path_new, 1);
+    rb_define_method(doc_path_class, "to_s", doc_path_to_s, 0);
+
+    lazy_sym = ID2SYM(rb_intern("lazy"));	rb_gc_register_address(&lazy_sym);
+    index_sym = ID2SYM(rb_intern("index"));	rb_gc_register_address(&index_sym);
 }
@@ -31,18 +31,41 @@
 #include "hash.h"
 #include <stdint.h>
 
-#define HASH_MASK	0x000003FF
-#define  HASH_SLOT_CNT	1024
+#define HASH_INIT_SIZE	1024
 
+// A missing atomic is only a problem if the GVL is released while parsing.
+#if defined(__GNUC__)
+#define LOAD_ACQUIRE(p)		__atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(p, v)	__atomic_store_n(p, v, __ATOMIC_RELEASE)
+#else
+#define LOAD_ACQUIRE(p)		(*(p))
+#define STORE_RELEASE(p, v)	(*(p) = (v))
+#endif
+
+// Entries are filled in with the key published last so a reader never sees
+// a partial entry. The value is Qnil or 0 until the caller sets it.
 typedef struct _KeyVal {
-    struct _KeyVal	*next;
     const char		*key;
     size_t		len;
+    uint32_t		h;
     VALUE		val;
 } *KeyVal;
 
+typedef struct _Table {
+    struct _Table	*prev;
+    size_t		size;
+    size_t		mask;
+    struct _KeyVal	slots[1];
+} *Table;
+
+// Writers must hold oj_cache_mutex. Readers take no lock and may be looking
+// at a table that has been replaced by a larger one so replaced tables are
+// kept on the prev list and never freed. Since the tables double in size the
+// retired ones never add up to more than the current one.
 struct _Hash {
-    struct _KeyVal	slots[HASH_SLOT_CNT];
+    Table		table;
+    size_t		cnt;
+    size_t		max_probe;
 };
 
 struct _Hash	class_hash;
@@ -89,57 +112,165 @@ hash_calc(const uint8_t *key, size_t len) {
     return h;
 }
 
+static Table
+table_new(size_t size) {
+    Table	t = (Table)xcalloc(1, sizeof(struct _Table) + sizeof(struct _KeyVal) * (size - 1));
+
+    t->size = size;
+    t->mask = size - 1;
+
+    return t;
+}
+
+static void
+hash_init(Hash hash) {
+    hash->table = table_new(HASH_INIT_SIZE);
+    hash->cnt = 0;
+    hash->max_probe = 0;
+}
+
 void
 oj_hash_init() {
-    memset(class_hash.slots, 0, sizeof(class_hash.slots));
-    memset(intern_hash.slots, 0, sizeof(intern_hash.slots));
+    hash_init(&class_hash);
+    hash_init(&intern_hash);
 }
 
-// if slotp is 0 then just lookup
+// Lock free lookup. The default value is returned on a miss or if the entry
+// is still being filled in.
 static VALUE
-hash_get(Hash hash, const char *key, size_t len, VALUE **slotp, VALUE def_value) {
-    uint32_t	h = hash_calc((const uint8_t*)key, len) & HASH_MASK;
-    KeyVal	bucket = hash->slots + h;
+hash_find(Hash hash, const char *key, size_t len, VALUE def_value) {
+    uint32_t	h = hash_calc((const uint8_t*)key, len);
+    Table	t = LOAD_ACQUIRE(&hash->table);
+    size_t	i = h & t->mask;
+    KeyVal	b;
+    const char	*k;
+
+    for (; 1; i = (i + 1) & t->mask) {
+	b = t->slots + i;
+	if (0 == (k = LOAD_ACQUIRE(&b->key))) {
+	    break;
+	}
+	if (h == b->h && len == b->len && 0 == memcmp(k, key, len)) {
+	    return LOAD_ACQUIRE(&b->val);
+	}
+    }
+    return def_value;
+}
+
+static void
+hash_grow(Hash hash) {
+    Table	old = hash->table;
+    Table	t = table_new(old->size * 2);
+    KeyVal	b;
+    KeyVal	end = old->slots + old->size;
+    size_t	i;
+    size_t	probe;
 
-    if (0 != bucket->key) {
-	KeyVal	b;
+    hash->max_probe = 0;
+    for (b = old->slots; b < end; b++) {
+	if (0 == b->key) {
+	    continue;
+	}
+	for (i = b->h & t->mask, probe = 0; 0 != t->slots[i].key; i = (i + 1) & t->mask) {
+	    probe++;
+	}
+	t->slots[i] = *b;
+	if (hash->max_probe < probe) {
+	    hash->max_probe = probe;
+	}
+    }
+    t->prev = old;
+    STORE_RELEASE(&hash->table, t);
+}
 
-	for (b = bucket; 0 != b; b = b->next) {
-	    if (len == b->len && 0 == strncmp(b->key, key, len)) {
+// Must be called with oj_cache_mutex held. If slotp is 0 then just lookup.
+static VALUE
+hash_get(Hash hash, const char *key, size_t len, VALUE **slotp, VALUE def_value) {
+    uint32_t	h = hash_calc((const uint8_t*)key, len);
+    Table	t = hash->table;
+    size_t	i = h & t->mask;
+    size_t	probe = 0;
+    KeyVal	b;
+
+    for (; 0 != t->slots[i].key; i = (i + 1) & t->mask, probe++) {
+	b = t->slots + i;
+	if (h == b->h && len == b->len && 0 == memcmp(b->key, key, len)) {
+	    if (0 != slotp) {
 		*slotp = &b->val;
-		return b->val;
 	    }
-	    bucket = b;
+	    return b->val;
 	}
     }
     if (0 != slotp) {
-	if (0 != bucket->key) {
-	    KeyVal	b = ALLOC(struct _KeyVal);
-	
-	    b->next = 0;
-	    bucket->next = b;
-	    bucket = b;
+	if (t->size <= (hash->cnt + 1) * 2) {
+	    hash_grow(hash);
+	    return hash_get(hash, key, len, slotp, def_value);
 	}
-	bucket->key = oj_strndup(key, len);
-	bucket->len = len;
-	bucket->val = def_value;
-	*slotp = &bucket->val;
+	b = t->slots + i;
+	b->len = len;
+	b->h = h;
+	b->val = def_value;
+	STORE_RELEASE(&b->key, (const char*)oj_strndup(key, len));
+	hash->cnt++;
+	if (hash->max_probe < probe) {
+	    hash->max_probe = probe;
+	}
+	*slotp = &b->val;
     }
     return def_value;
 }
 
+static void
+hash_stats(Hash hash, HashStats stats) {
+    Table	t = hash->table;
+    KeyVal	b;
+    KeyVal	end = t->slots + t->size;
+    size_t	total = 0;
+
+    for (b = t->slots; b < end; b++) {
+	if (0 != b->key) {
+	    total += ((b - t->slots) - (b->h & t->mask)) & t->mask;
+	}
+    }
+    stats->size = t->size;
+    stats->cnt = hash->cnt;
+    stats->load = (double)hash->cnt / (double)t->size;
+    stats->max_probe = hash->max_probe;
+    stats->avg_probe = (0 == hash->cnt) ? 0.0 : (double)total / (double)hash->cnt;
+}
+
+void
+oj_class_hash_stats(HashStats stats) {
+    hash_stats(&class_hash, stats);
+}
+
+void
+oj_attr_hash_stats(HashStats stats) {
+    hash_stats(&intern_hash, stats);
+}
+
 void
 oj_hash_print() {
-    int		i;
-    KeyVal	b;
+    struct _HashStats	stats;
+    Table		t = class_hash.table;
+    size_t		i;
 
-    for (i = 0; i < HASH_SLOT_CNT; i++) {
-	printf("%4d:", i);
-	for (b = class_hash.slots + i; 0 != b && 0 != b->key; b = b->next) {
-	    printf(" %s", b->key);
+    for (i = 0; i < t->size; i++) {
+	if (0 != t->slots[i].key) {
+	    printf("%4lu: %s\n", (unsigned long)i, t->slots[i].key);
 	}
-	printf("\n");
     }
+    oj_class_hash_stats(&stats);
+    printf("class hash: %lu of %lu slots, load %0.2f, max probe %lu, average probe %0.2f\n",
+	   (unsigned long)stats.cnt, (unsigned long)stats.size, stats.load, (unsigned long)stats.max_probe, stats.avg_probe);
+    oj_attr_hash_stats(&stats);
+    printf("attr hash: %lu of %lu slots, load %0.2f, max probe %lu, average probe %0.2f\n",
+	   (unsigned long)stats.cnt, (unsigned long)stats.size, stats.load, (unsigned long)stats.max_probe, stats.avg_probe);
+}
+
+VALUE
+oj_class_hash_find(const char *key, size_t len) {
+    return hash_find(&class_hash, key, len, Qnil);
 }
 
 VALUE
@@ -147,6 +278,11 @@ oj_class_hash_get(const char *key, size_t len, VALUE **slotp) {
     return hash_get(&class_hash, key, len, slotp, Qnil);
 }
 
+ID
+oj_attr_hash_find(const char *key, size_t len) {
+    return (ID)hash_find(&intern_hash, key, len, 0);
+}
+
 ID
 oj_attr_hash_get(const char *key, size_t len, ID **slotp) {
     return (ID)hash_get(&intern_hash, key, len, (VALUE**)slotp, 0);
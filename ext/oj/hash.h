@@ -35,11 +35,27 @@
 
 typedef struct _Hash	*Hash;
 
+typedef struct _HashStats {
+    size_t	size;
+    size_t	cnt;
+    double	load;
+    size_t	max_probe;
+    double	avg_probe;
+} *HashStats;
+
 extern void	oj_hash_init();
 
+// The find functions do not lock and return Qnil or 0 on a miss. The get
+// functions must be called with oj_cache_mutex held and add the key if it
+// is not already present.
+extern VALUE	oj_class_hash_find(const char *key, size_t len);
 extern VALUE	oj_class_hash_get(const char *key, size_t len, VALUE **slotp);
+extern ID	oj_attr_hash_find(const char *key, size_t len);
 extern ID	oj_attr_hash_get(const char *key, size_t len, ID **slotp);
 
+extern void	oj_class_hash_stats(HashStats stats);
+extern void	oj_attr_hash_stats(HashStats stats);
+
 extern void	oj_hash_print();
 extern char*	oj_strndup(const char *s, size_t len);
 
@@ -205,6 +205,8 @@ mimic_dump(int argc, VALUE *argv, VALUE self) {
     out.buf = buf;
     out.end = buf + sizeof(buf) - 10;
     out.allocated = false;
+    out.str = Qnil;
+    out.flush = NULL;
     out.caller = CALLER_DUMP;
     copts.escape_mode = JXEsc;
     copts.mode = CompatMode;
@@ -364,6 +366,8 @@ mimic_generate_core(int argc, VALUE *argv, Options copts) {
     out.buf = buf;
     out.end = buf + sizeof(buf) - 10;
     out.allocated = false;
+    out.str = Qnil;
+    out.flush = NULL;
     out.omit_nil = copts->dump_opts.omit_nil;
     out.caller = CALLER_GENERATE;
     // For obj.to_json or generate nan is not allowed but if called from dump
@@ -684,6 +688,8 @@ static struct _Options	mimic_object_to_json_options = {
     No,		// allow_invalid
     No,		// create_ok
     No,		// allow_nan
+    No,		// cache_keys
+    0,		// cache_str
     oj_json_class,// create_id
     10,		// create_id_len
     3,		// sec_prec
@@ -726,6 +732,8 @@ mimic_object_to_json(int argc, VALUE *argv, VALUE self) {
     out.buf = buf;
     out.end = buf + sizeof(buf) - 10;
     out.allocated = false;
+    out.str = Qnil;
+    out.flush = NULL;
     out.omit_nil = copts.dump_opts.omit_nil;
     copts.mode = CompatMode;
     copts.to_json = No;
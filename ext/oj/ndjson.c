@@ -0,0 +1,686 @@
+/* ndjson.c
+ * Copyright (c) 2017, Peter Ohler
+ * All rights reserved.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "oj.h"
+#include "err.h"
+#include "parse.h"
+#include "tape.h"
+#if !IS_WINDOWS
+#include <pthread.h>
+#endif
+#if HAS_GVL_RELEASE
+#include <ruby/thread.h>
+#endif
+
+// Amount read from an IO at a time.
+#define NDJSON_READ_SIZE	0x00010000
+// Amount of String input tokenized by each thread per batch.
+#define NDJSON_CHUNK_SIZE	0x00100000
+// Less than this per thread is not worth starting a thread for.
+#define NDJSON_MIN_CHUNK	0x00010000
+#define NDJSON_MAX_THREADS	64
+
+// One parser set up once and used for every line. String input is copied a
+// line at a time into buf so it can be terminated. IO input is read into buf
+// and each line is terminated in place.
+typedef struct _NDJson {
+    struct _ParseInfo	pi;
+    VALUE		input;
+    VALUE		errors;	// [line, message] pairs when skipping errors
+    VALUE		opts;	// Oj::Options the options are shared with or nil
+    char		*buf;
+    size_t		size;	// usable size of buf, one more byte is allocated
+    size_t		start;	// IO, start of the unparsed data in buf
+    size_t		end;	// IO, end of the data in buf
+    size_t		off;	// String, offset of the next line in input
+    long		line;	// line number of the last line parsed
+    ID			read_id;// 0 for a String
+    struct _Tape	*tapes;	// one per thread when threads is more than 1
+    int			threads;
+    int			tcnt;	// tapes in the current batch
+    int			ti;	// current tape
+    size_t		li;	// next line on the current tape
+    bool		eof;
+    bool		skip_errors;
+    bool		ready;	// stack and caches have been initialized
+} *NDJson;
+
+// One chunk of a batch, tokenized on its own thread.
+typedef struct _Work {
+    Tape		t;
+    const char		*start;
+    const char		*end;
+    Options		opts;
+    int			max_depth;
+} *Work;
+
+typedef struct _Batch {
+    struct _Work	work[NDJSON_MAX_THREADS];
+    int			cnt;
+} *Batch;
+
+typedef struct _Replay {
+    ParseInfo		pi;
+    Tape		t;
+    TapeLine		line;
+} *Replay;
+
+static VALUE	skip_errors_sym;
+static VALUE	threads_sym;
+
+static void
+ndjson_mark(void *ptr) {
+    NDJson	nd = (NDJson)ptr;
+
+    if (NULL == nd) {
+	return;
+    }
+    rb_gc_mark(nd->input);
+    rb_gc_mark(nd->errors);
+    rb_gc_mark(nd->opts);
+    if (nd->ready) {
+	oj_stack_mark(&nd->pi.stack);
+	oj_str_cache_mark(&nd->pi.key_cache);
+	oj_str_cache_mark(&nd->pi.str_cache);
+    }
+}
+
+static void
+ndjson_free(void *ptr) {
+    NDJson	nd = (NDJson)ptr;
+
+    if (NULL == nd) {
+	return;
+    }
+    if (nd->ready) {
+	stack_cleanup(&nd->pi.stack);
+	oj_str_cache_cleanup(&nd->pi.key_cache);
+	oj_str_cache_cleanup(&nd->pi.str_cache);
+    }
+    if (Qnil == nd->opts && NULL != nd->pi.options.str_rx.head && nd->pi.options.str_rx.head != oj_default_options.str_rx.head) {
+	oj_rxclass_cleanup(&nd->pi.options.str_rx);
+    }
+    if (NULL != nd->buf) {
+	xfree(nd->buf);
+    }
+    if (NULL != nd->tapes) {
+	int	i;
+
+	for (i = 0; i < nd->threads; i++) {
+	    oj_tape_cleanup(nd->tapes + i);
+	}
+	xfree(nd->tapes);
+    }
+    xfree(nd);
+}
+
+static void
+ensure_size(NDJson nd, size_t size) {
+    if (NULL == nd->buf || nd->size < size) {
+	if (size < nd->size * 2) {
+	    size = nd->size * 2;
+	}
+	if (NULL == nd->buf) {
+	    nd->buf = ALLOC_N(char, size + 1);
+	} else {
+	    REALLOC_N(nd->buf, char, size + 1);
+	}
+	nd->size = size;
+    }
+}
+
+static VALUE
+read_cb(VALUE ndv) {
+    NDJson		nd = (NDJson)ndv;
+    volatile VALUE	rstr = rb_funcall(nd->input, nd->read_id, 1, INT2FIX(NDJSON_READ_SIZE));
+    size_t		cnt;
+
+    if (Qnil == rstr || 0 == (cnt = RSTRING_LEN(rstr))) {
+	nd->eof = true;
+	return Qnil;
+    }
+    ensure_size(nd, nd->end + cnt);
+    memcpy(nd->buf + nd->end, StringValuePtr(rstr), cnt);
+    nd->end += cnt;
+
+    return Qnil;
+}
+
+static VALUE
+eof_cb(VALUE ndv, VALUE err) {
+    ((NDJson)ndv)->eof = true;
+
+    return Qnil;
+}
+
+// Sets *linep to the next terminated line and returns its length or -1 at
+// the end of the input.
+static long
+next_line(NDJson nd, char **linep) {
+    char	*nl;
+    size_t	len;
+
+    if (0 == nd->read_id) {
+	const char	*str = RSTRING_PTR(nd->input);
+	size_t		slen = RSTRING_LEN(nd->input);
+
+	if (slen <= nd->off) {
+	    return -1;
+	}
+	str += nd->off;
+	if (NULL == (nl = memchr(str, '\n', slen - nd->off))) {
+	    len = slen - nd->off;
+	    nd->off = slen;
+	} else {
+	    len = nl - str;
+	    nd->off += len + 1;
+	}
+	ensure_size(nd, len);
+	memcpy(nd->buf, str, len);
+	nd->buf[len] = '\0';
+	*linep = nd->buf;
+
+	return (long)len;
+    }
+    while (true) {
+	if (NULL != (nl = memchr(nd->buf + nd->start, '\n', nd->end - nd->start))) {
+	    *nl = '\0';
+	    *linep = nd->buf + nd->start;
+	    len = nl - *linep;
+	    nd->start += len + 1;
+
+	    return (long)len;
+	}
+	if (nd->eof) {
+	    if (nd->start < nd->end) {
+		*linep = nd->buf + nd->start;
+		len = nd->end - nd->start;
+		(*linep)[len] = '\0';
+		nd->start = nd->end;
+
+		return (long)len;
+	    }
+	    return -1;
+	}
+	if (0 < nd->start) {
+	    memmove(nd->buf, nd->buf + nd->start, nd->end - nd->start);
+	    nd->end -= nd->start;
+	    nd->start = 0;
+	}
+	rb_rescue2(read_cb, (VALUE)nd, eof_cb, (VALUE)nd, rb_eEOFError, (VALUE)0);
+    }
+    return -1;
+}
+
+static VALUE
+protect_parse(VALUE pip) {
+    oj_parse2((ParseInfo)pip);
+
+    return Qnil;
+}
+
+// Parses one line. Returns true and sets *docp if a document was read.
+static bool
+parse_line(NDJson nd, char *line, size_t len, VALUE *docp) {
+    ParseInfo	pi = &nd->pi;
+    int		state = 0;
+
+    pi->json = line;
+    pi->cur = line;
+    pi->end = line + len;
+    stack_reset(&pi->stack);
+    rb_protect(protect_parse, (VALUE)pi, &state);
+    if (0 != state) {
+	volatile VALUE	err = rb_errinfo();
+
+	if (!nd->skip_errors || !rb_obj_is_kind_of(err, rb_eStandardError)) {
+	    rb_jump_tag(state);
+	}
+	rb_set_errinfo(Qnil);
+	rb_ary_push(nd->errors, rb_ary_new3(2, LONG2NUM(nd->line), rb_funcall(err, rb_intern("message"), 0)));
+
+	return false;
+    }
+    if (!err_has(&pi->err) && !stack_empty(&pi->stack)) {
+	oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "not terminated");
+    }
+    if (err_has(&pi->err)) {
+	if (!nd->skip_errors) {
+	    rb_raise(pi->err.clas, "%s, NDJSON line %ld", pi->err.msg, nd->line);
+	}
+	rb_ary_push(nd->errors, rb_ary_new3(2, LONG2NUM(nd->line), rb_str_new2(pi->err.msg)));
+
+	return false;
+    }
+    *docp = stack_head_val(&pi->stack);
+
+    return true;
+}
+
+// Copies a line so it can be terminated and parses it. Returns false for a
+// blank line.
+static bool
+parse_copy(NDJson nd, const char *str, size_t len, VALUE *docp) {
+    const char	*s;
+
+    ensure_size(nd, len);
+    memcpy(nd->buf, str, len);
+    nd->buf[len] = '\0';
+    for (s = nd->buf; ' ' == *s || '\t' == *s || '\r' == *s || '\f' == *s; s++) {
+    }
+    if ('\0' == *s) {
+	return false;
+    }
+    return parse_line(nd, nd->buf, len, docp);
+}
+
+static void*
+build_tape(void *arg) {
+    Work	w = (Work)arg;
+
+    oj_tape_build(w->t, w->start, w->end, w->opts, w->max_depth);
+
+    return NULL;
+}
+
+// Called without the GVL. The first chunk is tokenized on the calling thread.
+static void*
+build_tapes(void *arg) {
+    Batch	b = (Batch)arg;
+#if !IS_WINDOWS
+    pthread_t	threads[NDJSON_MAX_THREADS];
+    bool	started[NDJSON_MAX_THREADS];
+    int		i;
+
+    for (i = 1; i < b->cnt; i++) {
+	if (!(started[i] = (0 == pthread_create(threads + i, NULL, build_tape, b->work + i)))) {
+	    build_tape(b->work + i);
+	}
+    }
+    build_tape(b->work);
+    for (i = 1; i < b->cnt; i++) {
+	if (started[i]) {
+	    pthread_join(threads[i], NULL);
+	}
+    }
+#else
+    int		i;
+
+    for (i = 0; i < b->cnt; i++) {
+	build_tape(b->work + i);
+    }
+#endif
+    return NULL;
+}
+
+// Splits the next batch of the input at line ends and tokenizes the pieces
+// in parallel.
+static void
+build_batch(NDJson nd) {
+    struct _Batch	b;
+    const char		*str = RSTRING_PTR(nd->input);
+    const char		*start = str + nd->off;
+    const char		*end = str + RSTRING_LEN(nd->input);
+    const char		*nl;
+    const char		*s;
+    const char		*cut;
+    size_t		size;
+    int			i;
+
+    if (NDJSON_CHUNK_SIZE * (size_t)nd->threads < (size_t)(end - start)) {
+	end = start + NDJSON_CHUNK_SIZE * nd->threads;
+	end = (NULL == (nl = memchr(end, '\n', str + RSTRING_LEN(nd->input) - end))) ? str + RSTRING_LEN(nd->input) : nl + 1;
+    }
+    size = end - start;
+    if (nd->threads <= (b.cnt = (int)(size / NDJSON_MIN_CHUNK) + 1)) {
+	b.cnt = nd->threads;
+    }
+    for (i = 0, s = start; i < b.cnt; i++) {
+	if (i == b.cnt - 1) {
+	    cut = end;
+	} else {
+	    if ((cut = start + size * (i + 1) / b.cnt) < s) {
+		cut = s;
+	    }
+	    cut = (NULL == (nl = memchr(cut, '\n', end - cut))) ? end : nl + 1;
+	}
+	b.work[i].t = nd->tapes + i;
+	b.work[i].start = s;
+	b.work[i].end = cut;
+	b.work[i].opts = &nd->pi.options;
+	b.work[i].max_depth = nd->pi.max_depth;
+	s = cut;
+    }
+#if HAS_GVL_RELEASE
+    rb_thread_call_without_gvl(build_tapes, &b, NULL, NULL);
+#else
+    build_tapes(&b);
+#endif
+    nd->tcnt = b.cnt;
+    nd->ti = 0;
+    nd->li = 0;
+    nd->off = end - str;
+}
+
+static VALUE
+protect_replay(VALUE rp) {
+    Replay	r = (Replay)rp;
+
+    oj_tape_replay(r->pi, r->t, r->line);
+
+    return Qnil;
+}
+
+static bool
+replay_line(NDJson nd, Tape t, TapeLine line, VALUE *docp) {
+    struct _Replay	r = { &nd->pi, t, line };
+    int			state = 0;
+
+    stack_reset(&nd->pi.stack);
+    rb_protect(protect_replay, (VALUE)&r, &state);
+    if (0 == state && !err_has(&nd->pi.err)) {
+	*docp = stack_head_val(&nd->pi.stack);
+	return true;
+    }
+    if (0 != state) {
+	if (!rb_obj_is_kind_of(rb_errinfo(), rb_eStandardError)) {
+	    rb_jump_tag(state);
+	}
+	rb_set_errinfo(Qnil);
+    }
+    // Parse the line again so the error is reported exactly as it would be
+    // without threads.
+    return parse_copy(nd, line->start, line->end - line->start, docp);
+}
+
+// Same as next_doc() but with documents from tapes built in parallel.
+static bool
+next_tape_doc(NDJson nd, VALUE *docp) {
+    Tape	t;
+    TapeLine	line;
+    const char	*nl;
+    const char	*str;
+
+    while (true) {
+	if (nd->tcnt <= nd->ti) {
+	    if ((size_t)RSTRING_LEN(nd->input) <= nd->off) {
+		return false;
+	    }
+	    build_batch(nd);
+	    continue;
+	}
+	t = nd->tapes + nd->ti;
+	if (nd->li < t->lcnt) {
+	    line = t->lines + nd->li++;
+	    nd->line++;
+	    if (LINE_DOC == line->kind) {
+		if (replay_line(nd, t, line, docp)) {
+		    return true;
+		}
+	    } else if (LINE_SERIAL == line->kind) {
+		if (parse_copy(nd, line->start, line->end - line->start, docp)) {
+		    return true;
+		}
+	    }
+	} else if (t->rest < t->end) {
+	    // Memory ran out while building the tape so the rest of the
+	    // chunk is parsed a line at a time.
+	    str = t->rest;
+	    if (NULL == (nl = memchr(str, '\n', t->end - str))) {
+		t->rest = t->end;
+	    } else {
+		t->rest = nl + 1;
+	    }
+	    nd->line++;
+	    if (parse_copy(nd, str, ((NULL == nl) ? t->end : nl) - str, docp)) {
+		return true;
+	    }
+	} else {
+	    nd->ti++;
+	    nd->li = 0;
+	}
+    }
+    return false;
+}
+
+// Returns true and sets *docp to the next document or returns false at the
+// end of the input. Blank lines are skipped.
+static bool
+next_doc(NDJson nd, VALUE *docp) {
+    char	*line;
+    long	len;
+    char	*s;
+
+    if (NULL != nd->tapes) {
+	return next_tape_doc(nd, docp);
+    }
+    while (0 <= (len = next_line(nd, &line))) {
+	nd->line++;
+	for (s = line; ' ' == *s || '\t' == *s || '\r' == *s || '\f' == *s; s++) {
+	}
+	if ('\0' == *s) {
+	    continue;
+	}
+	if (parse_line(nd, line, (size_t)len, docp)) {
+	    return true;
+	}
+    }
+    return false;
+}
+
+/* Document-method: new
+ * call-seq: new(input, options)
+ *
+ * Creates a reader for newline delimited JSON. Each line holds one JSON
+ * document. Blank lines are skipped. The parser is set up once and reused
+ * for every line so the :cache_keys and :cache_str options are shared across
+ * documents.
+ *
+ * - *input* [_String_|_IO_] the JSON lines or an IO that responds to readpartial() or read()
+ * - *options* [_Hash_] load options (same as default_options) and
+ *   - *:skip_errors* [_Boolean_] if true lines that fail to parse are skipped and recorded in errors instead of raising, default is false
+ *   - *:threads* [_Fixnum_] number of threads used to tokenize String input without holding the GVL, objects are still created on the calling thread, default is 1
+ */
+static VALUE
+ndjson_new(int argc, VALUE *argv, VALUE self) {
+    NDJson		nd;
+    volatile VALUE	obj;
+    volatile VALUE	v;
+
+    if (1 > argc) {
+	rb_raise(rb_eArgError, "Wrong number of arguments to Oj::NDJSON.new().");
+    }
+    nd = ALLOC(struct _NDJson);
+    memset(nd, 0, sizeof(struct _NDJson));
+    nd->input = Qnil;
+    nd->errors = Qnil;
+    nd->opts = Qnil;
+    obj = Data_Wrap_Struct(oj_ndjson_class, ndjson_mark, ndjson_free, nd);
+
+    nd->input = argv[0];
+    if (T_STRING == rb_type(nd->input)) {
+	nd->read_id = 0;
+    } else if (rb_respond_to(nd->input, oj_readpartial_id)) {
+	nd->read_id = oj_readpartial_id;
+    } else if (rb_respond_to(nd->input, oj_read_id)) {
+	nd->read_id = oj_read_id;
+    } else {
+	rb_raise(rb_eArgError, "NDJSON input must be a String or respond to readpartial() or read().");
+    }
+    nd->errors = rb_ary_new();
+    nd->pi.options = oj_default_options;
+    nd->pi.handler = Qnil;
+    nd->pi.err_class = Qnil;
+    nd->pi.proc = Qundef;
+    if (2 <= argc && oj_is_options(argv[1])) {
+	VALUE	h = oj_options_hash(argv[1]);
+
+	oj_parse_options(argv[1], &nd->pi.options);
+	if (h != argv[1]) {
+	    nd->opts = argv[1];
+	}
+	if (Qnil != (v = rb_hash_lookup(h, skip_errors_sym))) {
+	    nd->skip_errors = (Qtrue == v);
+	}
+	if (Qnil != (v = rb_hash_lookup(h, threads_sym))) {
+	    nd->threads = NUM2INT(v);
+	    if (NDJSON_MAX_THREADS < nd->threads) {
+		nd->threads = NDJSON_MAX_THREADS;
+	    }
+	}
+    }
+    switch (nd->pi.options.mode) {
+    case StrictMode:
+	oj_set_strict_callbacks(&nd->pi);
+	break;
+    case NullMode:
+    case CompatMode:
+    case CustomMode:
+    case RailsMode:
+	oj_set_compat_callbacks(&nd->pi);
+	break;
+    case WabMode:
+	oj_set_wab_callbacks(&nd->pi);
+	break;
+    case ObjectMode:
+    default:
+	oj_set_object_callbacks(&nd->pi);
+	break;
+    }
+    // The stack and caches live as long as this object and are marked by it
+    // so the Data objects that would mark them for a single parse are
+    // cleared.
+    DATA_PTR(oj_stack_init(&nd->pi.stack)) = 0;
+    if (Yes == nd->pi.options.cache_keys) {
+	DATA_PTR(oj_str_cache_init(&nd->pi.key_cache, Yes == nd->pi.options.sym_key, STR_CACHE_KEY_MAX, &oj_key_cache_stats)) = 0;
+    }
+    if (0 < nd->pi.options.cache_str) {
+	DATA_PTR(oj_str_cache_init(&nd->pi.str_cache, false, STR_CACHE_STR_MAX, &oj_str_cache_stats)) = 0;
+    }
+    if (0 != nd->read_id) {
+	ensure_size(nd, NDJSON_READ_SIZE);
+    } else if (1 < nd->threads) {
+	int	i;
+
+	// The threads read the input without the GVL so it must not change
+	// underneath them.
+	nd->input = rb_str_new_frozen(nd->input);
+	nd->tapes = ALLOC_N(struct _Tape, nd->threads);
+	for (i = 0; i < nd->threads; i++) {
+	    oj_tape_init(nd->tapes + i);
+	}
+    }
+    nd->ready = true;
+
+    return obj;
+}
+
+/* Document-method: each
+ * call-seq: each() { |doc| }
+ *
+ * Yields each remaining document. Returns an Enumerator if no block is given.
+ */
+static VALUE
+ndjson_each(VALUE self) {
+    NDJson		nd = (NDJson)DATA_PTR(self);
+    volatile VALUE	doc;
+
+    RETURN_ENUMERATOR(self, 0, 0);
+    while (next_doc(nd, (VALUE*)&doc)) {
+	rb_yield(doc);
+    }
+    // Nothing else refers to self when called from load_ndjson().
+    RB_GC_GUARD(self);
+
+    return self;
+}
+
+/* Document-method: read
+ * call-seq: read(max=nil)
+ *
+ * Reads up to _max_ documents, or all remaining documents if _max_ is nil.
+ *
+ * Returns [_Array_] the documents read, empty at the end of the input.
+ */
+static VALUE
+ndjson_read(int argc, VALUE *argv, VALUE self) {
+    NDJson		nd = (NDJson)DATA_PTR(self);
+    volatile VALUE	docs = rb_ary_new();
+    volatile VALUE	doc;
+    long		max = -1;
+
+    if (1 <= argc && Qnil != argv[0]) {
+	max = NUM2LONG(argv[0]);
+    }
+    for (; 0 != max && next_doc(nd, (VALUE*)&doc); max--) {
+	rb_ary_push(docs, doc);
+    }
+    RB_GC_GUARD(self);
+
+    return docs;
+}
+
+/* Document-method: line
+ * call-seq: line()
+ *
+ * Returns [_Fixnum_] the line number of the last line read.
+ */
+static VALUE
+ndjson_line(VALUE self) {
+    return LONG2NUM(((NDJson)DATA_PTR(self))->line);
+}
+
+/* Document-method: errors
+ * call-seq: errors()
+ *
+ * Returns [_Array_] a [line, message] pair for each line skipped with the
+ * :skip_errors option.
+ */
+static VALUE
+ndjson_errors(VALUE self) {
+    return ((NDJson)DATA_PTR(self))->errors;
+}
+
+/* Document-method: load_ndjson
+ * call-seq: load_ndjson(input, options) { |doc| }
+ *
+ * Parses newline delimited JSON, one document per line, with a single
+ * parser set up. Options are the same as for Oj::NDJSON.new().
+ *
+ * - *input* [_String_|_IO_] the JSON lines
+ * - *options* [_Hash_] load options
+ *
+ * Returns [_Array_|_nil_] all the documents if no block is given otherwise
+ * each is yielded and nil is returned.
+ */
+static VALUE
+load_ndjson(int argc, VALUE *argv, VALUE self) {
+    volatile VALUE	nd = ndjson_new(argc, argv, oj_ndjson_class);
+
+    if (rb_block_given_p()) {
+	ndjson_each(nd);
+	return Qnil;
+    }
+    return ndjson_read(0, NULL, nd);
+}
+
+void
+oj_ndjson_init() {
+    oj_ndjson_class = rb_define_class_under(Oj, "NDJSON", rb_cObject);
+    rb_undef_alloc_func(oj_ndjson_class);
+    rb_include_module(oj_ndjson_class, rb_mEnumerable);
+    rb_define_singleton_method(oj_ndjson_class, "new", ndjson_new, -1);
+    rb_define_method(oj_ndjson_class, "each", ndjson_each, 0);
+    rb_define_method(oj_ndjson_class, "read", ndjson_read, -1);
+    rb_define_method(oj_ndjson_class, "line", ndjson_line, 0);
+    rb_define_method(oj_ndjson_class, "errors", ndjson_errors, 0);
+    rb_define_module_function(Oj, "load_ndjson", load_ndjson, -1);
+
+    skip_errors_sym = ID2SYM(rb_intern("skip_errors"));	rb_gc_register_address(&skip_errors_sym);
+    threads_sym = ID2SYM(rb_intern("threads"));		rb_gc_register_address(&threads_sym);
+}
@@ -438,6 +438,10 @@ oj_set_obj_ivar(Val parent, Val kval, VALUE value) {
 	    rb_funcall(parent->val, rb_intern("set_backtrace"), 1, value);
 	}
     }
+    if (0 != (var_id = oj_attr_hash_find(key, klen))) {
+	rb_ivar_set(parent->val, var_id, value);
+	return;
+    }
 #if USE_PTHREAD_MUTEX
     pthread_mutex_lock(&oj_cache_mutex);
 #elif USE_RB_MUTEX
@@ -43,6 +43,7 @@ ID	oj_exclude_end_id;
 ID	oj_error_id;
 ID	oj_file_id;
 ID	oj_fileno_id;
+ID	oj_flush_id;
 ID	oj_ftype_id;
 ID	oj_has_key_id;
 ID	oj_hash_end_id;
@@ -79,10 +80,14 @@ ID	oj_write_id;
 VALUE	oj_bag_class;
 VALUE	oj_bigdecimal_class;
 VALUE	oj_cstack_class;
+VALUE	oj_options_class;
 VALUE	oj_date_class;
 VALUE	oj_datetime_class;
 VALUE	oj_enumerable_class;
 VALUE	oj_parse_error_class;
+VALUE	oj_ndjson_class;
+VALUE	oj_parser_class;
+VALUE	oj_dumper_class;
 VALUE	oj_stream_writer_class;
 VALUE	oj_string_writer_class;
 VALUE	oj_stringio_class;
@@ -107,6 +112,8 @@ static VALUE	auto_sym;
 static VALUE	bigdecimal_as_decimal_sym;
 static VALUE	bigdecimal_load_sym;
 static VALUE	bigdecimal_sym;
+static VALUE	cache_keys_sym;
+static VALUE	cache_str_sym;
 static VALUE	circular_sym;
 static VALUE	class_cache_sym;
 static VALUE	compat_sym;
@@ -179,6 +186,8 @@ struct _Options	oj_default_options = {
     No,		// allow_invalid
     No,		// create_ok
     Yes,	// allow_nan
+    No,		// cache_keys
+    0,		// cache_str
     oj_json_class,	// create_id
     10,		// create_id_len
     9,		// sec_prec
@@ -234,6 +243,8 @@ struct _Options	oj_default_options = {
  * - *:quirks_mode* [_true,_|_false_|_nil_] Allow single JSON values instead of documents, default is true (allow)
  * - *:allow_invalid_unicode* [_true,_|_false_|_nil_] Allow invalid unicode, default is false (don't allow)
  * - *:allow_nan* [_true,_|_false_|_nil_] Allow Nan, Infinity, and -Infinity to be parsed, default is true (allow)
+ * - *:cache_keys* [_true,_|_false_|_nil_] share one frozen String or Symbol for each distinct hash key in a strict or compat mode parse, default is false
+ * - *:cache_str* [_Fixnum_] share frozen String values up to this many bytes long in a strict or compat mode parse, 0 (the default) turns it off
  * - *:indent_str* [_String_|_nil_] String to use for indentation, overriding the indent option is not nil
  * - *:space* [_String_|_nil_] String to use for the space after the colon in JSON object fields
  * - *:space_before* [_String_|_nil_] String to use before the colon separator in JSON object fields
@@ -270,6 +281,8 @@ get_def_opts(VALUE self) {
     rb_hash_aset(opts, oj_quirks_mode_sym, (Yes == oj_default_options.quirks_mode) ? Qtrue : ((No == oj_default_options.quirks_mode) ? Qfalse : Qnil));
     rb_hash_aset(opts, allow_invalid_unicode_sym, (Yes == oj_default_options.allow_invalid) ? Qtrue : ((No == oj_default_options.allow_invalid) ? Qfalse : Qnil));
     rb_hash_aset(opts, oj_allow_nan_sym, (Yes == oj_default_options.allow_nan) ? Qtrue : ((No == oj_default_options.allow_nan) ? Qfalse : Qnil));
+    rb_hash_aset(opts, cache_keys_sym, (Yes == oj_default_options.cache_keys) ? Qtrue : ((No == oj_default_options.cache_keys) ? Qfalse : Qnil));
+    rb_hash_aset(opts, cache_str_sym, INT2FIX(oj_default_options.cache_str));
     rb_hash_aset(opts, float_prec_sym, INT2FIX(oj_default_options.float_prec));
     switch (oj_default_options.mode) {
     case StrictMode:	rb_hash_aset(opts, mode_sym, strict_sym);	break;
@@ -349,6 +362,8 @@ get_def_opts(VALUE self) {
  *   - *:quirks_mode* [_Boolean_|_nil_] allow single JSON values instead of documents, default is true (allow).
  *   - *:allow_invalid_unicode* [_Boolean_|_nil_] allow invalid unicode, default is false (don't allow).
  *   - *:allow_nan* [_Boolean_|_nil_] allow Nan, Infinity, and -Infinity, default is true (allow).
+ *   - *:cache_keys* [_Boolean_|_nil_] reuse frozen hash keys within a strict or compat mode parse, default is false.
+ *   - *:cache_str* [_Fixnum_] reuse frozen String values up to this many bytes within a strict or compat mode parse, default is 0 (off).
  *   - *:space* [_String_|_nil_] String to use for the space after the colon in JSON object fields.
  *   - *:space_before* [_String_|_nil_] String to use before the colon separator in JSON object fields.
  *   - *:object_nl* [_String_|_nil_] String to use after a JSON object field value.
@@ -366,8 +381,155 @@ set_def_opts(VALUE self, VALUE opts) {
     return Qnil;
 }
 
+// Options parsed once by Oj::Options.new(). The flags record which of the
+// options the load and dump methods adjust per mode were in the Hash so the
+// adjustments are kept when they were not.
+typedef struct _CompiledOpts {
+    struct _Options	opts;
+    VALUE		hash;
+    bool		nilnil;
+    bool		empty_string;
+    bool		allow_nan;
+    bool		nan;
+} *CompiledOpts;
+
+static CompiledOpts
+compiled_opts(VALUE ropts) {
+    if (T_DATA == rb_type(ropts) && oj_options_class == rb_obj_class(ropts)) {
+	return (CompiledOpts)DATA_PTR(ropts);
+    }
+    return NULL;
+}
+
+static void
+apply_compiled_opts(CompiledOpts co, Options copts) {
+    struct _Options	prev = *copts;
+
+    *copts = co->opts;
+    if (!co->nilnil) {
+	copts->nilnil = prev.nilnil;
+    }
+    if (!co->empty_string) {
+	copts->empty_string = prev.empty_string;
+    }
+    if (!co->allow_nan) {
+	copts->allow_nan = prev.allow_nan;
+    }
+    if (!co->nan) {
+	copts->dump_opts.nan_dump = prev.dump_opts.nan_dump;
+    }
+}
+
+bool
+oj_is_options(VALUE ropts) {
+    return T_HASH == rb_type(ropts) || NULL != compiled_opts(ropts);
+}
+
+VALUE
+oj_options_hash(VALUE ropts) {
+    CompiledOpts	co = compiled_opts(ropts);
+
+    return (NULL == co) ? ropts : co->hash;
+}
+
+static void
+options_mark(void *ptr) {
+    if (NULL != ptr) {
+	rb_gc_mark(((CompiledOpts)ptr)->hash);
+    }
+}
+
+static void
+options_free(void *ptr) {
+    CompiledOpts	co = (CompiledOpts)ptr;
+
+    if (NULL == co) {
+	return;
+    }
+    // Anything that copies the options, such as a StringWriter, keeps the
+    // Oj::Options alive so the create_id and patterns can be freed here.
+    if (NULL != co->opts.create_id) {
+	xfree((char*)co->opts.create_id);
+    }
+    oj_rxclass_cleanup(&co->opts.str_rx);
+    xfree(co);
+}
+
+static bool
+has_key(VALUE h, VALUE key) {
+    return Qtrue == rb_funcall(h, oj_has_key_id, 1, key);
+}
+
+/* Document-class: Oj::Options
+ *
+ * A set of options parsed and checked once. An Oj::Options can be passed
+ * anywhere an options Hash is accepted, such as to Oj.load, Oj.dump,
+ * Oj::StringWriter.new, and Oj::Rails::Encoder.new, and is not parsed again
+ * on each call. Options not in the Hash take the default options at the time
+ * the Oj::Options is created. Instances are frozen.
+ */
+
+/* Document-method: new
+ * call-seq: new(opts)
+ *
+ * Creates a new Oj::Options from an options Hash.
+ *
+ * - *opts* [_Hash_] options, the same as for Oj.default_options=
+ */
+static VALUE
+options_new(VALUE clas, VALUE ropts) {
+    CompiledOpts	co = ALLOC(struct _CompiledOpts);
+    VALUE		self;
+
+    Check_Type(ropts, T_HASH);
+    memset(co, 0, sizeof(struct _CompiledOpts));
+    co->hash = Qnil;
+    self = Data_Wrap_Struct(oj_options_class, options_mark, options_free, co);
+    co->opts = oj_default_options;
+    // The create_id and patterns are copied so changing the default options
+    // later does not free them out from under this instance.
+    if (NULL != oj_default_options.create_id) {
+	char	*id = ALLOC_N(char, oj_default_options.create_id_len + 1);
+
+	memcpy(id, oj_default_options.create_id, oj_default_options.create_id_len + 1);
+	co->opts.create_id = id;
+    }
+    oj_rxclass_copy(&oj_default_options.str_rx, &co->opts.str_rx);
+    {
+	const char	*id = co->opts.create_id;
+	struct _RxClass	rx = co->opts.str_rx;
+
+	oj_parse_options(ropts, &co->opts);
+	// Replaced by a new create_id or match_string from the Hash.
+	if (NULL != id && id != co->opts.create_id) {
+	    xfree((char*)id);
+	}
+	if (rx.head != co->opts.str_rx.head) {
+	    oj_rxclass_cleanup(&rx);
+	}
+    }
+    co->nilnil = has_key(ropts, nilnil_sym) || has_key(ropts, allow_blank_sym);
+    co->empty_string = has_key(ropts, empty_string_sym);
+    co->allow_nan = has_key(ropts, oj_allow_nan_sym);
+    co->nan = has_key(ropts, nan_sym);
+    co->hash = rb_obj_freeze(rb_hash_dup(ropts));
+
+    return rb_obj_freeze(self);
+}
+
+/* Document-method: to_h
+ * call-seq: to_h()
+ *
+ * Returns [_Hash_] a copy of the options Hash the instance was created from.
+ */
+static VALUE
+options_to_h(VALUE self) {
+    return rb_hash_dup(((CompiledOpts)DATA_PTR(self))->hash);
+}
+
 void
 oj_parse_options(VALUE ropts, Options copts) {
+    CompiledOpts	co;
     struct _YesNoOpt	ynos[] = {
 	{ circular_sym, &copts->circular },
 	{ auto_define_sym, &copts->auto_define },
@@ -385,6 +547,7 @@ oj_parse_options(VALUE ropts, Options copts) {
 	{ allow_invalid_unicode_sym, &copts->allow_invalid },
 	{ oj_allow_nan_sym, &copts->allow_nan },
 	{ oj_create_additions_sym, &copts->create_ok },
+	{ cache_keys_sym, &copts->cache_keys },
 	{ Qnil, 0 }
     };
     YesNoOpt		o;
@@ -392,6 +555,9 @@ oj_parse_options(VALUE ropts, Options copts) {
     size_t		len;
     
     if (T_HASH != rb_type(ropts)) {
+	if (NULL != (co = compiled_opts(ropts))) {
+	    apply_compiled_opts(co, copts);
+	}
 	return;
     }
     if (Qtrue == rb_funcall(ropts, oj_has_key_id, 1, oj_indent_sym)) {
@@ -464,6 +630,24 @@ oj_parse_options(VALUE ropts, Options copts) {
 	}
 	copts->sec_prec = n;
     }
+    if (Qnil != (v = rb_hash_lookup(ropts, cache_str_sym))) {
+	int	n;
+
+#ifdef RUBY_INTEGER_UNIFICATION
+	if (rb_cInteger != rb_obj_class(v)) {
+	    rb_raise(rb_eArgError, ":cache_str must be a Integer.");
+	}
+#else
+	if (T_FIXNUM != rb_type(v)) {
+	    rb_raise(rb_eArgError, ":cache_str must be a Fixnum.");
+	}
+#endif
+	n = NUM2INT(v);
+	if (0 > n) {
+	    n = 0;
+	}
+	copts->cache_str = n;
+    }
     if (Qnil != (v = rb_hash_lookup(ropts, mode_sym))) {
 	if (wab_sym == v) {
 	    copts->mode = WabMode;
@@ -525,8 +709,10 @@ oj_parse_options(VALUE ropts, Options copts) {
     if (Qtrue == rb_funcall(ropts, oj_has_key_id, 1, create_id_sym)) {
 	v = rb_hash_lookup(ropts, create_id_sym);
 	if (Qnil == v) {
-	    if (oj_json_class != oj_default_options.create_id && NULL != copts->create_id) {
-		xfree((char*)oj_default_options.create_id);
+	    // Only the default options own their create_id here. Other
+	    // options may be sharing it with the defaults.
+	    if (copts == &oj_default_options && oj_json_class != copts->create_id && NULL != copts->create_id) {
+		xfree((char*)copts->create_id);
 	    }
 	    copts->create_id = NULL;
 	    copts->create_id_len = 0;
@@ -718,6 +904,9 @@ oj_parse_opt_match_string(RxClass rc, VALUE ropts) {
  * any, will be yielded to. If no block then the last element read will be
  * returned.
  *
+ * Regular files are memory mapped and parsed in place. Other paths, such as
+ * named pipes, are read with the stream parser.
+ *
  * This parser operates on string and will attempt to load files into memory if
  * a file object is passed as the first argument. A stream input will be parsed
  * using a stream parser but others use the slightly faster string parser.
@@ -746,10 +935,13 @@ load(int argc, VALUE *argv, VALUE self) {
 	rb_raise(rb_eArgError, "Wrong number of arguments to load().");
     }
     if (2 <= argc) {
-	VALUE	ropts = argv[1];
-	VALUE	v;
+	VALUE		ropts = argv[1];
+	VALUE		v;
+	CompiledOpts	co;
 
-	if (Qnil != ropts || CompatMode != mode) {
+	if (NULL != (co = compiled_opts(ropts))) {
+	    mode = co->opts.mode;
+	} else if (Qnil != ropts || CompatMode != mode) {
 	    Check_Type(ropts, T_HASH);
 	    if (Qnil != (v = rb_hash_lookup(ropts, mode_sym))) {
 		if (object_sym == v) {
@@ -842,11 +1034,25 @@ load_file(int argc, VALUE *argv, VALUE self) {
     pi.err_class = Qnil;
     pi.max_depth = 0;
     if (2 <= argc) {
-	VALUE	ropts = argv[1];
-	VALUE	v;
-
-	Check_Type(ropts, T_HASH);
-	if (Qnil != (v = rb_hash_lookup(ropts, mode_sym))) {
+	VALUE		ropts = argv[1];
+	VALUE		v;
+	struct _Options	copts;
+	CompiledOpts	co;
+
+	if (NULL != (co = compiled_opts(ropts))) {
+	    // Already checked when created.
+	    mode = co->opts.mode;
+	} else {
+	    Check_Type(ropts, T_HASH);
+	    // The parser reads the options again. Checking them here first
+	    // means a bad option raises before the file is opened and mapped.
+	    copts = pi.options;
+	    oj_parse_options(ropts, &copts);
+	    if (copts.str_rx.head != pi.options.str_rx.head) {
+		oj_rxclass_cleanup(&copts.str_rx);
+	    }
+	}
+	if (NULL == co && Qnil != (v = rb_hash_lookup(ropts, mode_sym))) {
 	    if (object_sym == v) {
 		mode = ObjectMode;
 	    } else if (strict_sym == v) {
@@ -867,28 +1073,33 @@ load_file(int argc, VALUE *argv, VALUE self) {
 	}
     }
     path = StringValuePtr(*argv);
-    if (0 == (fd = open(path, O_RDONLY))) {
+    if (0 > (fd = open(path, O_RDONLY))) {
 	rb_raise(rb_eIOError, "%s", strerror(errno));
     }
     switch (mode) {
     case StrictMode:
 	oj_set_strict_callbacks(&pi);
-	return oj_pi_sparse(argc, argv, &pi, fd);
+	break;
     case NullMode:
     case CompatMode:
     case CustomMode:
     case RailsMode:
 	oj_set_compat_callbacks(&pi);
-	return oj_pi_sparse(argc, argv, &pi, fd);
+	break;
     case WabMode:
 	oj_set_wab_callbacks(&pi);
-	return oj_pi_sparse(argc, argv, &pi, fd);
+	break;
     case ObjectMode:
     default:
+	oj_set_object_callbacks(&pi);
 	break;
     }
-    oj_set_object_callbacks(&pi);
-
+    // Regular files are mapped and parsed in place. Anything else, such as
+    // a named pipe, is read through the stream parser.
+    if (oj_pi_map_fd(&pi, fd)) {
+	close(fd);
+	return oj_pi_parse(argc, argv, &pi, 0, 0, true);
+    }
     return oj_pi_sparse(argc, argv, &pi, fd);
 }
 
@@ -921,6 +1132,26 @@ safe_load(VALUE self, VALUE doc) {
     return oj_pi_parse(1, args, &pi, 0, 0, 1);
 }
 
+/* Document-method: cache_stats
+ * call-seq: cache_stats()
+ *
+ * Returns the number of hits and misses for the :cache_keys and :cache_str
+ * caches summed over all the loads that have completed.
+ *
+ * Returns [_Hash_] with :key_hits, :key_misses, :str_hits, and :str_misses.
+ */
+static VALUE
+cache_stats(VALUE self) {
+    volatile VALUE	stats = rb_hash_new();
+
+    rb_hash_aset(stats, ID2SYM(rb_intern("key_hits")), ULL2NUM(oj_key_cache_stats.hits));
+    rb_hash_aset(stats, ID2SYM(rb_intern("key_misses")), ULL2NUM(oj_key_cache_stats.misses));
+    rb_hash_aset(stats, ID2SYM(rb_intern("str_hits")), ULL2NUM(oj_str_cache_stats.hits));
+    rb_hash_aset(stats, ID2SYM(rb_intern("str_misses")), ULL2NUM(oj_str_cache_stats.misses));
+
+    return stats;
+}
+
 /* Document-method: saj_parse
  * call-seq: saj_parse(handler, io)
  *
@@ -960,6 +1191,7 @@ dump(int argc, VALUE *argv, VALUE self) {
     struct _Out		out;
     struct _Options	copts = oj_default_options;
     VALUE		rstr;
+    VALUE		arg = Qnil;
 
     if (1 > argc) {
 	rb_raise(rb_eArgError, "wrong number of arguments (0 for 1).");
@@ -969,13 +1201,17 @@ dump(int argc, VALUE *argv, VALUE self) {
     }
     if (2 == argc) {
 	oj_parse_options(argv[1], &copts);
+	// to_json and as_json are given the Hash, not an Oj::Options.
+	arg = oj_options_hash(argv[1]);
     }
     out.buf = buf;
     out.end = buf + sizeof(buf) - 10;
     out.allocated = false;
+    out.str = Qnil;
+    out.flush = NULL;
     out.omit_nil = copts.dump_opts.omit_nil;
     out.caller = CALLER_DUMP;
-    oj_dump_obj_to_json_using_params(*argv, &copts, &out, argc - 1,argv + 1);
+    oj_dump_obj_to_json_using_params(*argv, &copts, &out, argc - 1, &arg);
     if (0 == out.buf) {
 	rb_raise(rb_eNoMemError, "Not enough memory.");
     }
@@ -987,6 +1223,97 @@ dump(int argc, VALUE *argv, VALUE self) {
     return rstr;
 }
 
+typedef struct _DumpTo {
+    VALUE	obj;
+    Options	copts;
+    Out		out;
+    int		argc;
+    VALUE	*argv;
+} *DumpTo;
+
+static VALUE
+protect_dump_to(VALUE dp) {
+    DumpTo	d = (DumpTo)dp;
+
+    oj_dump_obj_to_json_using_params(d->obj, d->copts, d->out, d->argc, d->argv);
+
+    return Qnil;
+}
+
+/* Document-method: dump_to
+ * call-seq: dump_to(buffer, obj, options)
+ *
+ * Dumps an Object (obj) onto the end of a String (buffer). The JSON is
+ * written directly into the String, which grows as needed, instead of into a
+ * new String that would then be copied. The buffer can not be modified while
+ * the dump is in progress and is left unchanged if the dump raises. The
+ * buffer ends up UTF-8 encoded. If it holds non-ASCII characters in another
+ * ASCII compatible encoding they are converted to UTF-8 first, otherwise an
+ * Encoding::CompatibilityError is raised.
+ * - *buffer* [_String_] String to append the JSON document to
+ * - *obj* [_Object_] Object to serialize as an JSON document String
+ * - *options* [_Hash_] same as default_options
+ *
+ * Returns [_String_] the buffer.
+ */
+static VALUE
+dump_to(int argc, VALUE *argv, VALUE self) {
+    struct _Out		out;
+    struct _Options	copts = oj_default_options;
+    struct _DumpTo	d;
+    volatile VALUE	buffer;
+    VALUE		arg = Qnil;
+    int			state = 0;
+
+    if (2 > argc || 3 < argc) {
+	rb_raise(rb_eArgError, "wrong number of arguments (%d for 2..3).", argc);
+    }
+    buffer = argv[0];
+    Check_Type(buffer, T_STRING);
+    rb_str_modify(buffer);
+#if HAS_ENCODING_SUPPORT
+    // The JSON is UTF-8 so a buffer holding anything other than ASCII in
+    // another encoding is converted first.
+    if (rb_utf8_encoding() != rb_enc_get(buffer) && 0 < RSTRING_LEN(buffer) && !rb_enc_str_asciionly_p(buffer)) {
+	rb_encoding	*enc = rb_enc_get(buffer);
+	VALUE		ustr = Qnil;
+
+	if (rb_enc_asciicompat(enc) && rb_ascii8bit_encoding() != enc) {
+	    ustr = rb_str_conv_enc(buffer, enc, rb_utf8_encoding());
+	}
+	if (Qnil == ustr || rb_utf8_encoding() != rb_enc_get(ustr)) {
+	    rb_raise(rb_eEncCompatError, "incompatible character encodings: %s and UTF-8", rb_enc_name(enc));
+	}
+	rb_str_replace(buffer, ustr);
+    }
+#endif
+    if (CompatMode == copts.mode) {
+	copts.dump_opts.nan_dump = WordNan;
+    }
+    if (3 == argc) {
+	oj_parse_options(argv[2], &copts);
+	// to_json and as_json are given the Hash, not an Oj::Options.
+	arg = oj_options_hash(argv[2]);
+    }
+    out.omit_nil = copts.dump_opts.omit_nil;
+    out.caller = CALLER_DUMP;
+    out.flush = NULL;
+    oj_out_init_str(&out, buffer, 4096);
+    d.obj = argv[1];
+    d.copts = &copts;
+    d.out = &out;
+    d.argc = argc - 2;
+    d.argv = &arg;
+    rb_protect(protect_dump_to, (VALUE)&d, &state);
+    oj_out_str_done(&out, 0 == state);
+    if (0 != state) {
+	rb_jump_tag(state);
+    }
+    oj_encode(buffer);
+
+    return buffer;
+}
+
 /* Document-method: to_json
  * call-seq: to_json(obj, options)
  *
@@ -1025,6 +1352,8 @@ to_json(int argc, VALUE *argv, VALUE self) {
     out.buf = buf;
     out.end = buf + sizeof(buf) - 10;
     out.allocated = false;
+    out.str = Qnil;
+    out.flush = NULL;
     out.omit_nil = copts.dump_opts.omit_nil;
     // For obj.to_json or generate nan is not allowed but if called from dump
     // it is.
@@ -1468,8 +1797,16 @@ Init_oj() {
 
     oj_cstack_class = rb_define_class_under(Oj, "CStack", rb_cObject);
 
+    oj_options_class = rb_define_class_under(Oj, "Options", rb_cObject);
+    rb_undef_alloc_func(oj_options_class);
+    rb_define_singleton_method(oj_options_class, "new", options_new, 1);
+    rb_define_method(oj_options_class, "to_h", options_to_h, 0);
+
     oj_string_writer_init();
     oj_stream_writer_init();
+    oj_ndjson_init();
+    oj_parser_init();
+    oj_dumper_init();
 
     rb_require("date");
     // On Rubinius the require fails but can be done from a ruby file.
@@ -1495,12 +1832,14 @@ Init_oj() {
     rb_define_module_function(Oj, "load", load, -1);
     rb_define_module_function(Oj, "load_file", load_file, -1);
     rb_define_module_function(Oj, "safe_load", safe_load, 1);
+    rb_define_module_function(Oj, "cache_stats", cache_stats, 0);
     rb_define_module_function(Oj, "strict_load", oj_strict_parse, -1);
     rb_define_module_function(Oj, "compat_load", oj_compat_parse, -1);
     rb_define_module_function(Oj, "object_load", oj_object_parse, -1);
     rb_define_module_function(Oj, "wab_load", oj_wab_parse, -1);
 
     rb_define_module_function(Oj, "dump", dump, -1);
+    rb_define_module_function(Oj, "dump_to", dump_to, -1);
 
     rb_define_module_function(Oj, "to_file", to_file, -1);
     rb_define_module_function(Oj, "to_stream", to_stream, -1);
@@ -1531,6 +1870,7 @@ Init_oj() {
     oj_exclude_end_id = rb_intern("exclude_end?");
     oj_file_id = rb_intern("file?");
     oj_fileno_id = rb_intern("fileno");
+    oj_flush_id = rb_intern("flush");
     oj_ftype_id = rb_intern("ftype");
     oj_hash_end_id = rb_intern("hash_end");
     oj_hash_key_id = rb_intern("hash_key");
@@ -1589,6 +1929,8 @@ Init_oj() {
     bigdecimal_as_decimal_sym = ID2SYM(rb_intern("bigdecimal_as_decimal"));rb_gc_register_address(&bigdecimal_as_decimal_sym);
     bigdecimal_load_sym = ID2SYM(rb_intern("bigdecimal_load"));	rb_gc_register_address(&bigdecimal_load_sym);
     bigdecimal_sym = ID2SYM(rb_intern("bigdecimal"));		rb_gc_register_address(&bigdecimal_sym);
+    cache_keys_sym = ID2SYM(rb_intern("cache_keys"));		rb_gc_register_address(&cache_keys_sym);
+    cache_str_sym = ID2SYM(rb_intern("cache_str"));		rb_gc_register_address(&cache_str_sym);
     circular_sym = ID2SYM(rb_intern("circular"));		rb_gc_register_address(&circular_sym);
     class_cache_sym = ID2SYM(rb_intern("class_cache"));		rb_gc_register_address(&class_cache_sym);
     compat_sym = ID2SYM(rb_intern("compat"));			rb_gc_register_address(&compat_sym);
@@ -1644,6 +1986,7 @@ Init_oj() {
     oj_default_options.mode = ObjectMode;
 
     oj_hash_init();
+    oj_scan_init();
     oj_odd_init();
     oj_mimic_rails_init();
 
@@ -26,7 +26,7 @@ extern "C" {
 #if USE_PTHREAD_MUTEX
 #include <pthread.h>
 #endif
-#include "cache8.h"
+#include "circmap.h"
 
 #ifdef RUBINIUS_RUBY
 #undef T_RATIONAL
@@ -152,6 +152,8 @@ typedef struct _Options {
     char		allow_invalid;	// YesNo - allow invalid unicode
     char		create_ok;	// YesNo allow create_id
     char		allow_nan;	// YEsyNo for parsing only
+    char		cache_keys;	// YesNo share hash keys within a parse
+    int			cache_str;	// longest string value to share, 0 for none
     const char		*create_id;	// 0 or string
     size_t		create_id_len;	// length of create_id
     int			sec_prec;	// second precision when dumping time
@@ -179,11 +181,18 @@ typedef struct _ROptTable {
     ROpt		table;
 } *ROptTable;
 
+// Where a flushing Out writes a full buffer instead of growing it.
+typedef struct _OutFlush {
+    FILE		*fp;	// written to with fwrite() if not NULL
+    int			fd;	// otherwise written to with write() if not -1
+    VALUE		io;	// otherwise written to with write()
+} *OutFlush;
+
 typedef struct _Out {
     char		*buf;
     char		*end;
     char		*cur;
-    Cache8		circ_cache;
+    CircMap		circ_map;
     slot_t		circ_cnt;
     int			indent;
     int			depth; // used by dump_hash
@@ -191,6 +200,8 @@ typedef struct _Out {
     uint32_t		hash_cnt;
     bool		allocated;
     bool		omit_nil;
+    VALUE		str;	// String buf is part of or Qnil
+    OutFlush		flush;	// NULL unless the buffer is written out when full
     int			argc;
     VALUE		*argv;
     DumpCaller		caller; // used for the mimic json only
@@ -200,6 +211,7 @@ typedef struct _Out {
 typedef struct _StrWriter {
     struct _Out		out;
     struct _Options	opts;
+    VALUE		ropts;	// options opts was filled from, kept alive for an Oj::Options
     int			depth;
     char		*types;	// DumpType
     char		*types_end;
@@ -219,7 +231,8 @@ enum {
     NO_VAL   = 0x00,
     STR_VAL  = 0x01,
     COL_VAL  = 0x02,
-    RUBY_VAL = 0x03
+    RUBY_VAL = 0x03,
+    LAZY_VAL = 0x04  // container not parsed yet, str is the opening bracket
 };
     
 typedef struct _Leaf {
@@ -236,6 +249,7 @@ typedef struct _Leaf {
     uint8_t		rtype;
     uint8_t		parent_type;
     uint8_t		value_type;
+    uint32_t		child_index; // Oj::Doc index of the children + 1, 0 if not built
 } *Leaf;
 
 extern VALUE	oj_saj_parse(int argc, VALUE *argv, VALUE self);
@@ -255,6 +269,10 @@ extern VALUE	oj_object_parse_cstr(int argc, VALUE *argv, char *json, size_t len)
 extern VALUE	oj_custom_parse_cstr(int argc, VALUE *argv, char *json, size_t len);
 
 extern void	oj_parse_options(VALUE ropts, Options copts);
+// True if ropts is an options Hash or an Oj::Options.
+extern bool	oj_is_options(VALUE ropts);
+// The Hash an Oj::Options was created from, otherwise ropts itself.
+extern VALUE	oj_options_hash(VALUE ropts);
 
 extern void	oj_dump_obj_to_json(VALUE obj, Options copts, Out out);
 extern void	oj_dump_obj_to_json_using_params(VALUE obj, Options copts, Out out, int argc, VALUE *argv);
@@ -274,6 +292,9 @@ extern void	oj_str_writer_pop_all(StrWriter sw);
 extern void	oj_init_doc(void);
 extern void	oj_string_writer_init();
 extern void	oj_stream_writer_init();
+extern void	oj_ndjson_init();
+extern void	oj_parser_init();
+extern void	oj_dumper_init();
 extern void	oj_str_writer_init(StrWriter sw, int buf_size);
 extern VALUE	oj_define_mimic_json(int argc, VALUE *argv, VALUE self);
 extern VALUE	oj_mimic_generate(int argc, VALUE *argv, VALUE self);
@@ -297,12 +318,16 @@ extern VALUE		oj_utf8_encoding;
 extern VALUE	oj_bag_class;
 extern VALUE	oj_bigdecimal_class;
 extern VALUE	oj_cstack_class;
+extern VALUE	oj_options_class;
 extern VALUE	oj_date_class;
 extern VALUE	oj_datetime_class;
 extern VALUE	oj_doc_class;
 extern VALUE	oj_enumerable_class;
 extern VALUE	oj_json_generator_error_class;
 extern VALUE	oj_json_parser_error_class;
+extern VALUE	oj_ndjson_class;
+extern VALUE	oj_parser_class;
+extern VALUE	oj_dumper_class;
 extern VALUE	oj_stream_writer_class;
 extern VALUE	oj_string_writer_class;
 extern VALUE	oj_stringio_class;
@@ -335,6 +360,7 @@ extern ID	oj_error_id;
 extern ID	oj_exclude_end_id;
 extern ID	oj_file_id;
 extern ID	oj_fileno_id;
+extern ID	oj_flush_id;
 extern ID	oj_ftype_id;
 extern ID	oj_has_key_id;
 extern ID	oj_hash_end_id;
@@ -8,6 +8,10 @@
 #include <string.h>
 #include <unistd.h>
 #include <math.h>
+#include <sys/stat.h>
+#if !IS_WINDOWS
+#include <sys/mman.h>
+#endif
 
 #include "oj.h"
 #include "encode.h"
@@ -15,6 +19,8 @@
 #include "buf.h"
 #include "val_stack.h"
 #include "rxclass.h"
+#include "hash.h"
+#include "dbl.h"
 
 // Workaround in case INFINITY is not defined in math.h or if the OS is CentOS
 #define OJ_INFINITY	(1.0/0.0)
@@ -25,6 +31,10 @@
 
 static void
 next_non_white(ParseInfo pi) {
+    if (0 != pi->scan.tokens) {
+	pi->cur = scan_next(&pi->scan, pi->scan.tokens, pi->cur);
+	return;
+    }
     for (; 1; pi->cur++) {
 	switch(*pi->cur) {
 	case ' ':
@@ -185,51 +195,74 @@ unicode_to_chars(ParseInfo pi, Buf buf, uint32_t code) {
     }
 }
 
+// Returns the next byte that ends an unescaped run in a string body.
+inline static const char*
+str_stop(ParseInfo pi, const char *s) {
+    if (0 != pi->scan.stops) {
+	return scan_next(&pi->scan, pi->scan.stops, s);
+    }
+    return oj_scan_str(s, pi->end);
+}
+
+// Frees the escape buffer unless it belongs to a reused parser.
+inline static void
+esc_buf_done(Buf buf, Buf local) {
+    if (buf == local) {
+	buf_cleanup(buf);
+    }
+}
+
 // entered at /
 static void
 read_escaped_str(ParseInfo pi, const char *start) {
-    struct _Buf	buf;
+    struct _Buf	local;
+    Buf		buf = &local;
     const char	*s;
     int		cnt = (int)(pi->cur - start);
     uint32_t	code;
     Val		parent = stack_peek(&pi->stack);
 
-    buf_init(&buf);
+    if (NULL != pi->esc_buf) {
+	buf = pi->esc_buf;
+	buf->tail = buf->head;
+    } else {
+	buf_init(buf);
+    }
     if (0 < cnt) {
-	buf_append_string(&buf, start, cnt);
+	buf_append_string(buf, start, cnt);
     }
     for (s = pi->cur; '"' != *s; s++) {
 	if (s >= pi->end) {
 	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "quoted string not terminated");
-	    buf_cleanup(&buf);
+	    esc_buf_done(buf, &local);
 	    return;
 	} else if ('\\' == *s) {
 	    s++;
 	    switch (*s) {
-	    case 'n':	buf_append(&buf, '\n');	break;
-	    case 'r':	buf_append(&buf, '\r');	break;
-	    case 't':	buf_append(&buf, '\t');	break;
-	    case 'f':	buf_append(&buf, '\f');	break;
-	    case 'b':	buf_append(&buf, '\b');	break;
-	    case '"':	buf_append(&buf, '"');	break;
-	    case '/':	buf_append(&buf, '/');	break;
-	    case '\\':	buf_append(&buf, '\\');	break;
+	    case 'n':	buf_append(buf, '\n');	break;
+	    case 'r':	buf_append(buf, '\r');	break;
+	    case 't':	buf_append(buf, '\t');	break;
+	    case 'f':	buf_append(buf, '\f');	break;
+	    case 'b':	buf_append(buf, '\b');	break;
+	    case '"':	buf_append(buf, '"');	break;
+	    case '/':	buf_append(buf, '/');	break;
+	    case '\\':	buf_append(buf, '\\');	break;
 	    case '\'':
 		// The json gem claims this is not an error despite the
 		// ECMA-404 indicating it is not valid.
 		if (CompatMode == pi->options.mode) {
-		    buf_append(&buf, '\'');
+		    buf_append(buf, '\'');
 		} else {
 		    pi->cur = s;
 		    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "invalid escaped character");
-		    buf_cleanup(&buf);
+		    esc_buf_done(buf, &local);
 		    return;
 		}
 		break;
 	    case 'u':
 		s++;
 		if (0 == (code = read_hex(pi, s)) && err_has(&pi->err)) {
-		    buf_cleanup(&buf);
+		    esc_buf_done(buf, &local);
 		    return;
 		}
 		s += 3;
@@ -241,53 +274,58 @@ read_escaped_str(ParseInfo pi, const char *start) {
 		    if ('\\' != *s || 'u' != *(s + 1)) {
 			if (Yes == pi->options.allow_invalid) {
 			    s--;
-			    unicode_to_chars(pi, &buf, code);
+			    unicode_to_chars(pi, buf, code);
 			    break;
 			}
 			pi->cur = s;
 			oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "invalid escaped character");
-			buf_cleanup(&buf);
+			esc_buf_done(buf, &local);
 			return;
 		    }
 		    s += 2;
 		    if (0 == (c2 = read_hex(pi, s)) && err_has(&pi->err)) {
-			buf_cleanup(&buf);
+			esc_buf_done(buf, &local);
 			return;
 		    }
 		    s += 3;
 		    c2 = (c2 - 0x0000DC00) & 0x000003FF;
 		    code = ((c1 << 10) | c2) + 0x00010000;
 		}
-		unicode_to_chars(pi, &buf, code);
+		unicode_to_chars(pi, buf, code);
 		if (err_has(&pi->err)) {
-		    buf_cleanup(&buf);
+		    esc_buf_done(buf, &local);
 		    return;
 		}
 		break;
 	    default:
 		pi->cur = s;
 		oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "invalid escaped character");
-		buf_cleanup(&buf);
+		esc_buf_done(buf, &local);
 		return;
 	    }
 	} else {
-	    buf_append(&buf, *s);
+	    // Copy the whole run up to the next quote or escape. A '\0' before
+	    // the end is copied along with the rest.
+	    const char	*t = str_stop(pi, s + 1);
+
+	    buf_append_string(buf, s, t - s);
+	    s = t - 1;
 	}
     }
     if (0 == parent) {
-	pi->add_cstr(pi, buf.head, buf_len(&buf), start);
+	pi->add_cstr(pi, buf->head, buf_len(buf), start);
     } else {
 	switch (parent->next) {
 	case NEXT_ARRAY_NEW:
 	case NEXT_ARRAY_ELEMENT:
-	    pi->array_append_cstr(pi, buf.head, buf_len(&buf), start);
+	    pi->array_append_cstr(pi, buf->head, buf_len(buf), start);
 	    parent->next = NEXT_ARRAY_COMMA;
 	    break;
 	case NEXT_HASH_NEW:
 	case NEXT_HASH_KEY:
-	    if (Qundef == (parent->key_val = pi->hash_key(pi, buf.head, buf_len(&buf)))) {
-		parent->key = strdup(buf.head);
-		parent->klen = buf_len(&buf);
+	    if (Qundef == (parent->key_val = pi->hash_key(pi, buf->head, buf_len(buf)))) {
+		parent->key = oj_strndup(buf->head, buf_len(buf));
+		parent->klen = buf_len(buf);
 	    } else {
 		parent->key = "";
 		parent->klen = 0;
@@ -296,7 +334,7 @@ read_escaped_str(ParseInfo pi, const char *start) {
 	    parent->next = NEXT_HASH_COLON;
 	    break;
 	case NEXT_HASH_VALUE:
-	    pi->hash_set_cstr(pi, parent, buf.head, buf_len(&buf), start);
+	    pi->hash_set_cstr(pi, parent, buf->head, buf_len(buf), start);
 	    if (0 != parent->key && 0 < parent->klen && (parent->key < pi->json || pi->cur < parent->key)) {
 		xfree((char*)parent->key);
 		parent->key = 0;
@@ -313,7 +351,7 @@ read_escaped_str(ParseInfo pi, const char *start) {
 	}
     }
     pi->cur = s + 1;
-    buf_cleanup(&buf);
+    esc_buf_done(buf, &local);
 }
 
 static void
@@ -321,6 +359,7 @@ read_str(ParseInfo pi) {
     const char	*str = pi->cur;
     Val		parent = stack_peek(&pi->stack);
 
+    pi->cur = str_stop(pi, pi->cur);
     for (; '"' != *pi->cur; pi->cur++) {
 	if (pi->end <= pi->cur) {
 	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "quoted string not terminated");
@@ -374,128 +413,145 @@ read_str(ParseInfo pi) {
     pi->cur++; // move past "
 }
 
-static void
-read_num(ParseInfo pi) {
-    struct _NumInfo	ni;
-    Val			parent = stack_peek(&pi->stack);
+// Reads the number at str into ni. The end of the number is returned. If the
+// number is not valid *errp is set and the position of the problem is
+// returned. No Ruby calls are made so this is safe without the GVL.
+const char*
+oj_num_scan(const char *str, NumInfo ni, Options opts, const char **errp) {
+    const char	*cur = str;
 
-    ni.str = pi->cur;
-    ni.i = 0;
-    ni.num = 0;
-    ni.div = 1;
-    ni.di = 0;
-    ni.len = 0;
-    ni.exp = 0;
-    ni.big = 0;
-    ni.infinity = 0;
-    ni.nan = 0;
-    ni.neg = 0;
-    ni.hasExp = 0;
-    ni.no_big = (FloatDec == pi->options.bigdec_load);
-
-    if ('-' == *pi->cur) {
-	pi->cur++;
-	ni.neg = 1;
-    } else if ('+' == *pi->cur) {
-	pi->cur++;
+    *errp = NULL;
+    ni->str = str;
+    ni->i = 0;
+    ni->num = 0;
+    ni->div = 1;
+    ni->di = 0;
+    ni->len = 0;
+    ni->exp = 0;
+    ni->big = 0;
+    ni->infinity = 0;
+    ni->nan = 0;
+    ni->neg = 0;
+    ni->hasExp = 0;
+    ni->no_big = (FloatDec == opts->bigdec_load);
+
+    if ('-' == *cur) {
+	cur++;
+	ni->neg = 1;
+    } else if ('+' == *cur) {
+	cur++;
     }
-    if ('I' == *pi->cur) {
-	if (No == pi->options.allow_nan || 0 != strncmp("Infinity", pi->cur, 8)) {
-	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "not a number or other value");
-	    return;
+    if ('I' == *cur) {
+	if (No == opts->allow_nan || 0 != strncmp("Infinity", cur, 8)) {
+	    *errp = "not a number or other value";
+	    return cur;
 	}
-	pi->cur += 8;
-	ni.infinity = 1;
-    } else if ('N' == *pi->cur || 'n' == *pi->cur) {
-	if ('a' != pi->cur[1] || ('N' != pi->cur[2] && 'n' != pi->cur[2])) {
-	    oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "not a number or other value");
-	    return;
+	cur += 8;
+	ni->infinity = 1;
+    } else if ('N' == *cur || 'n' == *cur) {
+	if ('a' != cur[1] || ('N' != cur[2] && 'n' != cur[2])) {
+	    *errp = "not a number or other value";
+	    return cur;
 	}
-	pi->cur += 3;
-	ni.nan = 1;
+	cur += 3;
+	ni->nan = 1;
     } else {
 	int	dec_cnt = 0;
 	bool	zero1 = false;
 	
-	for (; '0' <= *pi->cur && *pi->cur <= '9'; pi->cur++) {
-	    if (0 == ni.i && '0' == *pi->cur) {
+	for (; '0' <= *cur && *cur <= '9'; cur++) {
+	    if (0 == ni->i && '0' == *cur) {
 		zero1 = true;
 	    }
-	    if (0 < ni.i) {
+	    if (0 < ni->i) {
 		dec_cnt++;
 	    }
-	    if (!ni.big) {
-		int	d = (*pi->cur - '0');
+	    if (!ni->big) {
+		int	d = (*cur - '0');
 
 		if (0 < d) {
-		    if (zero1 && CompatMode == pi->options.mode) {
-			oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "not a number");
-			return;
+		    if (zero1 && CompatMode == opts->mode) {
+			*errp = "not a number";
+			return cur;
 		    }
 		    zero1 = false;
 		}
-		ni.i = ni.i * 10 + d;
-		if (INT64_MAX <= ni.i || DEC_MAX < dec_cnt) {
-		    ni.big = 1;
+		ni->i = ni->i * 10 + d;
+		if (INT64_MAX <= ni->i || DEC_MAX < dec_cnt) {
+		    ni->big = 1;
 		}
 	    }
 	}
-	if ('.' == *pi->cur) {
-	    pi->cur++;
-	    if (*pi->cur < '0' || '9' < *pi->cur) {
-		oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "not a number");
-		return;
+	if ('.' == *cur) {
+	    cur++;
+	    if (*cur < '0' || '9' < *cur) {
+		*errp = "not a number";
+		return cur;
 	    }
-	    for (; '0' <= *pi->cur && *pi->cur <= '9'; pi->cur++) {
-		int	d = (*pi->cur - '0');
+	    for (; '0' <= *cur && *cur <= '9'; cur++) {
+		int	d = (*cur - '0');
 
-		if (0 < ni.num || 0 < ni.i) {
+		if (0 < ni->num || 0 < ni->i) {
 		    dec_cnt++;
 		}
-		ni.num = ni.num * 10 + d;
-		ni.div *= 10;
-		ni.di++;
-		if (INT64_MAX <= ni.div || DEC_MAX < dec_cnt) {
-		    ni.big = 1;
+		ni->num = ni->num * 10 + d;
+		ni->div *= 10;
+		ni->di++;
+		if (INT64_MAX <= ni->div || DEC_MAX < dec_cnt) {
+		    ni->big = 1;
 		}
 	    }
 	}
-	if ('e' == *pi->cur || 'E' == *pi->cur) {
+	if ('e' == *cur || 'E' == *cur) {
 	    int	eneg = 0;
 
-	    ni.hasExp = 1;
-	    pi->cur++;
-	    if ('-' == *pi->cur) {
-		pi->cur++;
+	    ni->hasExp = 1;
+	    cur++;
+	    if ('-' == *cur) {
+		cur++;
 		eneg = 1;
-	    } else if ('+' == *pi->cur) {
-		pi->cur++;
+	    } else if ('+' == *cur) {
+		cur++;
 	    }
-	    for (; '0' <= *pi->cur && *pi->cur <= '9'; pi->cur++) {
-		ni.exp = ni.exp * 10 + (*pi->cur - '0');
-		if (EXP_MAX <= ni.exp) {
-		    ni.big = 1;
+	    for (; '0' <= *cur && *cur <= '9'; cur++) {
+		ni->exp = ni->exp * 10 + (*cur - '0');
+		if (EXP_MAX <= ni->exp) {
+		    ni->big = 1;
 		}
 	    }
 	    if (eneg) {
-		ni.exp = -ni.exp;
+		ni->exp = -ni->exp;
 	    }
 	}
-	ni.len = pi->cur - ni.str;
+	ni->len = cur - ni->str;
     }
     // Check for special reserved values for Infinity and NaN.
-    if (ni.big) {
-	if (0 == strcasecmp(INF_VAL, ni.str)) {
-	    ni.infinity = 1;
-	} else if (0 == strcasecmp(NINF_VAL, ni.str)) {
-	    ni.infinity = 1;
-	    ni.neg = 1;
-	} else if (0 == strcasecmp(NAN_VAL, ni.str)) {
-	    ni.nan = 1;
+    if (ni->big) {
+	if (0 == strcasecmp(INF_VAL, ni->str)) {
+	    ni->infinity = 1;
+	} else if (0 == strcasecmp(NINF_VAL, ni->str)) {
+	    ni->infinity = 1;
+	    ni->neg = 1;
+	} else if (0 == strcasecmp(NAN_VAL, ni->str)) {
+	    ni->nan = 1;
 	}
     }
-    if (BigDec == pi->options.bigdec_load) {
-	ni.big = 1;
+    if (BigDec == opts->bigdec_load) {
+	ni->big = 1;
+    }
+    return cur;
+}
+
+static void
+read_num(ParseInfo pi) {
+    struct _NumInfo	ni;
+    Val			parent = stack_peek(&pi->stack);
+    const char		*err;
+
+    pi->cur = oj_num_scan(pi->cur, &ni, &pi->options, &err);
+    if (NULL != err) {
+	oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "%s", err);
+	return;
     }
     if (0 == parent) {
 	pi->add_num(pi, &ni);
@@ -756,36 +812,18 @@ oj_num_as_value(NumInfo ni) {
 	    }
 	}
     } else { // decimal
-	if (ni->big) {
+	if (ni->big && !ni->no_big) {
 	    rnum = rb_funcall(oj_bigdecimal_class, oj_new_id, 1, rb_str_new(ni->str, ni->len));
-	    if (ni->no_big) {
-		rnum = rb_funcall(rnum, rb_intern("to_f"), 0);
-	    }
+	} else if (ni->big) {
+	    rnum = rb_float_new(oj_dbl_parse(ni->str, ni->len));
 	} else {
-	    // All these machinations are to get rounding to work better.
-	    long double	d = (long double)ni->i * (long double)ni->div + (long double)ni->num;
-	    int		x = (int)((int64_t)ni->exp - ni->di);
-
-	    // Rounding sometimes cuts off the last digit even if there are only
-	    // 15 digits. This attempts to fix those few cases where this
-	    // occurs.
-	    if ((long double)INT64_MAX > d && (int64_t)d != (ni->i * ni->div + ni->num)) {
-		rnum = rb_funcall(oj_bigdecimal_class, oj_new_id, 1, rb_str_new(ni->str, ni->len));
-		if (ni->no_big) {
-		    rnum = rb_funcall(rnum, rb_intern("to_f"), 0);
-		}
-	    } else {
-		d = roundl(d);
-		if (0 < x) {
-		    d *= powl(10.0L, x);
-		} else if (0 > x) {
-		    d /= powl(10.0L, -x);
-		}
-		if (ni->neg) {
-		    d = -d;
-		}
-		rnum = rb_float_new((double)d);
+	    double	d;
+
+	    // At most DEC_MAX + 1 digits so the mantissa always fits.
+	    if (!oj_dbl_from_parts((uint64_t)(ni->i * ni->div + ni->num), (long)(ni->exp - ni->di), ni->neg, &d)) {
+		d = oj_dbl_parse(ni->str, ni->len);
 	    }
+	    rnum = rb_float_new(d);
 	}
     }
     return rnum;
@@ -816,7 +854,7 @@ protect_parse(VALUE pip) {
 
 extern int oj_utf8_index;
 
-static void
+void
 oj_pi_set_input_str(ParseInfo pi, volatile VALUE *inputp) {
 #if HAS_ENCODING_SUPPORT
     rb_encoding	*enc = rb_to_encoding(rb_obj_encoding(*inputp));
@@ -829,12 +867,189 @@ oj_pi_set_input_str(ParseInfo pi, volatile VALUE *inputp) {
     pi->end = pi->json + RSTRING_LEN(*inputp);
 }
 
+#if !IS_WINDOWS
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS	MAP_ANON
+#endif
+#endif
+
+static void
+skip_bom(ParseInfo pi) {
+    if (3 <= pi->end - pi->json && 0xEF == (uint8_t)*pi->json && 0xBB == (uint8_t)pi->json[1] && 0xBF == (uint8_t)pi->json[2]) {
+	pi->json += 3;
+    }
+}
+
+// Maps a regular file so it can be parsed in place with oj_parse2. The
+// parser expects a '\0' after the last byte. When the file does not end on
+// a page boundary the rest of the last page is zero filled. Otherwise the
+// file is mapped over an anonymous mapping one page longer. Returns false if
+// the fd is not a regular file, is empty, or can not be mapped.
+bool
+oj_pi_map_fd(ParseInfo pi, int fd) {
+#if IS_WINDOWS
+    return false;
+#else
+    struct stat	st;
+    size_t	page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t	len;
+    size_t	map_len;
+    char	*addr;
+
+    if (0 != fstat(fd, &st) || !S_ISREG(st.st_mode) || 0 >= st.st_size) {
+	return false;
+    }
+    len = (size_t)st.st_size;
+    // MAP_PRIVATE so nothing is ever written back to the file.
+    if (0 == len % page) {
+	map_len = len + page;
+	if (MAP_FAILED == (addr = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0))) {
+	    return false;
+	}
+	if (MAP_FAILED == mmap(addr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0)) {
+	    munmap(addr, map_len);
+	    return false;
+	}
+    } else {
+	map_len = len;
+	if (MAP_FAILED == (addr = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0))) {
+	    return false;
+	}
+    }
+#ifdef MADV_SEQUENTIAL
+    madvise(addr, len, MADV_SEQUENTIAL);
+#endif
+    pi->map = addr;
+    pi->map_len = map_len;
+    pi->json = addr;
+    pi->end = addr + len;
+    skip_bom(pi);
+
+    return true;
+#endif
+}
+
+static void
+unmap(ParseInfo pi) {
+#if !IS_WINDOWS
+    if (NULL != pi->map) {
+	munmap(pi->map, pi->map_len);
+	pi->map = NULL;
+    }
+#endif
+}
+
+// Sets an error if the input was empty when that is not allowed or if the
+// JSON ended before all arrays and objects were closed.
+void
+oj_pi_check_done(ParseInfo pi) {
+    if (Qundef == pi->stack.head->val && !empty_ok(&pi->options)) {
+	if (No == pi->options.nilnil || (CompatMode == pi->options.mode && 0 < pi->cur - pi->json)) {
+	    oj_set_error_at(pi, oj_json_parser_error_class, __FILE__, __LINE__, "Empty input");
+	}
+    }
+    if (!err_has(&pi->err)) {
+	// If the stack is not empty then the JSON terminated early.
+	Val	v;
+
+	if (0 != (v = stack_peek(&pi->stack))) {
+	    switch (v->next) {
+	    case NEXT_ARRAY_NEW:
+	    case NEXT_ARRAY_ELEMENT:
+	    case NEXT_ARRAY_COMMA:
+		oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "Array not terminated");
+		break;
+	    case NEXT_HASH_NEW:
+	    case NEXT_HASH_KEY:
+	    case NEXT_HASH_COLON:
+	    case NEXT_HASH_VALUE:
+	    case NEXT_HASH_COMMA:
+		oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "Hash/Object not terminated");
+		break;
+	    default:
+		oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "not terminated");
+	    }
+	}
+    }
+}
+
+// Returns the exception for the error recorded in pi or Qnil if there is
+// none. In compat mode the message includes the JSON source so this must be
+// called before the input is freed or unmapped.
+static VALUE
+pi_error(ParseInfo pi) {
+    if (!err_has(&pi->err)) {
+	return Qnil;
+    }
+    if (Qnil != pi->err_class) {
+	pi->err.clas = pi->err_class;
+    }
+    if (CompatMode == pi->options.mode) {
+	// The json gem requires the error message be UTF-8 encoded. In
+	// additional the complete JSON source must be returned. There
+	// does not seem to be a size limit. A mapped file is not a String the
+	// caller passed in and can be huge so it is left out.
+	VALUE	msg = oj_encode(rb_str_new2(pi->err.msg));
+	VALUE	args[1];
+
+	if (NULL != pi->json && NULL == pi->map) {
+	    msg = rb_str_append(msg, oj_encode(rb_str_new2(" in '")));
+	    msg = rb_str_append(msg, oj_encode(rb_str_new2(pi->json)));
+	}
+	args[0] = msg;
+
+	return rb_class_new_instance(1, args, pi->err.clas);
+    }
+    return rb_exc_new_cstr(pi->err.clas, pi->err.msg);
+}
+
+// Raises the error recorded in pi, if any, or returns the result once it is
+// checked against the quirks_mode option.
+VALUE
+oj_pi_result(ParseInfo pi, VALUE result) {
+    VALUE	err = pi_error(pi);
+
+    if (Qnil != err) {
+	rb_exc_raise(err);
+    }
+    if (pi->options.quirks_mode == No) {
+	switch (rb_type(result)) {
+	case T_NIL:
+	case T_TRUE:
+	case T_FALSE:
+	case T_FIXNUM:
+	case T_FLOAT:
+	case T_CLASS:
+	case T_STRING:
+	case T_SYMBOL: {
+	    struct _Err	err;
+
+	    if (Qnil == pi->err_class) {
+		err.clas = oj_parse_error_class;
+	    } else {
+		err.clas = pi->err_class;
+	    }
+	    snprintf(err.msg, sizeof(err.msg), "unexpected non-document value");
+	    oj_err_raise(&err);
+	    break;
+	}
+	default:
+	    // okay
+	    break;
+	}
+    }
+    return result;
+}
+
 VALUE
 oj_pi_parse(int argc, VALUE *argv, ParseInfo pi, char *json, size_t len, int yieldOk) {
     char		*buf = 0;
     volatile VALUE	input;
     volatile VALUE	wrapped_stack;
+    volatile VALUE	wrapped_keys = Qnil;
+    volatile VALUE	wrapped_strs = Qnil;
     volatile VALUE	result = Qnil;
+    volatile VALUE	err = Qnil;
     int			line = 0;
     int			free_json = 0;
 
@@ -843,9 +1058,9 @@ oj_pi_parse(int argc, VALUE *argv, ParseInfo pi, char *json, size_t len, int yie
     }
     input = argv[0];
     if (2 <= argc) {
-	if (T_HASH == rb_type(argv[1])) {
+	if (oj_is_options(argv[1])) {
 	    oj_parse_options(argv[1], &pi->options);
-	} else if (3 <= argc && T_HASH == rb_type(argv[2])) {
+	} else if (3 <= argc && oj_is_options(argv[2])) {
 	    oj_parse_options(argv[2], &pi->options);
 	}
     }
@@ -858,6 +1073,8 @@ oj_pi_parse(int argc, VALUE *argv, ParseInfo pi, char *json, size_t len, int yie
 	pi->json = json;
 	pi->end = json + len;
 	free_json = 1;
+    } else if (NULL != pi->map) {
+	// already set up by oj_pi_map_fd()
     } else if (T_STRING == rb_type(input)) {
 	if (CompatMode == pi->options.mode) {
 	    if (No == pi->options.nilnil && 0 == RSTRING_LEN(input)) {
@@ -879,6 +1096,9 @@ oj_pi_parse(int argc, VALUE *argv, ParseInfo pi, char *json, size_t len, int yie
 	    s = rb_funcall2(input, oj_string_id, 0, 0);
 	    oj_pi_set_input_str(pi, &s);
 #if !IS_WINDOWS
+	} else if (rb_cFile == clas && 0 == FIX2INT(rb_funcall(input, oj_pos_id, 0)) &&
+		   oj_pi_map_fd(pi, FIX2INT(rb_funcall(input, oj_fileno_id, 0)))) {
+	    // parsed in place
 	} else if (rb_cFile == clas && 0 == FIX2INT(rb_funcall(input, oj_pos_id, 0))) {
 	    int		fd = FIX2INT(rb_funcall(input, oj_fileno_id, 0));
 	    ssize_t	cnt;
@@ -895,10 +1115,7 @@ oj_pi_parse(int argc, VALUE *argv, ParseInfo pi, char *json, size_t len, int yie
 		rb_raise(rb_eIOError, "failed to read from IO Object.");
 	    }
 	    ((char*)pi->json)[len] = '\0';
-	    /* skip UTF-8 BOM if present */
-	    if (0xEF == (uint8_t)*pi->json && 0xBB == (uint8_t)pi->json[1] && 0xBF == (uint8_t)pi->json[2]) {
-		pi->cur += 3;
-	    }
+	    skip_bom(pi);
 #endif
 	} else if (rb_respond_to(input, oj_read_id)) {
 	    // use stream parser instead
@@ -920,102 +1137,56 @@ oj_pi_parse(int argc, VALUE *argv, ParseInfo pi, char *json, size_t len, int yie
     // data object and poviding a mark function for ruby objects on the
     // value stack (while it is in scope).
     wrapped_stack = oj_stack_init(&pi->stack);
-    rb_protect(protect_parse, (VALUE)pi, &line);
-    if (Qundef == pi->stack.head->val && !empty_ok(&pi->options)) {
-	if (No == pi->options.nilnil || (CompatMode == pi->options.mode && 0 < pi->cur - pi->json)) {
-	    oj_set_error_at(pi, oj_json_parser_error_class, __FILE__, __LINE__, "Empty input");
-	}
+    if (Yes == pi->options.cache_keys) {
+	wrapped_keys = oj_str_cache_init(&pi->key_cache, Yes == pi->options.sym_key, STR_CACHE_KEY_MAX, &oj_key_cache_stats);
+    }
+    if (0 < pi->options.cache_str) {
+	wrapped_strs = oj_str_cache_init(&pi->str_cache, false, STR_CACHE_STR_MAX, &oj_str_cache_stats);
+    }
+    if (SCAN_MIN_LEN <= pi->end - pi->json) {
+	oj_scan_index_build(&pi->scan, pi->json, pi->end - pi->json);
     }
+    rb_protect(protect_parse, (VALUE)pi, &line);
+    oj_pi_check_done(pi);
     result = stack_head_val(&pi->stack);
     DATA_PTR(wrapped_stack) = 0;
+    if (Qnil != wrapped_keys) {
+	DATA_PTR(wrapped_keys) = 0;
+    }
+    if (Qnil != wrapped_strs) {
+	DATA_PTR(wrapped_strs) = 0;
+    }
     if (No == pi->options.allow_gc) {
 	rb_gc_enable();
     }
-    if (!err_has(&pi->err)) {
-	// If the stack is not empty then the JSON terminated early.
-	Val	v;
-
-	if (0 != (v = stack_peek(&pi->stack))) {
-	    switch (v->next) {
-	    case NEXT_ARRAY_NEW:
-	    case NEXT_ARRAY_ELEMENT:
-	    case NEXT_ARRAY_COMMA:
-		oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "Array not terminated");
-		break;
-	    case NEXT_HASH_NEW:
-	    case NEXT_HASH_KEY:
-	    case NEXT_HASH_COLON:
-	    case NEXT_HASH_VALUE:
-	    case NEXT_HASH_COMMA:
-		oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "Hash/Object not terminated");
-		break;
-	    default:
-		oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "not terminated");
-	    }
-	}
+    // The error message can refer to the input so build it before the input
+    // is released.
+    if (0 == line) {
+	err = pi_error(pi);
     }
     // proceed with cleanup
+    oj_scan_index_cleanup(&pi->scan);
     if (0 != pi->circ_array) {
 	oj_circ_array_free(pi->circ_array);
     }
     if (0 != buf) {
 	xfree(buf);
+    } else if (NULL != pi->map) {
+	unmap(pi);
     } else if (free_json) {
 	xfree(json);
     }
     stack_cleanup(&pi->stack);
+    oj_str_cache_cleanup(&pi->key_cache);
+    oj_str_cache_cleanup(&pi->str_cache);
     if (pi->str_rx.head != oj_default_options.str_rx.head) {
 	oj_rxclass_cleanup(&pi->str_rx);
     }
     if (0 != line) {
 	rb_jump_tag(line);
     }
-    if (err_has(&pi->err)) {
-	if (Qnil != pi->err_class) {
-	    pi->err.clas = pi->err_class;
-	}
-	if (CompatMode == pi->options.mode) {
-	    // The json gem requires the error message be UTF-8 encoded. In
-	    // additional the complete JSON source must be returned. There
-	    // does not seem to be a size limit.
-	    VALUE	msg = oj_encode(rb_str_new2(pi->err.msg));
-	    VALUE	args[1];
-
-	    if (NULL != pi->json) {
-		msg = rb_str_append(msg, oj_encode(rb_str_new2(" in '")));
-		msg = rb_str_append(msg, oj_encode(rb_str_new2(pi->json)));
-	    }
-	    args[0] = msg;
-	    rb_exc_raise(rb_class_new_instance(1, args, pi->err.clas));
-	} else {
-	    oj_err_raise(&pi->err);
-	}
+    if (Qnil != err) {
+	rb_exc_raise(err);
     }
-    if (pi->options.quirks_mode == No) {
-	switch (rb_type(result)) {
-	case T_NIL:
-	case T_TRUE:
-	case T_FALSE:
-	case T_FIXNUM:
-	case T_FLOAT:
-	case T_CLASS:
-	case T_STRING:
-	case T_SYMBOL: {
-	    struct _Err	err;
-
-	    if (Qnil == pi->err_class) {
-		err.clas = oj_parse_error_class;
-	    } else {
-		err.clas = pi->err_class;
-	    }
-	    snprintf(err.msg, sizeof(err.msg), "unexpected non-document value");
-	    oj_err_raise(&err);
-	    break;
-	}
-	default:
-	    // okay
-	    break;
-	}
-    }
-    return result;
+    return oj_pi_result(pi, result);
 }
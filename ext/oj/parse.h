@@ -12,10 +12,14 @@
 
 #include "ruby.h"
 #include "oj.h"
+#include "buf.h"
 #include "val_stack.h"
 #include "circarray.h"
 #include "reader.h"
 #include "rxclass.h"
+#include "scan.h"
+#include "str_cache.h"
+#include "encode.h"
 
 struct _RxClass;
 
@@ -40,6 +44,9 @@ typedef struct _ParseInfo {
     const char		*json;
     const char		*cur;
     const char		*end;
+    struct _ScanIndex	scan; // empty unless the input is large enough
+    char		*map; // set when json is a memory mapped file
+    size_t		map_len;
     // used for the stream parser
     struct _Reader	rd;
 
@@ -47,6 +54,9 @@ typedef struct _ParseInfo {
     struct _Options	options;
     VALUE		handler;
     struct _ValStack	stack;
+    struct _StrCache	key_cache; // empty unless cache_keys is set
+    struct _StrCache	str_cache; // empty unless cache_str is set
+    Buf			esc_buf; // kept between parses by an Oj::Parser, otherwise NULL
     CircArray		circ_array;
     struct _RxClass	str_rx;
     int			expect_value;
@@ -75,12 +85,18 @@ typedef struct _ParseInfo {
 extern void	oj_parse2(ParseInfo pi);
 extern void	oj_set_error_at(ParseInfo pi, VALUE err_clas, const char* file, int line, const char *format, ...);
 extern VALUE	oj_pi_parse(int argc, VALUE *argv, ParseInfo pi, char *json, size_t len, int yieldOk);
+extern void	oj_pi_set_input_str(ParseInfo pi, volatile VALUE *inputp);
+extern void	oj_pi_check_done(ParseInfo pi);
+extern VALUE	oj_pi_result(ParseInfo pi, VALUE result);
+extern bool	oj_pi_map_fd(ParseInfo pi, int fd);
 extern VALUE	oj_num_as_value(NumInfo ni);
+extern const char*	oj_num_scan(const char *str, NumInfo ni, Options opts, const char **errp);
 
 extern void	oj_set_strict_callbacks(ParseInfo pi);
 extern void	oj_set_object_callbacks(ParseInfo pi);
 extern void	oj_set_compat_callbacks(ParseInfo pi);
 extern void	oj_set_wab_callbacks(ParseInfo pi);
+extern void	oj_set_custom_callbacks(ParseInfo pi);
 
 extern void	oj_sparse2(ParseInfo pi);
 extern VALUE	oj_pi_sparse(int argc, VALUE *argv, ParseInfo pi, int fd);
@@ -90,6 +106,16 @@ parse_info_init(ParseInfo pi) {
     memset(pi, 0, sizeof(struct _ParseInfo));
 }
 
+// Returns a String for a parsed string value, shared with earlier values of
+// the same content if the cache_str option covers it.
+static inline VALUE
+cstr_to_value(ParseInfo pi, const char *str, size_t len) {
+    if ((int)len <= pi->options.cache_str && str_cache_active(&pi->str_cache)) {
+	return oj_str_cache_intern(&pi->str_cache, str, len);
+    }
+    return oj_encode(rb_str_new(str, len));
+}
+
 static inline bool
 empty_ok(Options options) {
     switch (options->mode) {
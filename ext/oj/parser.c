@@ -0,0 +1,230 @@
+/* parser.c
+ * Copyright (c) 2017, Peter Ohler
+ * All rights reserved.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "oj.h"
+#include "err.h"
+#include "parse.h"
+
+// An escape buffer that grew past this is released after the parse instead
+// of being kept for the next one.
+#define PARSER_ESC_KEEP	0x00010000
+
+// A parser set up once and reused for each document. The value stack keeps
+// whatever it has grown to, the escaped string buffer and the key and string
+// caches are kept between parses, and the options are only read when the
+// parser is created.
+typedef struct _Parser {
+    struct _ParseInfo	pi;
+    struct _Buf		esc;
+    VALUE		opts;	// Oj::Options the options are shared with or nil
+    bool		yield_ok;
+    bool		busy;	// a parse is in progress
+} *Parser;
+
+static void
+parser_mark(void *ptr) {
+    Parser	p = (Parser)ptr;
+
+    if (NULL == p) {
+	return;
+    }
+    rb_gc_mark(p->opts);
+    oj_stack_mark(&p->pi.stack);
+    oj_str_cache_mark(&p->pi.key_cache);
+    oj_str_cache_mark(&p->pi.str_cache);
+}
+
+static void
+parser_free(void *ptr) {
+    Parser	p = (Parser)ptr;
+
+    if (NULL == p) {
+	return;
+    }
+    stack_cleanup(&p->pi.stack);
+    oj_str_cache_cleanup(&p->pi.key_cache);
+    oj_str_cache_cleanup(&p->pi.str_cache);
+    buf_cleanup(&p->esc);
+    xfree(p);
+}
+
+static VALUE
+protect_parse(VALUE pip) {
+    oj_parse2((ParseInfo)pip);
+
+    return Qnil;
+}
+
+/* Document-class: Oj::Parser
+ *
+ * A parser that is set up once and then used for any number of documents.
+ * The options are read when the parser is created and the parse stack,
+ * escaped string buffer, and the :cache_keys and :cache_str caches are kept
+ * from one parse to the next. A parser is not reentrant and should not be
+ * shared between threads.
+ */
+
+/* Document-method: new
+ * call-seq: new(options=nil)
+ *
+ * Creates a new parser. The mode and the adjustments Oj.load makes for that
+ * mode are set when the parser is created.
+ *
+ * - *options* [_Hash_|_Oj::Options_] load options (same as default_options)
+ */
+static VALUE
+parser_new(int argc, VALUE *argv, VALUE self) {
+    Parser		p = ALLOC(struct _Parser);
+    volatile VALUE	obj;
+
+    memset(p, 0, sizeof(struct _Parser));
+    p->opts = Qnil;
+    obj = Data_Wrap_Struct(oj_parser_class, parser_mark, parser_free, p);
+    // The stack and caches live as long as this object and are marked by it
+    // so the Data objects that would mark them for a single parse are
+    // cleared.
+    DATA_PTR(oj_stack_init(&p->pi.stack)) = 0;
+    buf_init(&p->esc);
+    p->pi.esc_buf = &p->esc;
+    p->pi.options = oj_default_options;
+    p->pi.handler = Qnil;
+    p->pi.err_class = Qnil;
+    p->pi.proc = Qundef;
+    if (1 <= argc && Qnil != *argv) {
+	if (T_HASH == rb_type(*argv)) {
+	    // Parsed once into an Oj::Options so the options can be applied
+	    // again after the mode adjustments below.
+	    p->opts = rb_funcall(oj_options_class, oj_new_id, 1, *argv);
+	} else if (oj_is_options(*argv)) {
+	    p->opts = *argv;
+	} else {
+	    rb_raise(rb_eTypeError, "Oj::Parser options must be a Hash or an Oj::Options.");
+	}
+	oj_parse_options(p->opts, &p->pi.options);
+    }
+    switch (p->pi.options.mode) {
+    case StrictMode:
+    case NullMode:
+	oj_set_strict_callbacks(&p->pi);
+	p->yield_ok = true;
+	break;
+    case CompatMode:
+    case RailsMode:
+	p->pi.options.allow_nan = Yes;
+	p->pi.options.nilnil = Yes;
+	p->pi.options.empty_string = No;
+	oj_set_compat_callbacks(&p->pi);
+	break;
+    case CustomMode:
+	p->pi.options.allow_nan = Yes;
+	p->pi.options.nilnil = Yes;
+	oj_set_custom_callbacks(&p->pi);
+	break;
+    case WabMode:
+	oj_set_wab_callbacks(&p->pi);
+	p->yield_ok = true;
+	break;
+    case ObjectMode:
+    default:
+	oj_set_object_callbacks(&p->pi);
+	p->yield_ok = true;
+	break;
+    }
+    if (Qnil != p->opts) {
+	// Options that were given take precedence over the mode adjustments.
+	oj_parse_options(p->opts, &p->pi.options);
+    }
+    if (Yes == p->pi.options.cache_keys) {
+	DATA_PTR(oj_str_cache_init(&p->pi.key_cache, Yes == p->pi.options.sym_key, STR_CACHE_KEY_MAX, &oj_key_cache_stats)) = 0;
+    }
+    if (0 < p->pi.options.cache_str) {
+	DATA_PTR(oj_str_cache_init(&p->pi.str_cache, false, STR_CACHE_STR_MAX, &oj_str_cache_stats)) = 0;
+    }
+    return obj;
+}
+
+/* Document-method: parse
+ * call-seq: parse(json) { |obj| }
+ *
+ * Parses a JSON document String the same way Oj.load() does with the
+ * options the parser was created with. In the modes that allow it a block
+ * is yielded each document when the String holds more than one.
+ *
+ * - *json* [_String_] JSON document
+ *
+ * Returns [_Object_|_Hash_|_Array_|_String_|_Fixnum_|_Float_|_Boolean_|_nil_]
+ */
+static VALUE
+parser_parse(VALUE self, VALUE json) {
+    Parser		p = (Parser)DATA_PTR(self);
+    ParseInfo		pi = &p->pi;
+    volatile VALUE	input = json;
+    volatile VALUE	result;
+    int			line = 0;
+
+    if (p->busy) {
+	rb_raise(rb_eRuntimeError, "Oj::Parser is already parsing.");
+    }
+    if (Qnil == input) {
+	if (Yes == pi->options.nilnil) {
+	    return Qnil;
+	}
+	rb_raise(rb_eTypeError, "Nil is not a valid JSON source.");
+    }
+    Check_Type(input, T_STRING);
+    if (CompatMode == pi->options.mode && No == pi->options.nilnil && 0 == RSTRING_LEN(input)) {
+	rb_raise(oj_json_parser_error_class, "An empty string is not a valid JSON string.");
+    }
+    oj_pi_set_input_str(pi, &input);
+    pi->proc = (p->yield_ok && rb_block_given_p()) ? Qnil : Qundef;
+    pi->err_class = Qnil;
+    if (Yes == pi->options.circular) {
+	pi->circ_array = oj_circ_array_new();
+    } else {
+	pi->circ_array = 0;
+    }
+    if (SCAN_MIN_LEN <= pi->end - pi->json) {
+	oj_scan_index_build(&pi->scan, pi->json, pi->end - pi->json);
+    }
+    if (No == pi->options.allow_gc) {
+	rb_gc_disable();
+    }
+    stack_reset(&pi->stack);
+    p->busy = true;
+    rb_protect(protect_parse, (VALUE)pi, &line);
+    p->busy = false;
+    oj_pi_check_done(pi);
+    result = stack_head_val(&pi->stack);
+    // Nothing from this parse is kept alive by the stack.
+    stack_reset(&pi->stack);
+    if (No == pi->options.allow_gc) {
+	rb_gc_enable();
+    }
+    oj_scan_index_cleanup(&pi->scan);
+    if (0 != pi->circ_array) {
+	oj_circ_array_free(pi->circ_array);
+	pi->circ_array = 0;
+    }
+    if (PARSER_ESC_KEEP < p->esc.end - p->esc.head) {
+	buf_cleanup(&p->esc);
+	buf_init(&p->esc);
+    }
+    RB_GC_GUARD(input);
+    if (0 != line) {
+	rb_jump_tag(line);
+    }
+    return oj_pi_result(pi, result);
+}
+
+void
+oj_parser_init() {
+    oj_parser_class = rb_define_class_under(Oj, "Parser", rb_cObject);
+    rb_undef_alloc_func(oj_parser_class);
+    rb_define_singleton_method(oj_parser_class, "new", parser_new, -1);
+    rb_define_method(oj_parser_class, "parse", parser_parse, 1);
+}
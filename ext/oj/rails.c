@@ -6,6 +6,7 @@
 #include "rails.h"
 #include "encode.h"
 #include "code.h"
+#include "dbl.h"
 #include "encode.h"
 
 #define OJ_INFINITY (1.0/0.0)
@@ -131,6 +132,7 @@ dump_obj_attrs(VALUE obj, int depth, Out out, bool as_ok) {
 	out->cur--; // backup to overwrite last comma
     }
     out->depth = depth;
+    assure_size(out, depth * out->indent + 2);
     fill_indent(out, depth);
     *out->cur++ = '}';
     *out->cur = '\0';
@@ -165,7 +167,7 @@ dump_struct(VALUE obj, int depth, Out out, bool as_ok) {
     for (i = 0; i < cnt; i++) {
 	name = rb_id2name(SYM2ID(rb_ary_entry(ma, i)));
 	len = (int)strlen(name);
-	assure_size(out, size + sep_len + 6);
+	assure_size(out, size + sep_len + len + 6);
 	if (0 < i) {
 	    *out->cur++ = ',';
 	}
@@ -190,6 +192,7 @@ dump_struct(VALUE obj, int depth, Out out, bool as_ok) {
 #endif
 	dump_rails_val(v, d3, out, true);
     }
+    assure_size(out, depth * out->indent + 2);
     fill_indent(out, depth);
     *out->cur++ = '}';
     *out->cur = '\0';
@@ -664,6 +667,8 @@ encode(VALUE obj, ROptTable ropts, Options opts, int argc, VALUE *argv) {
     out.buf = buf;
     out.end = buf + sizeof(buf) - 10;
     out.allocated = false;
+    out.str = Qnil;
+    out.flush = NULL;
     out.omit_nil = copts.dump_opts.omit_nil;
     out.caller = 0;
     out.cur = out.buf;
@@ -675,7 +680,7 @@ encode(VALUE obj, ROptTable ropts, Options opts, int argc, VALUE *argv) {
     out.argv = argv;
     out.ropts = ropts;
     if (Yes == copts.circular) {
-	oj_cache8_new(&out.circ_cache);
+	out.circ_map = oj_circ_map_new();
     }
     //dump_rails_val(*argv, 0, &out, true);
     rb_protect(protect_dump, (VALUE)&oo, &line);
@@ -700,7 +705,7 @@ encode(VALUE obj, ROptTable ropts, Options opts, int argc, VALUE *argv) {
 	rstr = oj_encode(rstr);
     }
     if (Yes == copts.circular) {
-	oj_cache8_delete(out.circ_cache);
+	oj_circ_map_free(out.circ_map);
     }
     if (out.allocated) {
 	xfree(out.buf);
@@ -723,7 +728,7 @@ encoder_encode(VALUE self, VALUE obj) {
     Encoder	e = (Encoder)DATA_PTR(self);
 
     if (Qnil != e->arg) {
-	VALUE	argv[1] = { e->arg };
+	VALUE	argv[1] = { oj_options_hash(e->arg) };
 	
 	return encode(obj, &e->ropts, &e->opts, 1, argv);
     }
@@ -974,10 +979,8 @@ dump_float(VALUE obj, int depth, Out out, bool as_ok) {
 	} else if (oj_rails_float_opt) {
 	    cnt = oj_dump_float_printf(buf, sizeof(buf), obj, d, "%0.16g");
 	} else {
-	    volatile VALUE	rstr = rb_funcall(obj, oj_to_s_id, 0);
-
-	    strcpy(buf, rb_string_value_ptr((VALUE*)&rstr));
-	    cnt = (int)RSTRING_LEN(rstr);
+	    cnt = oj_dbl_to_s(d, buf);
+	    buf[cnt] = '\0';
 	}
     }
     assure_size(out, cnt);
@@ -1076,11 +1079,7 @@ hash_cb(VALUE key, VALUE value, Out out) {
 	size = depth * out->indent + 1;
 	assure_size(out, size);
 	fill_indent(out, depth);
-	if (rtype == T_STRING) {
-	    oj_dump_str(key, 0, out, false);
-	} else {
-	    oj_dump_sym(key, 0, out, false);
-	}
+	oj_dump_key(key, out);
 	*out->cur++ = ':';
     } else {
 	size = depth * out->opts->dump_opts.indent_size + out->opts->dump_opts.hash_size + 1;
@@ -1096,11 +1095,7 @@ hash_cb(VALUE key, VALUE value, Out out) {
 		out->cur += out->opts->dump_opts.indent_size;
 	    }
 	}
-	if (rtype == T_STRING) {
-	    oj_dump_str(key, 0, out, false);
-	} else {
-	    oj_dump_sym(key, 0, out, false);
-	}
+	oj_dump_key(key, out);
 	size = out->opts->dump_opts.before_size + out->opts->dump_opts.after_size + 2;
 	assure_size(out, size);
 	if (0 < out->opts->dump_opts.before_size) {
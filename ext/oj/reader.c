@@ -6,12 +6,14 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <stdio.h>
+#include <string.h>
 #include <strings.h>
 #include <sys/types.h>
 #if NEEDS_UIO
 #include <sys/uio.h>	
 #endif
 #include <unistd.h>
+#include <fcntl.h>
 #include <time.h>
 
 #include "ruby.h"
@@ -20,14 +22,28 @@
 
 #define BUF_PAD	4
 
+// The first read asks for READ_INIT bytes. Each read that fills the request
+// doubles it up to READ_MAX so a fast source is read in a few large blocks
+// while a slow socket does not force large allocations.
+#define READ_INIT	0x00004000
+#define READ_MAX	0x00100000
+
 static VALUE		rescue_cb(VALUE rdr, VALUE err);
 static VALUE		io_cb(VALUE rdr);
 static VALUE		partial_io_cb(VALUE rdr);
 static int		read_from_io(Reader reader);
 static int		read_from_fd(Reader reader);
 static int		read_from_io_partial(Reader reader);
+static void		make_room(Reader reader);
 //static int		read_from_str(Reader reader);
 
+static void
+advise_sequential(int fd) {
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+}
+
 void
 oj_reader_init(Reader reader, VALUE io, int fd, bool to_s) {
     VALUE	io_class = rb_obj_class(io);
@@ -45,10 +61,12 @@ oj_reader_init(Reader reader, VALUE io, int fd, bool to_s) {
     reader->line = 1;
     reader->col = 0;
     reader->free_head = 0;
+    reader->read_size = READ_INIT;
 
     if (0 != fd) {
 	reader->read_func = read_from_fd;
 	reader->fd = fd;
+	advise_sequential(fd);
     } else if (rb_cString == io_class) {
 	reader->read_func = 0;
 	reader->in_str = StringValuePtr(io);
@@ -70,6 +88,7 @@ oj_reader_init(Reader reader, VALUE io, int fd, bool to_s) {
 	       0 == FIX2INT(rb_funcall(io, oj_pos_id, 0))) {
 	reader->read_func = read_from_fd;
 	reader->fd = FIX2INT(rb_funcall(io, oj_fileno_id, 0));
+	advise_sequential(reader->fd);
     } else if (rb_respond_to(io, oj_readpartial_id)) {
 	reader->read_func = read_from_io_partial;
 	reader->io = io;
@@ -89,56 +108,68 @@ oj_reader_init(Reader reader, VALUE io, int fd, bool to_s) {
     }
 }
 
+// Makes room for at least read_size more bytes. Everything before the
+// protected start, or before the current position if nothing is protected,
+// can be dropped. A short remainder is moved to the front of the buffer but a
+// long one is copied into a larger buffer instead so the same bytes are not
+// moved over and over while a long string or number is being read.
+static void
+make_room(Reader reader) {
+    char	*keep = (0 == reader->pro) ? reader->tail : reader->pro;
+    size_t	size = reader->end - reader->head;
+    size_t	used;
+
+    if (reader->head < keep) {
+	keep--; // leave one character so we can backup one
+    }
+    used = reader->read_end - keep;
+    if (reader->head != reader->base && reader->head < keep && used <= size / 4 && used + reader->read_size <= size) {
+	memmove(reader->head, keep, used);
+    } else {
+	char	*old = reader->head;
+	size_t	new_size = size * 2;
+
+	if (new_size < used + reader->read_size) {
+	    new_size = used + reader->read_size;
+	}
+	if (new_size < READ_INIT * 4) {
+	    new_size = READ_INIT * 4;
+	}
+	reader->head = ALLOC_N(char, new_size + BUF_PAD);
+	memcpy(reader->head, keep, used);
+	reader->end = reader->head + new_size;
+	if (reader->free_head) {
+	    xfree(old);
+	}
+	reader->free_head = 1;
+    }
+    reader->tail = reader->head + (reader->tail - keep);
+    reader->read_end = reader->head + used;
+    if (0 != reader->pro) {
+	reader->pro = reader->head + (reader->pro - keep);
+    }
+    if (0 != reader->str) {
+	reader->str = reader->head + (reader->str - keep);
+    }
+}
+
 int
 oj_reader_read(Reader reader) {
     int		err;
-    size_t	shift = 0;
+    char	*start;
 
     if (0 == reader->read_func) {
 	return -1;
     }
-    // if there is not much room to read into, shift or realloc a larger buffer.
-    if (reader->head < reader->tail && 4096 > reader->end - reader->tail) {
-	if (0 == reader->pro) {
-	    shift = reader->tail - reader->head;
-	} else {
-	    shift = reader->pro - reader->head - 1; // leave one character so we can backup one
-	}
-	if (0 >= shift) { /* no space left so allocate more */
-	    const char	*old = reader->head;
-	    size_t	size = reader->end - reader->head + BUF_PAD;
-	
-	    if (reader->head == reader->base) {
-		reader->head = ALLOC_N(char, size * 2);
-		memcpy((char*)reader->head, old, size);
-	    } else {
-		REALLOC_N(reader->head, char, size * 2);
-	    }
-	    reader->free_head = 1;
-	    reader->end = reader->head + size * 2 - BUF_PAD;
-	    reader->tail = reader->head + (reader->tail - old);
-	    reader->read_end = reader->head + (reader->read_end - old);
-	    if (0 != reader->pro) {
-		reader->pro = reader->head + (reader->pro - old);
-	    }
-	    if (0 != reader->str) {
-		reader->str = reader->head + (reader->str - old);
-	    }
-	} else {
-	    memmove((char*)reader->head, reader->head + shift, reader->read_end - (reader->head + shift));
-	    reader->tail -= shift;
-	    reader->read_end -= shift;
-	    if (0 != reader->pro) {
-		reader->pro -= shift;
-	    }
-	    if (0 != reader->str) {
-		reader->str -= shift;
-	    }
-	}
+    if ((size_t)(reader->end - reader->tail) < reader->read_size) {
+	make_room(reader);
     }
+    start = reader->tail;
     err = reader->read_func(reader);
     *(char*)reader->read_end = '\0';
-
+    if (0 == err && reader->read_size < READ_MAX && reader->read_size <= (size_t)(reader->read_end - start)) {
+	reader->read_size *= 2;
+    }
     return err;
 }
 
@@ -156,21 +187,30 @@ rescue_cb(VALUE rbuf, VALUE err) {
 
 static VALUE
 partial_io_cb(VALUE rbuf) {
-    Reader	reader = (Reader)rbuf;
-    VALUE	args[1];
-    VALUE	rstr;
-    char	*str;
-    size_t	cnt;
+    Reader		reader = (Reader)rbuf;
+    VALUE		args[1];
+    volatile VALUE	rstr;
+    char		*str;
+    size_t		cnt;
 
-    args[0] = ULONG2NUM(reader->end - reader->tail);
+    args[0] = ULONG2NUM(reader->read_size);
     rstr = rb_funcall2(reader->io, oj_readpartial_id, 1, args);
     if (Qnil == rstr) {
 	return Qfalse;
     }
     str = StringValuePtr(rstr);
     cnt = RSTRING_LEN(rstr);
+    if ((size_t)(reader->end - reader->tail) < cnt) {
+	// the IO returned more than was asked for
+	size_t	rs = reader->read_size;
+
+	reader->read_size = cnt;
+	make_room(reader);
+	reader->read_size = rs;
+	str = StringValuePtr(rstr);
+    }
     //printf("*** partial read %lu bytes, str: '%s'\n", cnt, str);
-    strcpy(reader->tail, str);
+    memcpy(reader->tail, str, cnt);
     reader->read_end = reader->tail + cnt;
 
     return Qtrue;
@@ -178,21 +218,30 @@ partial_io_cb(VALUE rbuf) {
 
 static VALUE
 io_cb(VALUE rbuf) {
-    Reader	reader = (Reader)rbuf;
-    VALUE	args[1];
-    VALUE	rstr;
-    char	*str;
-    size_t	cnt;
+    Reader		reader = (Reader)rbuf;
+    VALUE		args[1];
+    volatile VALUE	rstr;
+    char		*str;
+    size_t		cnt;
 
-    args[0] = ULONG2NUM(reader->end - reader->tail);
+    args[0] = ULONG2NUM(reader->read_size);
     rstr = rb_funcall2(reader->io, oj_read_id, 1, args);
     if (Qnil == rstr) {
 	return Qfalse;
     }
     str = StringValuePtr(rstr);
     cnt = RSTRING_LEN(rstr);
+    if ((size_t)(reader->end - reader->tail) < cnt) {
+	// the IO returned more than was asked for
+	size_t	rs = reader->read_size;
+
+	reader->read_size = cnt;
+	make_room(reader);
+	reader->read_size = rs;
+	str = StringValuePtr(rstr);
+    }
     //printf("*** read %lu bytes, str: '%s'\n", cnt, str);
-    strcpy(reader->tail, str);
+    memcpy(reader->tail, str, cnt);
     reader->read_end = reader->tail + cnt;
 
     return Qtrue;
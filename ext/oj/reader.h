@@ -18,6 +18,7 @@ typedef struct _Reader {
     int		line;
     int		col;
     int		free_head;
+    size_t	read_size;	/* bytes to ask for, grows when reads come back full */
     int		(*read_func)(struct _Reader *reader);
     union {
 	int		fd;
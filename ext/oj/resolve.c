@@ -75,6 +75,10 @@ oj_name2class(ParseInfo pi, const char *name, size_t len, int auto_define, VALUE
     if (No == pi->options.class_cache) {
 	return resolve_classpath(pi, name, len, auto_define, error_class);
     }
+    // Hits do not need the lock.
+    if (Qnil != (clas = oj_class_hash_find(name, len))) {
+	return clas;
+    }
 #if USE_PTHREAD_MUTEX
     pthread_mutex_lock(&oj_cache_mutex);
 #elif USE_RB_MUTEX
@@ -0,0 +1,513 @@
+/* scan.c
+ * Copyright (c) 2017, Peter Ohler
+ * All rights reserved.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ruby.h"
+#include "scan.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define SCAN_X86	1
+#include <immintrin.h>
+#else
+#define SCAN_X86	0
+#endif
+
+typedef void	(*ScanFunc)(const uint8_t *s, size_t bcnt, uint64_t *tokens, uint64_t *stops);
+typedef void	(*CloseFunc)(const uint8_t *s, uint64_t *masks);
+
+// Masks filled in for each 64 byte block by a CloseFunc. Open and close
+// include both kinds of bracket.
+enum {
+    CLOSE_QUOTE = 0,
+    CLOSE_BS,
+    CLOSE_OPEN,
+    CLOSE_CLOSE,
+    CLOSE_SLASH,
+    CLOSE_NUL,
+    CLOSE_MASK_CNT
+};
+
+static void
+scan_scalar(const uint8_t *s, size_t bcnt, uint64_t *tokens, uint64_t *stops) {
+    uint64_t	t;
+    uint64_t	st;
+    int		i;
+
+    for (; 0 < bcnt; bcnt--, tokens++, stops++) {
+	t = 0;
+	st = 0;
+	for (i = 0; i < 64; i++, s++) {
+	    switch (*s) {
+	    case ' ':
+	    case '\t':
+	    case '\f':
+	    case '\n':
+	    case '\r':
+		break;
+	    case '"':
+	    case '\\':
+	    case '\0':
+		st |= (uint64_t)1 << i;
+		t |= (uint64_t)1 << i;
+		break;
+	    default:
+		t |= (uint64_t)1 << i;
+		break;
+	    }
+	}
+	*tokens = t;
+	*stops = st;
+    }
+}
+
+// Returns the first '"', '\\', or '\0' in a string body or end if there
+// is none before end.
+static const char*
+scan_str_scalar(const char *s, const char *end) {
+    for (; s < end; s++) {
+	switch (*s) {
+	case '"':
+	case '\\':
+	case '\0':
+	    return s;
+	default:
+	    break;
+	}
+    }
+    return end;
+}
+
+static void
+close_scalar(const uint8_t *s, uint64_t *masks) {
+    uint64_t	bit = 1;
+    int		i;
+
+    memset(masks, 0, sizeof(uint64_t) * CLOSE_MASK_CNT);
+    for (i = 0; i < 64; i++, s++, bit <<= 1) {
+	switch (*s) {
+	case '"':	masks[CLOSE_QUOTE] |= bit;	break;
+	case '\\':	masks[CLOSE_BS] |= bit;		break;
+	case '[':
+	case '{':	masks[CLOSE_OPEN] |= bit;	break;
+	case ']':
+	case '}':	masks[CLOSE_CLOSE] |= bit;	break;
+	case '/':	masks[CLOSE_SLASH] |= bit;	break;
+	case '\0':	masks[CLOSE_NUL] |= bit;	break;
+	default:					break;
+	}
+    }
+}
+
+static const char*
+scan_esc_scalar(const char *s, const char *end, int flags) {
+    uint8_t	c;
+
+    for (; s < end; s++) {
+	c = (uint8_t)*s;
+	if (c < 0x20 || '"' == c || '\\' == c) {
+	    return s;
+	}
+	if (0 != (SCAN_ESC_HIBIT & flags) && 0x7F <= c) {
+	    return s;
+	}
+	if (0 != (SCAN_ESC_HTML & flags) && ('&' == c || '/' == c || '<' == c || '>' == c)) {
+	    return s;
+	}
+	if (0 != (SCAN_ESC_E2 & flags) && 0xE2 == c) {
+	    return s;
+	}
+    }
+    return end;
+}
+
+#if SCAN_X86
+
+// SSE2 is part of the x86_64 baseline so no dispatch is needed for it.
+static void
+scan_sse2(const uint8_t *s, size_t bcnt, uint64_t *tokens, uint64_t *stops) {
+    const __m128i	sp = _mm_set1_epi8(' ');
+    const __m128i	tab = _mm_set1_epi8('\t');
+    const __m128i	ff = _mm_set1_epi8('\f');
+    const __m128i	nl = _mm_set1_epi8('\n');
+    const __m128i	cr = _mm_set1_epi8('\r');
+    const __m128i	quote = _mm_set1_epi8('"');
+    const __m128i	bs = _mm_set1_epi8('\\');
+    const __m128i	zero = _mm_setzero_si128();
+    __m128i		v;
+    __m128i		w;
+    __m128i		st;
+    uint64_t		wm;
+    uint64_t		sm;
+    int			i;
+
+    for (; 0 < bcnt; bcnt--, tokens++, stops++) {
+	wm = 0;
+	sm = 0;
+	for (i = 0; i < 64; i += 16, s += 16) {
+	    v = _mm_loadu_si128((const __m128i*)s);
+	    w = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, tab)),
+			     _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, ff), _mm_cmpeq_epi8(v, nl)), _mm_cmpeq_epi8(v, cr)));
+	    st = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bs)), _mm_cmpeq_epi8(v, zero));
+	    wm |= (uint64_t)(uint16_t)_mm_movemask_epi8(w) << i;
+	    sm |= (uint64_t)(uint16_t)_mm_movemask_epi8(st) << i;
+	}
+	*tokens = ~wm;
+	*stops = sm;
+    }
+}
+
+static const char*
+scan_str_sse2(const char *s, const char *end) {
+    const __m128i	quote = _mm_set1_epi8('"');
+    const __m128i	bs = _mm_set1_epi8('\\');
+    const __m128i	zero = _mm_setzero_si128();
+    __m128i		v;
+    int			m;
+
+    for (; s + 16 <= end; s += 16) {
+	v = _mm_loadu_si128((const __m128i*)s);
+	m = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bs)), _mm_cmpeq_epi8(v, zero)));
+	if (0 != m) {
+	    return s + __builtin_ctz(m);
+	}
+    }
+    return scan_str_scalar(s, end);
+}
+
+// '[' and ']' differ from '{' and '}' only in the 0x20 bit so setting that
+// bit matches both kinds of bracket with one compare.
+static void
+close_sse2(const uint8_t *s, uint64_t *masks) {
+    const __m128i	quote = _mm_set1_epi8('"');
+    const __m128i	bs = _mm_set1_epi8('\\');
+    const __m128i	open = _mm_set1_epi8('{');
+    const __m128i	close = _mm_set1_epi8('}');
+    const __m128i	slash = _mm_set1_epi8('/');
+    const __m128i	bit = _mm_set1_epi8(0x20);
+    const __m128i	zero = _mm_setzero_si128();
+    __m128i		v;
+    __m128i		b;
+    int			i;
+
+    memset(masks, 0, sizeof(uint64_t) * CLOSE_MASK_CNT);
+    for (i = 0; i < 64; i += 16, s += 16) {
+	v = _mm_loadu_si128((const __m128i*)s);
+	b = _mm_or_si128(v, bit);
+	masks[CLOSE_QUOTE] |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)) << i;
+	masks[CLOSE_BS] |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, bs)) << i;
+	masks[CLOSE_OPEN] |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(b, open)) << i;
+	masks[CLOSE_CLOSE] |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(b, close)) << i;
+	masks[CLOSE_SLASH] |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, slash)) << i;
+	masks[CLOSE_NUL] |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) << i;
+    }
+}
+
+// Flags that are off compare against '"' which is already a stop. With
+// SCAN_ESC_HIBIT off only 0xFF, which is never valid UTF-8, is a stop.
+static const char*
+scan_esc_sse2(const char *s, const char *end, int flags) {
+    const __m128i	quote = _mm_set1_epi8('"');
+    const __m128i	bs = _mm_set1_epi8('\\');
+    const __m128i	ctrl = _mm_set1_epi8(0x1F);
+    const __m128i	hi = _mm_set1_epi8((char)((SCAN_ESC_HIBIT & flags) ? 0x7F : 0xFF));
+    const __m128i	amp = _mm_set1_epi8((SCAN_ESC_HTML & flags) ? '&' : '"');
+    const __m128i	slash = _mm_set1_epi8((SCAN_ESC_HTML & flags) ? '/' : '"');
+    const __m128i	lt = _mm_set1_epi8((SCAN_ESC_HTML & flags) ? '<' : '"');
+    const __m128i	gt = _mm_set1_epi8((SCAN_ESC_HTML & flags) ? '>' : '"');
+    const __m128i	e2 = _mm_set1_epi8((char)((SCAN_ESC_E2 & flags) ? 0xE2 : '"'));
+    __m128i		v;
+    __m128i		m;
+    int			bits;
+
+    for (; s + 16 <= end; s += 16) {
+	v = _mm_loadu_si128((const __m128i*)s);
+	m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bs)),
+			 _mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(v, ctrl), ctrl), _mm_cmpeq_epi8(_mm_max_epu8(v, hi), v)));
+	m = _mm_or_si128(m, _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, amp), _mm_cmpeq_epi8(v, slash)),
+					 _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, lt), _mm_cmpeq_epi8(v, gt)), _mm_cmpeq_epi8(v, e2))));
+	if (0 != (bits = _mm_movemask_epi8(m))) {
+	    return s + __builtin_ctz(bits);
+	}
+    }
+    return scan_esc_scalar(s, end, flags);
+}
+
+__attribute__((target("avx2")))
+static void
+scan_avx2(const uint8_t *s, size_t bcnt, uint64_t *tokens, uint64_t *stops) {
+    const __m256i	sp = _mm256_set1_epi8(' ');
+    const __m256i	tab = _mm256_set1_epi8('\t');
+    const __m256i	ff = _mm256_set1_epi8('\f');
+    const __m256i	nl = _mm256_set1_epi8('\n');
+    const __m256i	cr = _mm256_set1_epi8('\r');
+    const __m256i	quote = _mm256_set1_epi8('"');
+    const __m256i	bs = _mm256_set1_epi8('\\');
+    const __m256i	zero = _mm256_setzero_si256();
+    __m256i		v;
+    __m256i		w;
+    __m256i		st;
+    uint64_t		wm;
+    uint64_t		sm;
+    int			i;
+
+    for (; 0 < bcnt; bcnt--, tokens++, stops++) {
+	wm = 0;
+	sm = 0;
+	for (i = 0; i < 64; i += 32, s += 32) {
+	    v = _mm256_loadu_si256((const __m256i*)s);
+	    w = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, sp), _mm256_cmpeq_epi8(v, tab)),
+				_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, ff), _mm256_cmpeq_epi8(v, nl)), _mm256_cmpeq_epi8(v, cr)));
+	    st = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, bs)), _mm256_cmpeq_epi8(v, zero));
+	    wm |= (uint64_t)(uint32_t)_mm256_movemask_epi8(w) << i;
+	    sm |= (uint64_t)(uint32_t)_mm256_movemask_epi8(st) << i;
+	}
+	*tokens = ~wm;
+	*stops = sm;
+    }
+}
+
+// The AVX2 loops only run over whole 32 byte blocks and return to a plain
+// function that finishes with SSE2. Keeping them out of line lets the
+// compiler clear the upper ymm state on return so the SSE2 code does not pay
+// the AVX to SSE transition penalty, and short strings never touch ymm
+// registers at all.
+__attribute__((target("avx2"), noinline))
+static const char*
+str_blocks_avx2(const char *s, const char *end) {
+    const __m256i	quote = _mm256_set1_epi8('"');
+    const __m256i	bs = _mm256_set1_epi8('\\');
+    const __m256i	zero = _mm256_setzero_si256();
+    __m256i		v;
+    uint32_t		m;
+
+    for (; s + 32 <= end; s += 32) {
+	v = _mm256_loadu_si256((const __m256i*)s);
+	m = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, bs)), _mm256_cmpeq_epi8(v, zero)));
+	if (0 != m) {
+	    return s + __builtin_ctz(m);
+	}
+    }
+    return s;
+}
+
+static const char*
+scan_str_avx2(const char *s, const char *end) {
+    if (32 <= end - s) {
+	s = str_blocks_avx2(s, end);
+    }
+    return scan_str_sse2(s, end);
+}
+
+__attribute__((target("avx2")))
+static void
+close_avx2(const uint8_t *s, uint64_t *masks) {
+    const __m256i	quote = _mm256_set1_epi8('"');
+    const __m256i	bs = _mm256_set1_epi8('\\');
+    const __m256i	open = _mm256_set1_epi8('{');
+    const __m256i	close = _mm256_set1_epi8('}');
+    const __m256i	slash = _mm256_set1_epi8('/');
+    const __m256i	bit = _mm256_set1_epi8(0x20);
+    const __m256i	zero = _mm256_setzero_si256();
+    __m256i		v;
+    __m256i		b;
+    int			i;
+
+    memset(masks, 0, sizeof(uint64_t) * CLOSE_MASK_CNT);
+    for (i = 0; i < 64; i += 32, s += 32) {
+	v = _mm256_loadu_si256((const __m256i*)s);
+	b = _mm256_or_si256(v, bit);
+	masks[CLOSE_QUOTE] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, quote)) << i;
+	masks[CLOSE_BS] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, bs)) << i;
+	masks[CLOSE_OPEN] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b, open)) << i;
+	masks[CLOSE_CLOSE] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b, close)) << i;
+	masks[CLOSE_SLASH] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, slash)) << i;
+	masks[CLOSE_NUL] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero)) << i;
+    }
+}
+
+__attribute__((target("avx2"), noinline))
+static const char*
+esc_blocks_avx2(const char *s, const char *end, int flags) {
+    const __m256i	quote = _mm256_set1_epi8('"');
+    const __m256i	bs = _mm256_set1_epi8('\\');
+    const __m256i	ctrl = _mm256_set1_epi8(0x1F);
+    const __m256i	hi = _mm256_set1_epi8((char)((SCAN_ESC_HIBIT & flags) ? 0x7F : 0xFF));
+    const __m256i	amp = _mm256_set1_epi8((SCAN_ESC_HTML & flags) ? '&' : '"');
+    const __m256i	slash = _mm256_set1_epi8((SCAN_ESC_HTML & flags) ? '/' : '"');
+    const __m256i	lt = _mm256_set1_epi8((SCAN_ESC_HTML & flags) ? '<' : '"');
+    const __m256i	gt = _mm256_set1_epi8((SCAN_ESC_HTML & flags) ? '>' : '"');
+    const __m256i	e2 = _mm256_set1_epi8((char)((SCAN_ESC_E2 & flags) ? 0xE2 : '"'));
+    __m256i		v;
+    __m256i		m;
+    uint32_t		bits;
+
+    for (; s + 32 <= end; s += 32) {
+	v = _mm256_loadu_si256((const __m256i*)s);
+	m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, bs)),
+			    _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(v, ctrl), ctrl), _mm256_cmpeq_epi8(_mm256_max_epu8(v, hi), v)));
+	m = _mm256_or_si256(m, _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, amp), _mm256_cmpeq_epi8(v, slash)),
+					       _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, lt), _mm256_cmpeq_epi8(v, gt)), _mm256_cmpeq_epi8(v, e2))));
+	if (0 != (bits = (uint32_t)_mm256_movemask_epi8(m))) {
+	    return s + __builtin_ctz(bits);
+	}
+    }
+    return s;
+}
+
+static const char*
+scan_esc_avx2(const char *s, const char *end, int flags) {
+    if (32 <= end - s) {
+	s = esc_blocks_avx2(s, end, flags);
+    }
+    return scan_esc_sse2(s, end, flags);
+}
+
+#endif
+
+static ScanFunc	scan_blocks = scan_scalar;
+static CloseFunc	close_masks = close_scalar;
+
+ScanStrFunc	oj_scan_str = scan_str_scalar;
+ScanEscFunc	oj_scan_esc = scan_esc_scalar;
+
+void
+oj_scan_init() {
+#if SCAN_X86
+    scan_blocks = scan_sse2;
+    close_masks = close_sse2;
+    oj_scan_str = scan_str_sse2;
+    oj_scan_esc = scan_esc_sse2;
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+	scan_blocks = scan_avx2;
+	close_masks = close_avx2;
+	oj_scan_str = scan_str_avx2;
+	oj_scan_esc = scan_esc_avx2;
+    }
+#endif
+}
+
+void
+oj_scan_index_build(ScanIndex si, const char *json, size_t len) {
+    size_t	full = len >> 6;
+    size_t	rem = len & 0x3F;
+    uint8_t	pad[64];
+
+    si->head = json;
+    si->end = json + len;
+    si->bcnt = full + 1;
+    si->tokens = ALLOC_N(uint64_t, si->bcnt * 2);
+    si->stops = si->tokens + si->bcnt;
+    scan_blocks((const uint8_t*)json, full, si->tokens, si->stops);
+    // The last block is padded with '\0' which is both a token and a stop
+    // so a search never runs past the end.
+    memset(pad, 0, sizeof(pad));
+    memcpy(pad, json + (full << 6), rem);
+    scan_blocks(pad, 1, si->tokens + full, si->stops + full);
+}
+
+void
+oj_scan_index_cleanup(ScanIndex si) {
+    if (0 != si->tokens) {
+	xfree(si->tokens);
+	si->tokens = 0;
+	si->stops = 0;
+    }
+}
+
+inline static int
+scan_popcount(uint64_t m) {
+#if defined(__GNUC__)
+    return __builtin_popcountll(m);
+#else
+    int	cnt = 0;
+
+    for (; 0 != m; m &= m - 1) {
+	cnt++;
+    }
+    return cnt;
+#endif
+}
+
+// Bit i of the result is the xor of bits 0 through i so every byte from an
+// opening quote up to but not including the closing quote is set.
+inline static uint64_t
+prefix_xor(uint64_t m) {
+    m ^= m << 1;
+    m ^= m << 2;
+    m ^= m << 4;
+    m ^= m << 8;
+    m ^= m << 16;
+    m ^= m << 32;
+
+    return m;
+}
+
+const char*
+oj_scan_close(const char *s, const char *end) {
+    uint64_t	masks[CLOSE_MASK_CNT];
+    uint8_t	pad[64];
+    const uint8_t	*b;
+    uint64_t	in_str = 0;	// all ones when a block starts in a string
+    uint64_t	carry = 0;	// 1 when the first byte of a block is escaped
+    uint64_t	escaped;
+    uint64_t	bs;
+    uint64_t	bit;
+    uint64_t	str;
+    uint64_t	open;
+    uint64_t	close;
+    uint64_t	m;
+    long	depth = 1;
+    size_t	len;
+
+    for (; s < end; s += 64) {
+	len = end - s;
+	if (64 <= len) {
+	    b = (const uint8_t*)s;
+	} else {
+	    memset(pad, ' ', sizeof(pad));
+	    memcpy(pad, s, len);
+	    b = pad;
+	}
+	close_masks(b, masks);
+	// Backslashes are rare enough that walking them one at a time is
+	// cheaper than the branch free way of finding escaped bytes.
+	escaped = carry;
+	carry = 0;
+	for (bs = masks[CLOSE_BS]; 0 != bs; bs &= bs - 1) {
+	    bit = bs & (~bs + 1);
+	    if (0 != (bit & escaped)) {
+		continue;
+	    }
+	    if (0x8000000000000000ULL == bit) {
+		carry = 1;
+	    } else {
+		escaped |= bit << 1;
+	    }
+	}
+	str = prefix_xor(masks[CLOSE_QUOTE] & ~escaped) ^ in_str;
+	in_str = (0 != (str >> 63)) ? ~(uint64_t)0 : 0;
+	if (0 != ((masks[CLOSE_SLASH] & ~str) | masks[CLOSE_NUL])) {
+	    return 0;
+	}
+	open = masks[CLOSE_OPEN] & ~str;
+	close = masks[CLOSE_CLOSE] & ~str;
+	if (depth <= scan_popcount(close)) {
+	    for (m = open | close; 0 != m; m &= m - 1) {
+		bit = m & (~m + 1);
+		if (0 != (bit & open)) {
+		    depth++;
+		} else if (0 == --depth) {
+		    return s + scan_ctz(m) + 1;
+		}
+	    }
+	} else {
+	    depth += scan_popcount(open) - scan_popcount(close);
+	}
+    }
+    return 0;
+}
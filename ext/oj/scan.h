@@ -0,0 +1,88 @@
+/* scan.h
+ * Copyright (c) 2017, Peter Ohler
+ * All rights reserved.
+ */
+
+#ifndef __OJ_SCAN_H__
+#define __OJ_SCAN_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// Inputs shorter than this are parsed without building an index.
+#define SCAN_MIN_LEN	256
+
+// The index is built in 64 byte blocks with one bit per input byte. The
+// tokens mask marks every byte that is not JSON whitespace, which includes
+// the structural characters as well as the start of every scalar. The stops
+// mask marks the bytes that terminate an unescaped string run; '"', '\\',
+// and '\0'. Both are context free so comments and the other non-standard
+// input the parser accepts do not throw the index off.
+typedef struct _ScanIndex {
+    const char	*head;
+    const char	*end;
+    size_t	bcnt;
+    uint64_t	*tokens;
+    uint64_t	*stops;
+} *ScanIndex;
+
+typedef const char*	(*ScanStrFunc)(const char *s, const char *end);
+typedef const char*	(*ScanEscFunc)(const char *s, const char *end, int flags);
+
+// Bytes oj_scan_esc() stops at in addition to control characters, '"', and
+// '\\'. The stops are a superset of what an escape mode escapes so the
+// caller still checks each one against its table.
+#define SCAN_ESC_HIBIT	0x01	// 0x7F and above
+#define SCAN_ESC_HTML	0x02	// '&', '/', '<', and '>'
+#define SCAN_ESC_E2	0x04	// 0xE2, the lead byte of U+2028 and U+2029
+
+extern void	oj_scan_init();
+extern void	oj_scan_index_build(ScanIndex si, const char *json, size_t len);
+extern void	oj_scan_index_cleanup(ScanIndex si);
+// Returns the byte after the bracket that closes the array or object whose
+// contents start at s. Returns 0 if there is a comment or '\0' along the way
+// or if the container is not closed before end.
+extern const char*	oj_scan_close(const char *s, const char *end);
+// Finds the first '"', '\\', or '\0' in a string body without an index.
+extern ScanStrFunc	oj_scan_str;
+// Finds the first byte of a string being dumped that may need escaping.
+extern ScanEscFunc	oj_scan_esc;
+
+inline static int
+scan_ctz(uint64_t m) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(m);
+#else
+    int	cnt = 0;
+
+    for (; 0 == (m & 1); m >>= 1) {
+	cnt++;
+    }
+    return cnt;
+#endif
+}
+
+// Returns the first byte at or after cur that is set in the masks. The end
+// of the input is returned if there are none.
+inline static const char*
+scan_next(ScanIndex si, const uint64_t *masks, const char *cur) {
+    size_t	off;
+    size_t	b;
+    uint64_t	m;
+
+    if (si->end <= cur) {
+	return cur;
+    }
+    off = cur - si->head;
+    b = off >> 6;
+    m = masks[b] & (~(uint64_t)0 << (off & 0x3F));
+    while (0 == m) {
+	if (si->bcnt <= ++b) {
+	    return si->end;
+	}
+	m = masks[b];
+    }
+    return si->head + (b << 6) + scan_ctz(m);
+}
+
+#endif /* __OJ_SCAN_H__ */
@@ -806,6 +806,8 @@ VALUE
 oj_pi_sparse(int argc, VALUE *argv, ParseInfo pi, int fd) {
     volatile VALUE	input;
     volatile VALUE	wrapped_stack;
+    volatile VALUE	wrapped_keys = Qnil;
+    volatile VALUE	wrapped_strs = Qnil;
     VALUE		result = Qnil;
     int			line = 0;
 
@@ -814,9 +816,9 @@ oj_pi_sparse(int argc, VALUE *argv, ParseInfo pi, int fd) {
     }
     input = argv[0];
     if (2 <= argc) {
-	if (T_HASH == rb_type(argv[1])) {
+	if (oj_is_options(argv[1])) {
 	    oj_parse_options(argv[1], &pi->options);
-	} else if (3 <= argc && T_HASH == rb_type(argv[2])) {
+	} else if (3 <= argc && oj_is_options(argv[2])) {
 	    oj_parse_options(argv[2], &pi->options);
 	}
     }
@@ -829,6 +831,15 @@ oj_pi_sparse(int argc, VALUE *argv, ParseInfo pi, int fd) {
     } else if (CompatMode == pi->options.mode && T_STRING == rb_type(input) && No == pi->options.nilnil && 0 == RSTRING_LEN(input)) {
 	rb_raise(oj_json_parser_error_class, "An empty string is not a valid JSON string.");
     }
+#if !IS_WINDOWS
+    // A regular File that has not been read from yet is parsed in place.
+    if (0 == fd && rb_cFile == rb_obj_class(input) && 0 == FIX2INT(rb_funcall(input, oj_pos_id, 0)) &&
+	oj_pi_map_fd(pi, FIX2INT(rb_funcall(input, oj_fileno_id, 0)))) {
+	// The options are already in pi so only the input is passed along.
+	// Parsing them again would leak the :match_string list built above.
+	return oj_pi_parse(1, argv, pi, 0, 0, true);
+    }
+#endif
     if (rb_block_given_p()) {
 	pi->proc = Qnil;
     } else {
@@ -850,12 +861,24 @@ oj_pi_sparse(int argc, VALUE *argv, ParseInfo pi, int fd) {
     // data object and providing a mark function for ruby objects on the
     // value stack (while it is in scope).
     wrapped_stack = oj_stack_init(&pi->stack);
+    if (Yes == pi->options.cache_keys) {
+	wrapped_keys = oj_str_cache_init(&pi->key_cache, Yes == pi->options.sym_key, STR_CACHE_KEY_MAX, &oj_key_cache_stats);
+    }
+    if (0 < pi->options.cache_str) {
+	wrapped_strs = oj_str_cache_init(&pi->str_cache, false, STR_CACHE_STR_MAX, &oj_str_cache_stats);
+    }
     rb_protect(protect_parse, (VALUE)pi, &line);
     if (Qundef == pi->stack.head->val && !empty_ok(&pi->options)) {
 	oj_set_error_at(pi, oj_parse_error_class, __FILE__, __LINE__, "Empty input");
     }
     result = stack_head_val(&pi->stack);
     DATA_PTR(wrapped_stack) = 0;
+    if (Qnil != wrapped_keys) {
+	DATA_PTR(wrapped_keys) = 0;
+    }
+    if (Qnil != wrapped_strs) {
+	DATA_PTR(wrapped_strs) = 0;
+    }
     if (No == pi->options.allow_gc) {
 	rb_gc_enable();
     }
@@ -887,6 +910,9 @@ oj_pi_sparse(int argc, VALUE *argv, ParseInfo pi, int fd) {
 	oj_circ_array_free(pi->circ_array);
     }
     stack_cleanup(&pi->stack);
+    oj_str_cache_cleanup(&pi->key_cache);
+    oj_str_cache_cleanup(&pi->str_cache);
+    reader_cleanup(&pi->rd);
     if (0 != fd) {
 	close(fd);
     }
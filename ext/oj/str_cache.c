@@ -0,0 +1,178 @@
+/* str_cache.c
+ * Copyright (c) 2017, Peter Ohler
+ * All rights reserved.
+ */
+
+#include <string.h>
+
+#include "oj.h"
+#include "str_cache.h"
+#include "encode.h"
+
+#define STR_CACHE_INIT_SIZE	256
+
+struct _StrCacheStats	oj_key_cache_stats = { 0, 0 };
+struct _StrCacheStats	oj_str_cache_stats = { 0, 0 };
+
+static uint64_t
+str_hash(const char *str, size_t len) {
+    uint64_t	h = 0xCBF29CE484222325ULL ^ len;
+    const char	*end = str + len;
+
+    for (; str < end; str++) {
+	h = (h ^ (uint8_t)*str) * 0x100000001B3ULL;
+    }
+    return h ^ (h >> 29);
+}
+
+static void
+mark(void *ptr) {
+    StrCache	cache = (StrCache)ptr;
+    StrSlot	s;
+    StrSlot	end;
+
+    if (0 == ptr || NULL == cache->slots) {
+	return;
+    }
+    end = cache->slots + cache->size;
+    for (s = cache->slots; s < end; s++) {
+	if (0 != s->str) {
+	    rb_gc_mark(s->str);
+	    rb_gc_mark(s->val);
+	}
+    }
+}
+
+static StrSlot
+empty_slot(StrSlot slots, size_t mask, uint64_t h) {
+    StrSlot	s = slots + (h & mask);
+
+    while (0 != s->str) {
+	s = slots + ((s - slots + 1) & mask);
+    }
+    return s;
+}
+
+static void
+grow(StrCache cache) {
+    size_t	size = cache->size * 2;
+    size_t	mask = size - 1;
+    StrSlot	slots = ALLOC_N(struct _StrSlot, size);
+    StrSlot	end = cache->slots + cache->size;
+    StrSlot	s;
+
+    // The new slots are filled before they replace the old ones so a GC
+    // triggered by the allocation still marks every cached value.
+    memset(slots, 0, sizeof(struct _StrSlot) * size);
+    for (s = cache->slots; s < end; s++) {
+	if (0 != s->str) {
+	    *empty_slot(slots, mask, s->h) = *s;
+	}
+    }
+    xfree(cache->slots);
+    cache->slots = slots;
+    cache->size = size;
+    cache->mask = mask;
+    cache->hand = 0;
+}
+
+// Clock eviction. Entries that have not been hit since the hand last passed
+// are removed and the probe chain behind them is shifted back to close the
+// hole.
+static void
+evict(StrCache cache) {
+    size_t	i;
+    size_t	j;
+    size_t	k;
+
+    while (true) {
+	i = cache->hand;
+	cache->hand = (cache->hand + 1) & cache->mask;
+	if (0 == cache->slots[i].str) {
+	    continue;
+	}
+	if (cache->slots[i].ref) {
+	    cache->slots[i].ref = false;
+	    continue;
+	}
+	break;
+    }
+    for (j = (i + 1) & cache->mask; 0 != cache->slots[j].str; j = (j + 1) & cache->mask) {
+	k = cache->slots[j].h & cache->mask;
+	// Move the entry at j into the hole unless its home is cyclically
+	// between the hole and j.
+	if ((i < j) ? (k <= i || j < k) : (k <= i && j < k)) {
+	    cache->slots[i] = cache->slots[j];
+	    i = j;
+	}
+    }
+    memset(cache->slots + i, 0, sizeof(struct _StrSlot));
+    cache->cnt--;
+}
+
+void
+oj_str_cache_mark(StrCache cache) {
+    mark(cache);
+}
+
+// The returned Data object marks the cached values. Clear its pointer before
+// calling oj_str_cache_cleanup().
+VALUE
+oj_str_cache_init(StrCache cache, bool sym, size_t limit, StrCacheStats totals) {
+    cache->size = STR_CACHE_INIT_SIZE;
+    cache->mask = cache->size - 1;
+    cache->cnt = 0;
+    cache->limit = limit;
+    cache->hand = 0;
+    cache->sym = sym;
+    cache->stats.hits = 0;
+    cache->stats.misses = 0;
+    cache->totals = totals;
+    cache->slots = ALLOC_N(struct _StrSlot, cache->size);
+    memset(cache->slots, 0, sizeof(struct _StrSlot) * cache->size);
+
+    return Data_Wrap_Struct(0, mark, 0, cache);
+}
+
+void
+oj_str_cache_cleanup(StrCache cache) {
+    if (NULL != cache->slots) {
+	xfree(cache->slots);
+	cache->slots = NULL;
+	cache->totals->hits += cache->stats.hits;
+	cache->totals->misses += cache->stats.misses;
+    }
+}
+
+VALUE
+oj_str_cache_intern(StrCache cache, const char *str, size_t len) {
+    uint64_t		h = str_hash(str, len);
+    StrSlot		s = cache->slots + (h & cache->mask);
+    volatile VALUE	rstr;
+    volatile VALUE	val;
+
+    for (; 0 != s->str; s = cache->slots + ((s - cache->slots + 1) & cache->mask)) {
+	if (h == s->h && len == (size_t)RSTRING_LEN(s->str) && 0 == memcmp(str, RSTRING_PTR(s->str), len)) {
+	    s->ref = true;
+	    cache->stats.hits++;
+	    return s->val;
+	}
+    }
+    cache->stats.misses++;
+    rstr = oj_encode(rb_str_new(str, len));
+    rb_obj_freeze(rstr);
+    val = cache->sym ? rb_str_intern(rstr) : rstr;
+    if (cache->limit <= cache->cnt) {
+	evict(cache);
+    }
+    s = empty_slot(cache->slots, cache->mask, h);
+    s->h = h;
+    s->val = val;
+    s->str = rstr;
+    s->ref = false;
+    cache->cnt++;
+    if (cache->size / 2 < cache->cnt) {
+	grow(cache);
+    }
+    return val;
+}
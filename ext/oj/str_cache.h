@@ -0,0 +1,58 @@
+/* str_cache.h
+ * Copyright (c) 2017, Peter Ohler
+ * All rights reserved.
+ */
+
+#ifndef __OJ_STR_CACHE_H__
+#define __OJ_STR_CACHE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ruby.h"
+
+// Maximum number of entries in the hash key and string value caches. Once
+// full the least recently reused entries are replaced.
+#define STR_CACHE_KEY_MAX	65536
+#define STR_CACHE_STR_MAX	4096
+
+typedef struct _StrSlot {
+    uint64_t	h;
+    VALUE	str; // frozen String with the key bytes
+    VALUE	val; // str or the Symbol for it
+    bool	ref; // set on a hit, cleared as the clock hand passes
+} *StrSlot;
+
+typedef struct _StrCacheStats {
+    uint64_t	hits;
+    uint64_t	misses;
+} *StrCacheStats;
+
+// A parse scoped map from string bytes to a frozen Ruby String or Symbol.
+// The cache is empty (no slots) unless it has been initialized.
+typedef struct _StrCache {
+    StrSlot		slots;
+    size_t		size;
+    size_t		mask;
+    size_t		cnt;
+    size_t		limit;
+    size_t		hand;
+    bool		sym;
+    struct _StrCacheStats	stats;
+    StrCacheStats	totals; // where stats are added on cleanup
+} *StrCache;
+
+extern struct _StrCacheStats	oj_key_cache_stats;
+extern struct _StrCacheStats	oj_str_cache_stats;
+
+extern VALUE	oj_str_cache_init(StrCache cache, bool sym, size_t limit, StrCacheStats totals);
+extern void	oj_str_cache_cleanup(StrCache cache);
+extern void	oj_str_cache_mark(StrCache cache);
+extern VALUE	oj_str_cache_intern(StrCache cache, const char *str, size_t len);
+
+inline static bool
+str_cache_active(StrCache cache) {
+    return NULL != cache->slots;
+}
+
+#endif /* __OJ_STR_CACHE_H__ */
@@ -24,6 +24,13 @@ stream_writer_free(void *ptr) {
     xfree(ptr);
 }
 
+static void
+stream_writer_mark(void *ptr) {
+    if (0 != ptr) {
+	rb_gc_mark(((StreamWriter)ptr)->sw.ropts);
+    }
+}
+
 static void
 stream_writer_reset_buf(StreamWriter sw) {
     sw->sw.out.cur = sw->sw.out.buf;
@@ -95,7 +102,7 @@ stream_writer_new(int argc, VALUE *argv, VALUE self) {
 	rb_raise(rb_eArgError, "expected an IO Object.");
     }
     sw = ALLOC(struct _StreamWriter);
-    if (2 == argc && T_HASH == rb_type(argv[1])) {
+    if (2 == argc && oj_is_options(argv[1])) {
 	volatile VALUE	v;
 	int		buf_size = 0;
 
@@ -103,7 +110,7 @@ stream_writer_new(int argc, VALUE *argv, VALUE self) {
 	    buffer_size_sym = ID2SYM(rb_intern("buffer_size"));	rb_gc_register_address(&buffer_size_sym);
 	    
 	}
-	if (Qnil != (v = rb_hash_lookup(argv[1], buffer_size_sym))) {
+	if (Qnil != (v = rb_hash_lookup(oj_options_hash(argv[1]), buffer_size_sym))) {
 #ifdef RUBY_INTEGER_UNIFICATION
 	    if (rb_cInteger != rb_obj_class(v)) {
 		rb_raise(rb_eArgError, ":buffer size must be a Integer.");
@@ -117,6 +124,7 @@ stream_writer_new(int argc, VALUE *argv, VALUE self) {
 	}
 	oj_str_writer_init(&sw->sw, buf_size);
 	oj_parse_options(argv[1], &sw->sw.opts);
+	sw->sw.ropts = argv[1];
 	sw->flush_limit = buf_size;
     } else {
 	oj_str_writer_init(&sw->sw, 4096);
@@ -127,7 +135,7 @@ stream_writer_new(int argc, VALUE *argv, VALUE self) {
     sw->type = type;
     sw->fd = fd;
 
-    return Data_Wrap_Struct(oj_stream_writer_class, 0, stream_writer_free, sw);
+    return Data_Wrap_Struct(oj_stream_writer_class, stream_writer_mark, stream_writer_free, sw);
 }
 
 /* Document-method: push_key
@@ -29,9 +29,7 @@ add_value(ParseInfo pi, VALUE val) {
 
 static void
 add_cstr(ParseInfo pi, const char *str, size_t len, const char *orig) {
-    volatile VALUE	rstr = rb_str_new(str, len);
-
-    rstr = oj_encode(rstr);
+    volatile VALUE	rstr = cstr_to_value(pi, str, len);
     pi->stack.head->val = rstr;
 }
 
@@ -56,6 +54,9 @@ calc_hash_key(ParseInfo pi, Val parent) {
     volatile VALUE	rkey = parent->key_val;
 
     if (Qundef == rkey) {
+	if (str_cache_active(&pi->key_cache)) {
+	    return oj_str_cache_intern(&pi->key_cache, parent->key, parent->klen);
+	}
 	rkey = rb_str_new(parent->key, parent->klen);
     }
     rkey = oj_encode(rkey);
@@ -67,9 +68,7 @@ calc_hash_key(ParseInfo pi, Val parent) {
 
 static void
 hash_set_cstr(ParseInfo pi, Val parent, const char *str, size_t len, const char *orig) {
-    volatile VALUE	rstr = rb_str_new(str, len);
-
-    rstr = oj_encode(rstr);
+    volatile VALUE	rstr = cstr_to_value(pi, str, len);
     rb_hash_aset(stack_peek(&pi->stack)->val, calc_hash_key(pi, parent), rstr);
 }
 
@@ -93,9 +92,7 @@ start_array(ParseInfo pi) {
 
 static void
 array_append_cstr(ParseInfo pi, const char *str, size_t len, const char *orig) {
-    volatile VALUE	rstr = rb_str_new(str, len);
-
-    rstr = oj_encode(rstr);
+    volatile VALUE	rstr = cstr_to_value(pi, str, len);
     rb_ary_push(stack_peek(&pi->stack)->val, rstr);
 }
 
@@ -50,6 +50,7 @@ maybe_comma(StrWriter sw) {
 void
 oj_str_writer_init(StrWriter sw, int buf_size) {
     sw->opts = oj_default_options;
+    sw->ropts = Qnil;
     sw->depth = 0;
     sw->types = ALLOC_N(char, 256);
     sw->types_end = sw->types + 256;
@@ -64,6 +65,8 @@ oj_str_writer_init(StrWriter sw, int buf_size) {
     sw->out.buf = ALLOC_N(char, buf_size);
     sw->out.end = sw->out.buf + buf_size - 10;
     sw->out.allocated = true;
+    sw->out.str = Qnil;
+    sw->out.flush = NULL;
     sw->out.cur = sw->out.buf;
     *sw->out.cur = '\0';
     sw->out.circ_cnt = 0;
@@ -252,6 +255,13 @@ str_writer_free(void *ptr) {
     xfree(ptr);
 }
 
+static void
+str_writer_mark(void *ptr) {
+    if (0 != ptr) {
+	rb_gc_mark(((StrWriter)ptr)->ropts);
+    }
+}
+
 /* Document-method: new
  * call-seq: new(io, options)
  *
@@ -275,12 +285,13 @@ str_writer_new(int argc, VALUE *argv, VALUE self) {
     oj_str_writer_init(sw, 0);
     if (1 == argc) {
 	oj_parse_options(argv[0], &sw->opts);
+	sw->ropts = argv[0];
     }
     sw->out.argc = argc - 1;
     sw->out.argv = argv + 1;
     sw->out.indent = sw->opts.indent;
 
-    return Data_Wrap_Struct(oj_string_writer_class, 0, str_writer_free, sw);
+    return Data_Wrap_Struct(oj_string_writer_class, str_writer_mark, str_writer_free, sw);
 }
 
 /* Document-method: push_key
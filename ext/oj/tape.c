@@ -0,0 +1,573 @@
+/* tape.c
+ * Copyright (c) 2017, Peter Ohler
+ * All rights reserved.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "oj.h"
+#include "err.h"
+#include "parse.h"
+#include "scan.h"
+#include "tape.h"
+
+#define TAPE_TOK_INIT	1024
+#define TAPE_LINE_INIT	256
+#define TAPE_BLOCK_SIZE	0x00010000
+// Deeper documents are left to oj_parse2().
+#define TAPE_MAX_DEPTH	256
+
+typedef enum {
+    ST_VALUE		= 'v',
+    ST_ARRAY_NEW	= 'a',
+    ST_HASH_NEW		= 'h',
+    ST_KEY		= 'k',
+    ST_COLON		= ':',
+    ST_COMMA		= ',',
+    ST_DONE		= 'd',
+} BuildState;
+
+void
+oj_tape_init(Tape t) {
+    memset(t, 0, sizeof(struct _Tape));
+}
+
+void
+oj_tape_cleanup(Tape t) {
+    TapeBlock	b;
+
+    while (NULL != (b = t->arena)) {
+	t->arena = b->next;
+	free(b);
+    }
+    free(t->toks);
+    free(t->lines);
+    oj_tape_init(t);
+}
+
+static Tok
+tok_push(Tape t, char type, const char *str, size_t len, const char *orig) {
+    Tok	tok;
+
+    if (t->tsize <= t->tcnt) {
+	size_t	size = (0 == t->tsize) ? TAPE_TOK_INIT : t->tsize * 2;
+	Tok	toks = (Tok)realloc(t->toks, sizeof(struct _Tok) * size);
+
+	if (NULL == toks) {
+	    return NULL;
+	}
+	t->toks = toks;
+	t->tsize = size;
+    }
+    tok = t->toks + t->tcnt++;
+    tok->type = type;
+    tok->str = str;
+    tok->len = (uint32_t)len;
+    tok->orig = orig;
+
+    return tok;
+}
+
+static char*
+arena_alloc(Tape t, size_t len) {
+    TapeBlock	b = t->arena;
+    char	*s;
+
+    if (NULL == b || b->size - b->used < len) {
+	size_t	size = (TAPE_BLOCK_SIZE < len) ? len : TAPE_BLOCK_SIZE;
+
+	if (NULL == (b = (TapeBlock)malloc(sizeof(struct _TapeBlock) + size))) {
+	    return NULL;
+	}
+	b->next = t->arena;
+	b->size = size;
+	b->used = 0;
+	t->arena = b;
+    }
+    s = b->data + b->used;
+    b->used += len;
+
+    return s;
+}
+
+static int
+hex4(const char *h) {
+    int	b = 0;
+    int	i;
+
+    for (i = 0; i < 4; i++, h++) {
+	b = b << 4;
+	if ('0' <= *h && *h <= '9') {
+	    b += *h - '0';
+	} else if ('A' <= *h && *h <= 'F') {
+	    b += *h - 'A' + 10;
+	} else if ('a' <= *h && *h <= 'f') {
+	    b += *h - 'a' + 10;
+	} else {
+	    return -1;
+	}
+    }
+    return b;
+}
+
+// Unescapes a string body into the arena. The same escapes as
+// read_escaped_str() are handled. Anything it would reject or only accepts
+// with an option returns false so the line is left to oj_parse2().
+static bool
+unescape(Tape t, const char *s, const char *end, const char **strp, size_t *lenp, bool *oomp) {
+    char	*buf;
+    char	*b;
+    int		code;
+    int		c2;
+
+    // The result is never longer than the escaped form.
+    if (NULL == (buf = arena_alloc(t, end - s))) {
+	*oomp = true;
+	return false;
+    }
+    for (b = buf; s < end; s++) {
+	if ('\\' != *s) {
+	    *b++ = *s;
+	    continue;
+	}
+	s++;
+	switch (*s) {
+	case 'n':	*b++ = '\n';	break;
+	case 'r':	*b++ = '\r';	break;
+	case 't':	*b++ = '\t';	break;
+	case 'f':	*b++ = '\f';	break;
+	case 'b':	*b++ = '\b';	break;
+	case '"':	*b++ = '"';	break;
+	case '/':	*b++ = '/';	break;
+	case '\\':	*b++ = '\\';	break;
+	case 'u':
+	    if (end - s < 5 || 0 > (code = hex4(s + 1))) {
+		return false;
+	    }
+	    s += 4;
+	    if (0x0000D800 <= code && code <= 0x0000DFFF) {
+		if (end - s < 7 || '\\' != s[1] || 'u' != s[2] || 0 > (c2 = hex4(s + 3))) {
+		    return false;
+		}
+		s += 6;
+		code = ((((code - 0x0000D800) & 0x000003FF) << 10) | ((c2 - 0x0000DC00) & 0x000003FF)) + 0x00010000;
+	    }
+	    if (0x0000007F >= code) {
+		*b++ = (char)code;
+	    } else if (0x000007FF >= code) {
+		*b++ = 0xC0 | (code >> 6);
+		*b++ = 0x80 | (0x3F & code);
+	    } else if (0x0000FFFF >= code) {
+		*b++ = 0xE0 | (code >> 12);
+		*b++ = 0x80 | ((code >> 6) & 0x3F);
+		*b++ = 0x80 | (0x3F & code);
+	    } else {
+		*b++ = 0xF0 | (code >> 18);
+		*b++ = 0x80 | ((code >> 12) & 0x3F);
+		*b++ = 0x80 | ((code >> 6) & 0x3F);
+		*b++ = 0x80 | (0x3F & code);
+	    }
+	    break;
+	default:
+	    return false;
+	}
+    }
+    *strp = buf;
+    *lenp = b - buf;
+
+    return true;
+}
+
+// Adds a string token for the body starting at s. Returns the position after
+// the closing quote or NULL if the line should be left to oj_parse2(). If
+// memory ran out *oomp is also set.
+static const char*
+read_str(Tape t, char type, const char *s, const char *end, bool *oomp) {
+    const char	*start = s;
+    const char	*str = s;
+    size_t	len;
+    bool	escaped = false;
+
+    while (true) {
+	s = oj_scan_str(s, end);
+	if (end <= s || '\0' == *s) {
+	    return NULL;
+	}
+	if ('"' == *s) {
+	    break;
+	}
+	escaped = true;
+	s += 2;
+    }
+    len = s - start;
+    if (escaped && !unescape(t, start, s, &str, &len, oomp)) {
+	return NULL;
+    }
+    if (UINT32_MAX < len) {
+	return NULL;
+    }
+    if (NULL == tok_push(t, type, str, len, start)) {
+	*oomp = true;
+	return NULL;
+    }
+    return s + 1;
+}
+
+// The reserved values for Infinity and NaN are only recognized when the
+// number is the last thing in the input so those are left to oj_parse2().
+static bool
+reserved_num(const char *s, size_t len) {
+    return ((sizeof(INF_VAL) - 1 == len && 0 == strncasecmp(INF_VAL, s, len)) ||
+	    (sizeof(NINF_VAL) - 1 == len && 0 == strncasecmp(NINF_VAL, s, len)) ||
+	    (sizeof(NAN_VAL) - 1 == len && 0 == strncasecmp(NAN_VAL, s, len)));
+}
+
+// Tokenizes one line. Returns the kind of line or 0 if memory ran out.
+static char
+build_line(Tape t, const char *s, const char *end, Options opts, int max_depth) {
+    char		stack[TAPE_MAX_DEPTH];
+    int			depth = 0;
+    char		state = ST_VALUE;
+    bool		oom = false;
+    struct _NumInfo	ni;
+    const char		*err;
+    const char		*num = NULL;
+
+    for (; s < end && (' ' == *s || '\t' == *s || '\r' == *s || '\f' == *s); s++) {
+    }
+    if (end <= s || '\0' == *s) {
+	return LINE_BLANK;
+    }
+    while (true) {
+	if (0 < max_depth && max_depth <= depth) {
+	    return LINE_SERIAL;
+	}
+	for (; s < end && (' ' == *s || '\t' == *s || '\r' == *s || '\f' == *s); s++) {
+	}
+	if (end <= s) {
+	    return (ST_DONE == state) ? LINE_DOC : LINE_SERIAL;
+	}
+	switch (*s) {
+	case '{':
+	case '[':
+	    if ((ST_VALUE != state && ST_ARRAY_NEW != state) || TAPE_MAX_DEPTH <= depth) {
+		return LINE_SERIAL;
+	    }
+	    if (NULL == tok_push(t, *s, NULL, 0, s)) {
+		return 0;
+	    }
+	    stack[depth++] = *s;
+	    state = ('{' == *s) ? ST_HASH_NEW : ST_ARRAY_NEW;
+	    s++;
+	    continue;
+	case '}':
+	    if (ST_HASH_NEW != state && (ST_COMMA != state || '{' != stack[depth - 1])) {
+		return LINE_SERIAL;
+	    }
+	    break;
+	case ']':
+	    if (ST_ARRAY_NEW != state && (ST_COMMA != state || '[' != stack[depth - 1])) {
+		return LINE_SERIAL;
+	    }
+	    break;
+	case ':':
+	    if (ST_COLON != state) {
+		return LINE_SERIAL;
+	    }
+	    state = ST_VALUE;
+	    s++;
+	    continue;
+	case ',':
+	    if (ST_COMMA != state) {
+		return LINE_SERIAL;
+	    }
+	    state = ('[' == stack[depth - 1]) ? ST_VALUE : ST_KEY;
+	    s++;
+	    continue;
+	case '"':
+	    if (ST_HASH_NEW == state || ST_KEY == state) {
+		if (NULL == (s = read_str(t, TOK_KEY, s + 1, end, &oom))) {
+		    return oom ? 0 : LINE_SERIAL;
+		}
+		state = ST_COLON;
+		continue;
+	    }
+	    if (ST_VALUE != state && ST_ARRAY_NEW != state) {
+		return LINE_SERIAL;
+	    }
+	    if (NULL == (s = read_str(t, TOK_STR, s + 1, end, &oom))) {
+		return oom ? 0 : LINE_SERIAL;
+	    }
+	    state = (0 < depth) ? ST_COMMA : ST_DONE;
+	    continue;
+	case '-':
+	case '0':
+	case '1':
+	case '2':
+	case '3':
+	case '4':
+	case '5':
+	case '6':
+	case '7':
+	case '8':
+	case '9':
+	    num = ('-' == *s) ? s + 1 : s;
+	    // Leading zeros are an error in compat mode and only a bare '-' is
+	    // accepted by oj_parse2() so both are left to it.
+	    if (*num < '0' || '9' < *num || ('0' == *num && '0' <= num[1] && num[1] <= '9')) {
+		return LINE_SERIAL;
+	    }
+	    num = oj_num_scan(s, &ni, opts, &err);
+	    if (NULL != err || (ni.big && reserved_num(s, num - s))) {
+		return LINE_SERIAL;
+	    }
+	    break;
+	case 't':
+	    if (end - s < 4 || 0 != strncmp("true", s, 4)) {
+		return LINE_SERIAL;
+	    }
+	    break;
+	case 'f':
+	    if (end - s < 5 || 0 != strncmp("false", s, 5)) {
+		return LINE_SERIAL;
+	    }
+	    break;
+	case 'n':
+	    if (end - s < 4 || 0 != strncmp("null", s, 4)) {
+		return LINE_SERIAL;
+	    }
+	    break;
+	default:
+	    // Comments, NaN, Infinity, and anything invalid.
+	    return LINE_SERIAL;
+	}
+	// Closes and scalar values remain.
+	switch (*s) {
+	case '}':
+	case ']':
+	    if (NULL == tok_push(t, *s, NULL, 0, s)) {
+		return 0;
+	    }
+	    depth--;
+	    s++;
+	    break;
+	case 't':
+	    if (ST_VALUE != state && ST_ARRAY_NEW != state) {
+		return LINE_SERIAL;
+	    }
+	    if (NULL == tok_push(t, TOK_TRUE, NULL, 0, s)) {
+		return 0;
+	    }
+	    s += 4;
+	    break;
+	case 'f':
+	    if (ST_VALUE != state && ST_ARRAY_NEW != state) {
+		return LINE_SERIAL;
+	    }
+	    if (NULL == tok_push(t, TOK_FALSE, NULL, 0, s)) {
+		return 0;
+	    }
+	    s += 5;
+	    break;
+	case 'n':
+	    if (ST_VALUE != state && ST_ARRAY_NEW != state) {
+		return LINE_SERIAL;
+	    }
+	    if (NULL == tok_push(t, TOK_NULL, NULL, 0, s)) {
+		return 0;
+	    }
+	    s += 4;
+	    break;
+	default: // number
+	    if (ST_VALUE != state && ST_ARRAY_NEW != state) {
+		return LINE_SERIAL;
+	    }
+	    if (NULL == tok_push(t, TOK_NUM, s, num - s, s)) {
+		return 0;
+	    }
+	    s = num;
+	    break;
+	}
+	state = (0 < depth) ? ST_COMMA : ST_DONE;
+    }
+    return LINE_SERIAL;
+}
+
+void
+oj_tape_build(Tape t, const char *start, const char *end, Options opts, int max_depth) {
+    TapeBlock	b;
+    TapeLine	line;
+    const char	*nl;
+    const char	*lend;
+
+    t->tcnt = 0;
+    t->lcnt = 0;
+    t->rest = start;
+    t->end = end;
+    // Keep one arena block for the next build.
+    if (NULL != (b = t->arena)) {
+	TapeBlock	next;
+
+	for (next = b->next; NULL != next; next = b->next) {
+	    b->next = next->next;
+	    free(next);
+	}
+	b->used = 0;
+    }
+    while (t->rest < end) {
+	if (t->lsize <= t->lcnt) {
+	    size_t	size = (0 == t->lsize) ? TAPE_LINE_INIT : t->lsize * 2;
+	    TapeLine	lines = (TapeLine)realloc(t->lines, sizeof(struct _TapeLine) * size);
+
+	    if (NULL == lines) {
+		return;
+	    }
+	    t->lines = lines;
+	    t->lsize = size;
+	}
+	if (NULL == (nl = memchr(t->rest, '\n', end - t->rest))) {
+	    lend = end;
+	} else {
+	    lend = nl;
+	}
+	line = t->lines + t->lcnt;
+	line->start = t->rest;
+	line->end = lend;
+	line->tok = t->tcnt;
+	if (0 == (line->kind = build_line(t, t->rest, lend, opts, max_depth))) {
+	    t->tcnt = line->tok;
+	    return;
+	}
+	if (LINE_DOC != line->kind) {
+	    t->tcnt = line->tok;
+	}
+	line->cnt = t->tcnt - line->tok;
+	t->lcnt++;
+	t->rest = (NULL == nl) ? end : nl + 1;
+    }
+}
+
+static void
+add_value(ParseInfo pi, VALUE rval) {
+    Val	parent = stack_peek(&pi->stack);
+
+    if (0 == parent) {
+	pi->add_value(pi, rval);
+    } else if (NEXT_HASH_VALUE == parent->next) {
+	pi->hash_set_value(pi, parent, rval);
+	parent->next = NEXT_HASH_COMMA;
+    } else {
+	pi->array_append_value(pi, rval);
+	parent->next = NEXT_ARRAY_COMMA;
+    }
+}
+
+static void
+add_str(ParseInfo pi, Tok tok) {
+    Val	parent = stack_peek(&pi->stack);
+
+    if (0 == parent) {
+	pi->add_cstr(pi, tok->str, tok->len, tok->orig);
+    } else if (NEXT_HASH_VALUE == parent->next) {
+	pi->hash_set_cstr(pi, parent, tok->str, tok->len, tok->orig);
+	parent->next = NEXT_HASH_COMMA;
+    } else {
+	pi->array_append_cstr(pi, tok->str, tok->len, tok->orig);
+	parent->next = NEXT_ARRAY_COMMA;
+    }
+}
+
+static void
+add_num(ParseInfo pi, Tok tok) {
+    struct _NumInfo	ni;
+    const char		*err;
+    Val			parent = stack_peek(&pi->stack);
+
+    // Already validated by the builder so only the fields are needed.
+    oj_num_scan(tok->str, &ni, &pi->options, &err);
+    if (0 == parent) {
+	pi->add_num(pi, &ni);
+    } else if (NEXT_HASH_VALUE == parent->next) {
+	pi->hash_set_num(pi, parent, &ni);
+	parent->next = NEXT_HASH_COMMA;
+    } else {
+	pi->array_append_num(pi, &ni);
+	parent->next = NEXT_ARRAY_COMMA;
+    }
+}
+
+static void
+set_key(ParseInfo pi, Tok tok) {
+    Val	parent = stack_peek(&pi->stack);
+
+    // Keys stay in the input or arena until the tape is rebuilt so they are
+    // never copied or freed.
+    if (Qundef == (parent->key_val = pi->hash_key(pi, tok->str, tok->len))) {
+	parent->key = tok->str;
+	parent->klen = tok->len;
+    } else {
+	parent->key = "";
+	parent->klen = 0;
+    }
+    parent->k1 = *tok->orig;
+    parent->next = NEXT_HASH_VALUE;
+}
+
+void
+oj_tape_replay(ParseInfo pi, Tape t, TapeLine line) {
+    Tok			tok = t->toks + line->tok;
+    Tok			end = tok + line->cnt;
+    volatile VALUE	v;
+    Val			val;
+
+    pi->json = line->start;
+    pi->end = line->end;
+    err_init(&pi->err);
+    for (; tok < end; tok++) {
+	pi->cur = tok->orig;
+	switch (tok->type) {
+	case TOK_HASH_START:
+	    v = pi->start_hash(pi);
+	    stack_push(&pi->stack, v, NEXT_HASH_NEW);
+	    break;
+	case TOK_HASH_END:
+	    pi->end_hash(pi);
+	    val = stack_pop(&pi->stack);
+	    add_value(pi, val->val);
+	    break;
+	case TOK_ARRAY_START:
+	    v = pi->start_array(pi);
+	    stack_push(&pi->stack, v, NEXT_ARRAY_NEW);
+	    break;
+	case TOK_ARRAY_END:
+	    val = stack_pop(&pi->stack);
+	    pi->end_array(pi);
+	    add_value(pi, val->val);
+	    break;
+	case TOK_KEY:
+	    set_key(pi, tok);
+	    break;
+	case TOK_STR:
+	    add_str(pi, tok);
+	    break;
+	case TOK_NUM:
+	    add_num(pi, tok);
+	    break;
+	case TOK_TRUE:
+	    add_value(pi, Qtrue);
+	    break;
+	case TOK_FALSE:
+	    add_value(pi, Qfalse);
+	    break;
+	case TOK_NULL:
+	    add_value(pi, Qnil);
+	    break;
+	default:
+	    break;
+	}
+	if (err_has(&pi->err)) {
+	    return;
+	}
+    }
+}
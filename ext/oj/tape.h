@@ -0,0 +1,87 @@
+/* tape.h
+ * Copyright (c) 2017, Peter Ohler
+ * All rights reserved.
+ */
+
+#ifndef __OJ_TAPE_H__
+#define __OJ_TAPE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// A tape is the token stream for a run of newline delimited JSON
+// documents. It is built without touching Ruby so several can be built at
+// once on threads that do not hold the GVL. Replaying a line drives the same
+// parse callbacks oj_parse2() would so the resulting objects are the same
+// for every mode. Lines the tape builder does not handle, including all
+// invalid lines, are marked to be parsed with oj_parse2() instead so errors
+// are reported exactly as they are without a tape.
+
+typedef enum {
+    TOK_HASH_START	= '{',
+    TOK_HASH_END	= '}',
+    TOK_ARRAY_START	= '[',
+    TOK_ARRAY_END	= ']',
+    TOK_KEY		= 'k',
+    TOK_STR		= 's',
+    TOK_NUM		= '#',
+    TOK_TRUE		= 't',
+    TOK_FALSE		= 'f',
+    TOK_NULL		= 'n',
+} TokType;
+
+typedef enum {
+    LINE_DOC		= 'd',
+    LINE_BLANK		= 'b',
+    LINE_SERIAL		= 's', // parse with oj_parse2()
+} LineKind;
+
+typedef struct _Tok {
+    const char	*str;	// key, string, or number, unescaped strings are in the arena
+    const char	*orig;	// start in the input
+    uint32_t	len;
+    char	type;	// TokType
+} *Tok;
+
+typedef struct _TapeLine {
+    const char	*start;
+    const char	*end;
+    size_t	tok;	// index of the first token
+    size_t	cnt;
+    char	kind;	// LineKind
+} *TapeLine;
+
+typedef struct _TapeBlock {
+    struct _TapeBlock	*next;
+    size_t		size;
+    size_t		used;
+    char		data[1];
+} *TapeBlock;
+
+typedef struct _Tape {
+    struct _Tok		*toks;
+    size_t		tcnt;
+    size_t		tsize;
+    struct _TapeLine	*lines;
+    size_t		lcnt;
+    size_t		lsize;
+    TapeBlock		arena;	// unescaped strings
+    const char		*rest;	// start of the lines not on the tape, end if all are
+    const char		*end;
+} *Tape;
+
+struct _ParseInfo;
+struct _Options;
+
+extern void	oj_tape_init(Tape t);
+extern void	oj_tape_cleanup(Tape t);
+// Tokenizes the lines from start to end. Only malloc() and free() are used
+// so it is safe to call without the GVL. If memory runs out the lines not
+// tokenized are left from rest to end.
+extern void	oj_tape_build(Tape t, const char *start, const char *end, struct _Options *opts, int max_depth);
+// Drives the parse callbacks for one line. The document is left at the head
+// of the stack as with oj_parse2().
+extern void	oj_tape_replay(struct _ParseInfo *pi, Tape t, TapeLine line);
+
+#endif /* __OJ_TAPE_H__ */
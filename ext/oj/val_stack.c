@@ -60,6 +60,11 @@ mark(void *ptr) {
 #endif
 }
 
+void
+oj_stack_mark(ValStack stack) {
+    mark(stack);
+}
+
 VALUE
 oj_stack_init(ValStack stack) {
 #if USE_PTHREAD_MUTEX
@@ -85,6 +85,16 @@ typedef struct _ValStack {
 } *ValStack;
 
 extern VALUE	oj_stack_init(ValStack stack);
+// For a stack that outlives a single parse the owner marks it.
+extern void	oj_stack_mark(ValStack stack);
+
+// Empties the stack for the next document, keeping any memory it has grown.
+inline static void
+stack_reset(ValStack stack) {
+    stack->tail = stack->head;
+    stack->head->val = Qundef;
+    stack->head->key_val = Qundef;
+}
 
 inline static int
 stack_empty(ValStack stack) {
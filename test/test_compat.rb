@@ -358,6 +358,14 @@ class CompatJuice < Minitest::Test
     assert_equal({ :x => true, :y => 58, :z => [1, 2, 3]}, obj)
   end
 
+  def test_cache_keys
+    json = %{[{"x":"one","y":2},{"x":"two","y":[]}]}
+    obj = Oj.compat_load(json, :cache_keys => true)
+    assert_equal([{ 'x' => 'one', 'y' => 2 }, { 'x' => 'two', 'y' => [] }], obj)
+    assert_same(obj[0].keys[0], obj[1].keys[0])
+    assert_same(obj[0].keys[1], obj[1].keys[1])
+  end
+
   # comments
   def test_comment_slash
     json = %{{
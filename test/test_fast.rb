@@ -285,6 +285,104 @@ class DocTest < Minitest::Test
     end
   end
 
+  def test_fetch_wide
+    h = {}
+    100.times { |i| h["k#{i}"] = i }
+    h['a/b'] = 'slash'
+    json = %|{"list":#{(1..100).to_a},"hash":#{Oj.dump(h, :mode => :strict)[0..-2]},"k5":"dup"}}|
+    Oj::Doc.open(json) do |doc|
+      2.times {
+        assert_equal(1, doc.fetch('/list/0'))
+        assert_equal(1, doc.fetch('/list/1'))
+        assert_equal(100, doc.fetch('/list/100'))
+        assert_nil(doc.fetch('/list/101'))
+        assert_equal(99, doc.fetch('/hash/k99'))
+        assert_equal(5, doc.fetch('/hash/k5'))
+        assert_equal('slash', doc.fetch('/hash/a\/b'))
+        assert_nil(doc.fetch('/hash/k100'))
+      }
+      doc.move('/hash/k42')
+      assert_equal('/hash/k42', doc.where?)
+      doc.move('/list/77')
+      assert_equal(77, doc.fetch())
+    end
+  end
+
+  def test_compiled_path
+    json = %|{"users":[{"name":"a","n":1},{"name":"b","n":2},{"name":"c","n":3}],"*":"star","a/b":4}|
+    name = Oj::Doc::Path.new('/users/2/name')
+    all = Oj::Doc::Path.new('/users/*/name')
+    slice = Oj::Doc::Path.new('/users/2../n')
+    up = Oj::Doc::Path.new('/users/1/../3/name')
+    assert_equal('/users/2/name', name.to_s)
+    assert_raises(TypeError) { Oj::Doc::Path.allocate }
+    Oj::Doc.open(json) do |doc|
+      assert_equal('b', doc.fetch(name))
+      assert_equal(%w(a b c), doc.fetch(all))
+      assert_equal([2, 3], doc.fetch(slice))
+      assert_equal([1, 2], doc.fetch(Oj::Doc::Path.new('users/1..2/n')))
+      assert_equal([], doc.fetch(Oj::Doc::Path.new('/users/5..9/n')))
+      assert_equal('c', doc.fetch(up))
+      assert_equal('star', doc.fetch(Oj::Doc::Path.new('/\*')))
+      assert_equal(4, doc.fetch(Oj::Doc::Path.new('/a\/b')))
+      assert_equal(:none, doc.fetch(Oj::Doc::Path.new('/users/4/name'), :none))
+      assert_equal(['star', 4], doc.fetch(Oj::Doc::Path.new('/*'))[1..2])
+      # Position 0 is the first element, the same as for a String path.
+      assert_equal(doc.fetch('/users/0/name'), doc.fetch(Oj::Doc::Path.new('/users/0/name')))
+      assert_equal('a', doc.fetch(Oj::Doc::Path.new('/users/0/name')))
+      assert_equal([1, 2], doc.fetch(Oj::Doc::Path.new('/users/0..2/n')))
+      assert_equal([1], doc.fetch(Oj::Doc::Path.new('/users/0..0/n')))
+      # So is an empty step.
+      assert_equal(doc.fetch('/users//name'), doc.fetch(Oj::Doc::Path.new('/users//name')))
+      assert_equal('a', doc.fetch(Oj::Doc::Path.new('/users//name')))
+
+      doc.move(name)
+      assert_equal('/users/2/name', doc.where?)
+      doc.move('/users')
+      assert_equal(3, doc.fetch(Oj::Doc::Path.new('3/n')))
+      assert_raises(ArgumentError) { doc.move(Oj::Doc::Path.new('/users/9')) }
+
+      keys = []
+      doc.each_child(Oj::Doc::Path.new('/users/*')) { |d| keys << d.where? }
+      assert_equal(%w(/users/1/name /users/1/n /users/2/name /users/2/n /users/3/name /users/3/n), keys)
+      assert_equal('/users', doc.where?)
+    end
+  end
+
+  def test_lazy
+    json = %|{"a":[1,{"b":"x]}\\"y"},/* ] */3],"c":{"d":{"e":[true,null]}},"f":[],"g":{"h":[1,,2]}}|
+    Oj::Doc.open(json, :lazy => true) do |doc|
+      assert_equal('x]}"y', doc.fetch('/a/2/b'))
+      assert_equal(Hash, doc.type('/c/d'))
+      assert_equal([true, nil], doc.fetch('/c/d/e'))
+      assert_equal([], doc.fetch('/f'))
+      doc.move('/c/d')
+      keys = []
+      doc.each_child { |d| keys << d.where? }
+      assert_equal(['/c/d/e'], keys)
+      assert_equal(3, doc.fetch('/a/3'))
+      # Errors in a container only show up once it is read.
+      assert_raises(Oj::ParseError) { doc.fetch('/g/h') }
+    end
+    json = %|{"a":[1,{"b":[2,3]}],"c":{"d":4}}|
+    Oj::Doc.open(json, :lazy => true) do |doc|
+      assert_equal(9, doc.size)
+      assert_equal(json, doc.dump)
+    end
+    # Reading everything is one pass, not one rescan per level.
+    json = '[' * 40000 + '1' + ']' * 40000
+    Oj::Doc.open(json, :lazy => true) do |doc|
+      assert_equal(40001, doc.size)
+      assert_equal(json, doc.dump)
+    end
+    assert_raises(Oj::ParseError) { Oj::Doc.open('{"a":[1,2}', :lazy => true) }
+    # Any true value turns on lazy reading.
+    assert_equal(1, Oj::Doc.open('{"a":1,"g":[1,,2]}', :lazy => 1) { |doc| doc.fetch('/a') })
+    assert_raises(Oj::ParseError) { Oj::Doc.open('{"a":1,"g":[1,,2]}', :lazy => nil) }
+    assert_raises(ArgumentError) { Oj::Doc.open('[1]', {}, 3) }
+    assert_raises(ArgumentError) { Oj::Doc.open_file('no_such_file.json', {}, 3) }
+  end
+
   def test_move_fetch_path
     Oj::Doc.open(@json1) do |doc|
       [['/array/1', 'num', 3],
@@ -371,6 +469,72 @@ class DocTest < Minitest::Test
     end
   end
 
+  def test_open_file_index
+    filename = File.join(File.dirname(__FILE__), 'open_file_index_test.json')
+    index = filename + '.ojx'
+    File.open(filename, 'w') { |f| f.write('{"a":[1,"x\\ty",{"b":null}],"c":12345678901234567890}') }
+    File.delete(index) if File.exist?(index)
+    # The first open parses and writes the index, the second reads it.
+    2.times do
+      Oj::Doc.open_file(filename, :index => index) do |doc|
+        assert_equal(7, doc.size)
+        assert_equal("x\ty", doc.fetch('/a/2'))
+        assert_equal(12345678901234567890, doc.fetch('/c'))
+        assert_equal(%|{"a":[1,"x\\ty",{"b":null}],"c":12345678901234567890}|, doc.dump)
+      end
+      assert(File.exist?(index))
+    end
+    # A changed file is parsed again and the index replaced.
+    File.open(filename, 'w') { |f| f.write('[1,2,3]') }
+    doc = Oj::Doc.open_file(filename, :index => index)
+    assert_equal([1, 2, 3], doc.fetch)
+    doc.close
+    # Same size and second but a different file or nanosecond.
+    mtime = File.mtime(filename)
+    File.open(filename + '.tmp', 'w') { |f| f.write('[4,5,6]') }
+    File.rename(filename + '.tmp', filename)
+    File.utime(mtime, mtime, filename)
+    assert_equal([4, 5, 6], Oj::Doc.open_file(filename, :index => index) { |d| d.fetch })
+    File.open(filename, 'w') { |f| f.write('[7,8,9]') }
+    File.utime(mtime, Time.at(mtime.to_i, 123 == mtime.nsec ? 456 : 123, :nsec), filename)
+    assert_equal([7, 8, 9], Oj::Doc.open_file(filename, :index => index) { |d| d.fetch })
+    # A corrupt index is parsed around and replaced.
+    ix = File.binread(index)
+    File.binwrite(index, ix[0...-32] + ("\xFF" * 32).b)
+    2.times do
+      assert_equal([7, 8, 9], Oj::Doc.open_file(filename, :index => index) { |d| d.fetch })
+      assert_equal(ix, File.binread(index))
+    end
+    # An index that can not be written still leaves the parsed doc.
+    missing = File.join(File.dirname(__FILE__), 'no_such_dir', 'test.ojx')
+    begin
+      verbose, $VERBOSE = $VERBOSE, true
+      assert_output(nil, /Failed to write Oj::Doc index/) {
+        assert_equal([7, 8, 9], Oj::Doc.open_file(filename, :index => missing) { |d| d.fetch })
+      }
+    ensure
+      $VERBOSE = verbose
+    end
+    # Records with a parent type that does not match their container.
+    File.open(filename, 'w') { |f| f.write('{"a":1,"b":{"c":[1,2]}}') }
+    assert_equal(1, Oj::Doc.open_file(filename, :index => index) { |d| d.fetch('/a') })
+    ix = File.binread(index)
+    [[1, 0], [0, 8]].each { |i, t|
+      bad = ix.dup
+      bad.setbyte(ix.size - (6 - i) * 24 + 17, t)
+      File.binwrite(index, bad)
+      assert_equal(1, Oj::Doc.open_file(filename, :index => index) { |d| d.fetch('/a') })
+      assert_equal(ix, File.binread(index))
+      File.binwrite(index, bad)
+      doc = Oj::Doc.open_file(filename, :index => index)
+      assert_equal([1, 2], doc.fetch('/b/c'))
+      doc.close
+    }
+  ensure
+    File.delete(filename) if File.exist?(filename)
+    File.delete(index) if File.exist?(index)
+  end
+
   def test_open_close
     json = %{{"a":[1,2,3]}}
     doc = Oj::Doc.open(json)
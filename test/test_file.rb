@@ -212,6 +212,49 @@ class FileJuice < Minitest::Test
     dump_and_load(DateTime.new(2012, 6, 19), false)
   end
 
+  def test_load_file_page_boundary
+    filename = File.join(File.dirname(__FILE__), 'file_test.json')
+    [4095, 4096, 8192].each { |size|
+      json = %{\xEF\xBB\xBF{"a":[1,2,3],"b":"#{'x' * (size - 24)}"}\n}
+      assert_equal(size, json.bytesize)
+      File.open(filename, "wb") { |f| f.write(json) }
+      assert_equal({ 'a' => [1, 2, 3], 'b' => 'x' * (size - 24) }, Oj.load_file(filename, :mode => :strict))
+      File.open(filename) { |f| assert_equal(%w(a b), Oj.load(f, :mode => :strict).keys) }
+      # An unterminated document must stop at the end of the file.
+      File.open(filename, "wb") { |f| f.write('[' + '1,' * ((size - 2) / 2) + (size.even? ? '1' : '')) }
+      assert_raises(Oj::ParseError) { Oj.load_file(filename, :mode => :strict) }
+    }
+    File.open(filename, "w") { |f| f.write(%{{"x":1} {"x":2}}) }
+    results = []
+    Oj.load_file(filename, :mode => :compat) { |x| results << x }
+    assert_equal([{ 'x' => 1 }, { 'x' => 2 }], results)
+  end
+
+  def test_load_file_truncated_compat
+    filename = File.join(File.dirname(__FILE__), 'file_test.json')
+    File.open(filename, "w") { |f| f.write('{"a":[1,2,') }
+    assert_raises(Oj::ParseError) { Oj.load_file(filename, :mode => :compat) }
+    File.open(filename) { |f|
+      assert_raises(Oj::ParseError) { Oj.load(f, :mode => :compat) }
+    }
+    # The message does not include the contents of a large file.
+    File.open(filename, "w") { |f| f.write('[' + '1,' * 100000 + ']') }
+    e = assert_raises(Oj::ParseError) { Oj.load_file(filename, :mode => :compat) }
+    assert(200 > e.message.size, "message is #{e.message.size} bytes")
+  end
+
+  def test_load_file_fifo
+    return unless File.respond_to?(:mkfifo) && Process.respond_to?(:fork)
+    filename = File.join(File.dirname(__FILE__), 'file_test.fifo')
+    File.unlink(filename) if File.exist?(filename)
+    File.mkfifo(filename)
+    pid = fork { File.open(filename, 'w') { |f| f.write(%{[1,"two",{"three":3}]}) } }
+    assert_equal([1, 'two', { 'three' => 3 }], Oj.load_file(filename, :mode => :strict))
+    Process.wait(pid)
+  ensure
+    File.unlink(filename) if filename && File.exist?(filename)
+  end
+
   def dump_and_load(obj, trace=false)
     filename = File.join(File.dirname(__FILE__), 'file_test.json')
     File.open(filename, "w") { |f|
@@ -0,0 +1,65 @@
+#!/usr/bin/env ruby
+# encoding: UTF-8
+
+$: << File.dirname(__FILE__)
+
+require 'helper'
+
+class NDJSONTest < Minitest::Test
+
+  def test_load_string
+    json = %|{"a":1}\n\n[1,2,"x"]\n  \r\n"str"\r\n{"b":{"c":null}}|
+    expect = [{ 'a' => 1 }, [1, 2, 'x'], 'str', { 'b' => { 'c' => nil } }]
+    assert_equal(expect, Oj.load_ndjson(json, :mode => :strict))
+    docs = []
+    assert_nil(Oj.load_ndjson(json, :mode => :compat) { |doc| docs << doc })
+    assert_equal(expect, docs)
+    assert_equal([1], Oj.load_ndjson("\n1", :mode => :strict))
+  end
+
+  def test_load_io
+    json = (1..5000).map { |i| %|{"id":#{i},"name":"n#{i}"}| }.join("\n") + "\n"
+    docs = Oj.load_ndjson(StringIO.new(json), :mode => :strict, :cache_keys => true)
+    assert_equal(5000, docs.size)
+    assert_equal({ 'id' => 5000, 'name' => 'n5000' }, docs[-1])
+    assert_same(docs[0].keys[0], docs[-1].keys[0])
+  end
+
+  def test_batches
+    nd = Oj::NDJSON.new("1\n2\n3\n4\n5", :mode => :strict)
+    assert_equal([1, 2], nd.read(2))
+    assert_equal(2, nd.line)
+    assert_equal([3, 4, 5], nd.read)
+    assert_equal([], nd.read(2))
+    assert_equal([[1, 2], [3]], Oj::NDJSON.new("1\n2\n3", :mode => :strict).each_slice(2).to_a)
+    assert_raises(TypeError) { Oj::NDJSON.allocate }
+  end
+
+  def test_errors
+    json = %|{"a":1}\n{"a":\n[1,2]\n{"x" 1}\n5|
+    e = assert_raises(Oj::ParseError) { Oj.load_ndjson(json, :mode => :strict) }
+    assert(e.message.include?('NDJSON line 2'), e.message)
+
+    nd = Oj::NDJSON.new(json, :mode => :strict, :skip_errors => true)
+    assert_equal([{ 'a' => 1 }, [1, 2], 5], nd.to_a)
+    assert_equal([2, 4], nd.errors.map { |err| err[0] })
+  end
+
+  def test_threads
+    lines = [
+      %|{"a":1,"b":[1,2.5,-3e10,true,false,null],"c":{"d":"x\\ny\\u00e9\\ud83d\\ude00"}}|,
+      %|{"x" 1}|, '', %|[[[1]]]|, %|12345678901234567890123|, %|/* c */ [1]|, %|{"a":01}|, %|"end"|,
+    ]
+    json = (lines * 2000).join("\n")
+    [:strict, :compat, :object].each do |mode|
+      serial = Oj::NDJSON.new(json, :mode => mode, :skip_errors => true)
+      threaded = Oj::NDJSON.new(json, :mode => mode, :skip_errors => true, :threads => 3)
+      assert_equal(serial.to_a, threaded.to_a)
+      assert_equal(serial.errors, threaded.errors)
+      assert_equal(serial.line, threaded.line)
+    end
+    e = assert_raises(Oj::ParseError) { Oj.load_ndjson(json, :mode => :strict, :threads => 3) }
+    assert(e.message.include?('NDJSON line 2'), e.message)
+  end
+
+end # NDJSONTest
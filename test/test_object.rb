@@ -492,6 +492,17 @@ class ObjectJuice < Minitest::Test
     assert_equal(t.utc_offset, loaded.utc_offset)
   end
 
+  def test_xml_time_five_digit_year
+    t = Time.utc(12000, 1, 1)
+    assert_equal(%{{"^t":"12000-01-01T00:00:00Z"}}, Oj.dump(t, :mode => :object, :time_format => :xmlschema))
+    t = Time.new(36812, 2, 19, 16, 36, 16, -8 * 3600)
+    assert_equal(%{{"^t":"36812-02-19T16:36:16-08:00"}}, Oj.dump(t, :mode => :object, :time_format => :xmlschema))
+    t = Time.utc(12000, 1, 1, 0, 0, 0.5r)
+    assert_equal(%{{"^t":"12000-01-01T00:00:00.500Z"}}, Oj.dump(t, :mode => :object, :time_format => :xmlschema, :second_precision => 3))
+    t = Time.new(12000, 1, 1, 0, 0, 0.5r, -8 * 3600)
+    assert_equal(%{{"^t":"12000-01-01T00:00:00.500000000-08:00"}}, Oj.dump(t, :mode => :object, :time_format => :xmlschema))
+  end
+
   def test_ruby_time
     t = Time.new(2015, 1, 5, 21, 37, 7.123456789, -8 * 3600)
     # The fractional seconds are not always recreated exactly which causes a
@@ -0,0 +1,46 @@
+#!/usr/bin/env ruby
+# encoding: UTF-8
+
+$: << File.dirname(__FILE__)
+
+require 'helper'
+
+class ParserTest < Minitest::Test
+
+  def test_reuse
+    p = Oj::Parser.new(:mode => :strict, :cache_keys => true)
+    deep = ('[' * 200) + (']' * 200)
+    json = %|{"id":1,"name":"a\\nb\\u00e9","tags":["x","y"]}|
+    first = p.parse(json)
+    assert_equal({ 'id' => 1, 'name' => "a\nbé", 'tags' => ['x', 'y'] }, first)
+    assert_equal(Oj.load(deep, :mode => :strict), p.parse(deep))
+    second = p.parse(json)
+    assert_equal(first, second)
+    assert_same(first.keys[0], second.keys[0])
+    assert_equal(%|"#{'x' * 100_000}\\t"|.length - 3, p.parse(%|"#{'x' * 100_000}\\t"|).length)
+  end
+
+  def test_modes
+    compat = Oj::Parser.new(:mode => :compat)
+    assert_nil(compat.parse(nil))
+    assert(compat.parse('[NaN]')[0].nan?)
+    assert_raises(Oj::ParseError) { compat.parse('') }
+    assert_equal({ :a => 1 }, Oj::Parser.new(Oj::Options.new(:mode => :strict, :symbol_keys => true)).parse('{"a":1}'))
+    assert_equal(Time.at(1, 5), Oj::Parser.new(:mode => :object).parse('{"^t":1.000005}'))
+
+    docs = []
+    Oj::Parser.new(:mode => :strict).parse('[1] {"a":2}') { |doc| docs << doc }
+    assert_equal([[1], { 'a' => 2 }], docs)
+  end
+
+  def test_errors
+    p = Oj::Parser.new(:mode => :strict)
+    assert_raises(Oj::ParseError) { p.parse('{"a":') }
+    assert_raises(Oj::ParseError) { p.parse('[1,"\\x"]') }
+    assert_raises(Oj::ParseError) { p.parse('[1]]') }
+    assert_equal([1, { 'b' => nil }], p.parse('[1,{"b":null}]'))
+    assert_raises(TypeError) { Oj::Parser.new([]) }
+    assert_raises(TypeError) { Oj::Parser.allocate }
+  end
+
+end # ParserTest
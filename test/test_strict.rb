@@ -69,6 +69,13 @@ class StrictJuice < Minitest::Test
     dump_and_load(-2.48e100 * 1.0e10, false)
   end
 
+  def test_float_shortest
+    [0.1, 1.0/3.0, -2.5e-5, 0.0001, 1.0e-5, 123456.789, 4.35e-10, 1.0e23,
+     5.0e-324, 2.2250738585072014e-308, 1.7976931348623157e308, -9.87e-100].each { |f|
+      assert_equal(f.to_s, Oj.dump(f, :mode => :strict, :float_precision => 0))
+    }
+  end
+
   def test_nan_dump
     assert_equal('null', Oj.dump(0/0.0, :nan => :null))
     assert_equal('3.3e14159265358979323846', Oj.dump(0/0.0, :nan => :huge))
@@ -143,6 +150,13 @@ class StrictJuice < Minitest::Test
     assert_equal(json, json2)
   end
 
+  def test_escaped_runs
+    (1..70).each { |n|
+      s = %{#{'a' * n}\n#{'b' * (70 - n)}"\\}
+      assert_equal([s, s], Oj.strict_load(Oj.dump([s, s], :mode => :strict)))
+    }
+  end
+
   def test_array
     dump_and_load([], false)
     dump_and_load([true, false], false)
@@ -262,6 +276,30 @@ class StrictJuice < Minitest::Test
     assert_equal({ 'x' => true, 'y' => 58, 'z' => [1, 2, 3]}, obj)
   end
 
+  class Trickle
+    def initialize(str, max)
+      @str = str
+      @max = max
+      @pos = 0
+    end
+
+    def readpartial(len)
+      raise EOFError if @str.bytesize <= @pos
+      s = @str.byteslice(@pos, [len, @max].min)
+      @pos += s.bytesize
+      s
+    end
+  end
+
+  def test_io_partial
+    # strings longer than the read buffer and reads of varied sizes
+    obj = ['x' * 100_000, { 'a' => "b\0c" * 1000 }, (1..3000).map { |i| "s#{i}" }, 12345678901234567890]
+    json = Oj.dump(obj, :mode => :strict)
+    [3, 4096, 70_000].each { |max|
+      assert_equal(obj, Oj.strict_load(Trickle.new(json, max)))
+    }
+  end
+
   def test_io_file
     filename = File.join(File.dirname(__FILE__), 'open_file_test.json')
     File.open(filename, 'w') { |f| f.write(%{{
@@ -324,6 +362,38 @@ class StrictJuice < Minitest::Test
     assert_equal({ :x => true, :y => 58, :z => [1, 2, 3]}, obj)
   end
 
+  def test_cache_keys
+    json = %{[{"id":1,"name":"a"},{"id":2,"na\\u006de":"b"}]}
+    obj = Oj.strict_load(json, :cache_keys => true)
+    assert_equal([{ 'id' => 1, 'name' => 'a' }, { 'id' => 2, 'name' => 'b' }], obj)
+    assert(obj[0].keys[0].frozen?)
+    assert_same(obj[0].keys[0], obj[1].keys[0])
+    assert_same(obj[0].keys[1], obj[1].keys[1])
+    assert_equal(Encoding::UTF_8, obj[0].keys[0].encoding)
+
+    obj = Oj.strict_load(json, :cache_keys => true, :symbol_keys => true)
+    assert_equal([{ :id => 1, :name => 'a' }, { :id => 2, :name => 'b' }], obj)
+  end
+
+  def test_cache_str
+    json = %{[{"s":"USD","t":"a longer string"},{"s":"USD","t":"a longer string"},["GET","USD"],"GET"]}
+    stats = Oj.cache_stats
+    obj = Oj.strict_load(json, :cache_str => 8)
+    assert_equal([{ 's' => 'USD', 't' => 'a longer string' }, { 's' => 'USD', 't' => 'a longer string' }, ['GET', 'USD'], 'GET'], obj)
+    assert(obj[0]['s'].frozen?)
+    assert_same(obj[0]['s'], obj[1]['s'])
+    assert_same(obj[0]['s'], obj[2][1])
+    assert_same(obj[2][0], obj[3])
+    refute(obj[0]['t'].frozen?)
+    after = Oj.cache_stats
+    assert_equal(3, after[:str_hits] - stats[:str_hits])
+    assert_equal(2, after[:str_misses] - stats[:str_misses])
+
+    # more distinct values than the cache holds
+    values = (0...10000).map { |i| "v#{i}" }
+    assert_equal(values, Oj.strict_load(Oj.dump(values), :cache_str => 8))
+  end
+
   def test_symbol_keys_safe
     json = %{{
   "x":true,
@@ -371,6 +441,19 @@ class StrictJuice < Minitest::Test
     assert_equal({ 'x' => true, 'y' => 58, 'z' => [1, 2, 3]}, obj)
   end
 
+  def test_large_whitespace
+    # long enough to be indexed before parsing
+    json = %{[
+  #{' ' * 70}"#{'a' * 100}",
+  "a\\"b#{' ' * 64}\\\\",/* "not a string" */
+  {"key" :#{"\t" * 130}[1, 2.5, true]}
+]
+}
+    obj = Oj.strict_load(json)
+    assert_equal(['a' * 100, %{a"b#{' ' * 64}\\}, { 'key' => [1, 2.5, true] }], obj)
+    assert_raises(Oj::ParseError) { Oj.strict_load(%{["#{'x' * 300}}) }
+  end
+
   def test_double
     json = %{{ "x": 1}{ "y": 2}}
     results = []
@@ -153,6 +153,8 @@ class Juice < Minitest::Test
       :hash_class=>Hash,
       :omit_nil=>false,
       :allow_nan=>true,
+      :cache_keys=>true,
+      :cache_str=>6,
       :array_class=>Array,
     }
     Oj.default_options = alt
@@ -206,6 +208,17 @@ class Juice < Minitest::Test
 
   end
 
+  def test_float_parse_rounding
+    Oj.default_options = { :bigdecimal_load => :float }
+    %w(0.1 1000.0000123456789 -0.000012345678901234567 9007199254740993.0
+       2.2250738585072011e-308 4.9e-324 1.7976931348623157e308 1e-400
+       0.00000009458052487095 123456789012345678901234567890.5).each { |s|
+      n = Oj.load(s)
+      assert_equal(Float, n.class)
+      assert_equal(s.to_f, n, s)
+    }
+  end
+
 =begin
 # TBD move to custom
   def test_float_dump
@@ -305,6 +318,106 @@ class Juice < Minitest::Test
 
   end
 
+  def test_compiled_options
+    opts = Oj::Options.new(:mode => :strict, :symbol_keys => true, :indent => 2)
+    assert(opts.frozen?)
+    assert_equal({:mode => :strict, :symbol_keys => true, :indent => 2}, opts.to_h)
+    assert_equal({:a => [1, 2.5, nil]}, Oj.load('{"a":[1,2.5,null]}', opts))
+    assert_equal(%|{\n  "a":1\n}\n|, Oj.dump({ 'a' => 1 }, opts))
+
+    w = Oj::StringWriter.new(opts)
+    w.push_object()
+    w.push_value(1, 'a')
+    w.pop()
+    assert_equal(%|{\n  "a":1\n}\n|, w.to_s)
+
+    # Options not in the Hash keep the per mode adjustments.
+    compat = Oj::Options.new(:mode => :compat)
+    assert_equal(Oj.load('[NaN]', :mode => :compat)[0].nan?, Oj.load('[NaN]', compat)[0].nan?)
+    assert_nil(Oj.load(nil, compat))
+    assert_raises(StandardError) { Oj.dump(1.0/0.0, :mode => :compat) }
+    assert_raises(StandardError) { Oj.dump(1.0/0.0, compat) }
+
+    rx = Oj::Options.new(:mode => :compat, :create_additions => true, :match_string => { /^\d{4}$/ => Jeez })
+    GC.start
+    assert_equal([String, Jeez], Oj.load('["abc","2017"]', rx).map(&:class))
+
+    # The create_id is copied so changing the defaults later does not free it.
+    Oj.default_options = { :create_id => 'klass_x' }
+    kx = Oj::Options.new(:mode => :compat, :create_additions => true)
+    Oj.default_options = { :create_id => nil }
+    GC.start
+    jeez = Oj.load(%|{"klass_x":"Juice::Jeez","x":1,"y":2}|, kx)
+    assert_equal(Jeez, jeez.class)
+
+    assert_raises(ArgumentError) { Oj::Options.new(:mode => :bogus) }
+    assert_raises(TypeError) { Oj::Options.new([]) }
+  end
+
+  def test_dumper
+    d = Oj::Dumper.new(:mode => :compat, :indent => 1)
+    small = { 'a' => [1, 2.5, "x\ny"], 'b' => nil }
+    big = (1..2000).map { |i| { 'id' => i, 'name' => "n#{i}" } }
+    [small, big, big, small, big].each { |obj|
+      assert_equal(Oj.dump(obj, :mode => :compat, :indent => 1), d.dump(obj))
+    }
+    assert_equal(Encoding::UTF_8, d.dump(big).encoding)
+    assert_raises(StandardError) { d.dump(1.0/0.0) }
+    assert_equal(Oj.dump(small, :mode => :compat, :indent => 1), d.dump(small))
+    assert_equal('{"a":1}', Oj::Dumper.new(Oj::Options.new(:mode => :strict)).dump({ 'a' => 1 }))
+    assert_raises(TypeError) { Oj::Dumper.new([]) }
+    assert_raises(TypeError) { Oj::Dumper.allocate }
+  end
+
+  def test_dump_to
+    buf = 'data: '.dup
+    assert_same(buf, Oj.dump_to(buf, { 'a' => [1, 'x'] }, :mode => :compat))
+    assert_equal('data: {"a":[1,"x"]}', buf)
+    big = (1..3000).to_a
+    Oj.dump_to(buf, big, Oj::Options.new(:mode => :strict))
+    assert_equal('data: {"a":[1,"x"]}' + Oj.dump(big, :mode => :strict), buf)
+    assert_equal(Encoding::UTF_8, Oj.dump_to(''.dup, 'x').encoding)
+    # A failed dump leaves the buffer as it was.
+    buf = 'x'.dup
+    assert_raises(StandardError) { Oj.dump_to(buf, [1, 1.0/0.0], :mode => :compat) }
+    assert_equal('x', buf)
+    buf << 'y'
+    assert_equal('xy', buf)
+    assert_raises(FrozenError) { Oj.dump_to('x'.freeze, 1) } if defined?(FrozenError)
+    assert_raises(ArgumentError) { Oj.dump_to(''.dup, 1, {}, 3) }
+  end
+
+  def test_dump_to_encoding
+    buf = Oj.dump_to('abc'.dup.force_encoding('US-ASCII'), "\u00e9")
+    assert_equal(Encoding::UTF_8, buf.encoding)
+    assert_equal(%{abc"\u00e9"}, buf)
+    buf = Oj.dump_to("\xE9:".dup.force_encoding('ISO-8859-1'), "\u00e9")
+    assert(buf.valid_encoding?)
+    assert_equal(%{\u00e9:"\u00e9"}, buf)
+    buf = "\xE9".dup.force_encoding('ASCII-8BIT')
+    assert_raises(Encoding::CompatibilityError) { Oj.dump_to(buf, 1) }
+    assert_equal("\xE9".b, buf)
+  end
+
+  class DupBuffer
+    def initialize(buf)
+      @buf = buf
+    end
+    def to_json(*)
+      @copy = @buf.dup
+      '1'
+    end
+  end
+
+  def test_dump_to_shared
+    buf = ('x' * 3000).force_encoding('US-ASCII')
+    Oj.dump_to(buf, buf)
+    assert_equal('x' * 3000 + %{"#{'x' * 3000}"}, buf)
+    buf = 'y' * 3000
+    Oj.dump_to(buf, [DupBuffer.new(buf)] + (1..2000).to_a, :mode => :compat, :use_to_json => true)
+    assert_equal('y' * 3000 + Oj.dump([1] + (1..2000).to_a), buf)
+  end
+
   def test_null_char
     assert_raises(Oj::ParseError) { Oj.load("\"\0\"") }
     assert_raises(Oj::ParseError) { Oj.load("\"\\\0\"") }
@@ -376,6 +489,21 @@ class Juice < Minitest::Test
     out = Oj.dump(hash, :escape_mode => :xss_safe)
     assert_equal(%{{"key":"\\u003cscript\\u003ealert(123) \\u0026\\u0026 formatHD()\\u003c\\/script\\u003e"}}, out)
   end
+  def test_escapes_in_long_strings
+    pre = 'x' * 37
+    s = "#{pre}<a\u00e9\n#{pre}\"\u2028/#{pre}\\"
+    assert_equal(%{"#{pre}<a\u00e9\\n#{pre}\\"\u2028/#{pre}\\\\"}, Oj.dump(s, :escape_mode => :json))
+    assert_equal(%{"#{pre}<a\\u00e9\\n#{pre}\\"\\u2028/#{pre}\\\\"}, Oj.dump(s, :escape_mode => :ascii))
+    assert_equal(%{"#{pre}\\u003ca\\u00e9\\n#{pre}\\"\\u2028\\/#{pre}\\\\"}, Oj.dump(s, :escape_mode => :xss_safe))
+    assert_equal(%{"#{pre}\\u003ca\u00e9\\n#{pre}\\"\\u2028/#{pre}\\\\"}, Oj.dump(s, :escape_mode => :unicode_xss))
+  end
+  def test_repeated_keys_escape_mode
+    h = { :'a<b' => 1, 'c/d' => 2 }
+    2.times {
+      assert_equal(%{{"a<b":1,"c/d":2}}, Oj.dump(h, :mode => :strict, :escape_mode => :json))
+      assert_equal(%{{"a\\u003cb":1,"c\\/d":2}}, Oj.dump(h, :mode => :strict, :escape_mode => :xss_safe))
+    }
+  end
   def test_escape_newline_by_default
     Oj.default_options = { :escape_mode => :json }
     json = %{["one","two\\n2"]}
@@ -557,6 +685,46 @@ class Juice < Minitest::Test
     assert_equal(src, obj)
   end
 
+  def test_io_large
+    # Larger than the buffer so it is written out in pieces.
+    src = (1..20000).map { |i| { 'id' => i, 'name' => "n#{i}", 'list' => [1, { 'x' => nil }] } }
+    expect = Oj.dump(src, :mode => :compat, :indent => 2)
+    output = StringIO.new
+    Oj.to_stream(output, src, :mode => :compat, :indent => 2)
+    assert_equal(expect, output.string)
+    filename = File.join(File.dirname(__FILE__), 'open_file_test.json')
+    File.open(filename, "w") { |f|
+      f.write('[')
+      Oj.to_stream(f, src, :mode => :compat, :indent => 2)
+    }
+    assert_equal('[' + expect, File.read(filename))
+    Oj.to_file(filename, src, :mode => :compat, :indent => 2)
+    assert_equal(expect, File.read(filename))
+    # A dump that fails leaves the file as it was, even after a flush.
+    [[1, Object.new], src + [Object.new]].each { |bad|
+      assert_raises(TypeError) { Oj.to_file(filename, bad, :mode => :strict) }
+      assert_equal(expect, File.read(filename))
+    }
+    assert_equal([File.basename(filename)], Dir.glob(filename + '*').map { |f| File.basename(f) })
+  end
+
+  def test_io_large_nested
+    # The closing indents land across a flush of the buffer.
+    filename = File.join(File.dirname(__FILE__), 'open_file_test.json')
+    [:custom, :object, :rails].each { |mode|
+      (60_000..64_000).step(97) { |pad|
+        src = Jam.new(1, 'x' * pad)
+        40.times { |i| src = Jam.new(src, i) }
+        expect = Oj.dump(src, :mode => mode, :indent => 2)
+        output = StringIO.new
+        Oj.to_stream(output, src, :mode => mode, :indent => 2)
+        assert_equal(expect, output.string)
+        Oj.to_file(filename, src, :mode => mode, :indent => 2)
+        assert_equal(expect, File.read(filename))
+      }
+    }
+  end
+
 # comments
   def test_comment_slash
     json = %{{
@@ -13,8 +13,10 @@ require 'test_fast'
 require 'test_file'
 require 'test_gc'
 require 'test_hash'
+require 'test_ndjson'
 require 'test_null'
 require 'test_object'
+require 'test_parser'
 require 'test_saj'
 require 'test_scp'
 require 'test_strict'